@@ -1,24 +1,43 @@
 package `is`.xyz.mpv
 
+import android.content.ComponentCallbacks2
 import android.content.Context
 import android.graphics.Bitmap
+import android.net.Uri
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
-import kotlinx.coroutines.withContext
+import kotlinx.coroutines.async
+import kotlinx.coroutines.coroutineScope
+import java.io.Closeable
+import java.io.File
+import java.util.ArrayDeque
 import java.util.concurrent.atomic.AtomicBoolean
 
 object FastThumbnails {
     private val initialized = AtomicBoolean(false)
     
+    // grabThumbnailFast flag on top of the SeekMode bits
+    private const val FLAG_REPRESENTATIVE = 0x4
+    private const val FLAG_COVER_ART = 0x8
+    
+    // Histogram buckets per stage in getThumbnailStats
+    private const val STATS_BUCKETS = 16
+    
     /**
      * Initialize the fast thumbnail system.
      * Call this once before generating thumbnails (typically in Application.onCreate).
      * 
+     * Persistent data such as keyframe indexes for files that are slow to seek
+     * and previously generated thumbnails of local files is kept in a
+     * "thumbnails" directory inside the app's cache directory.
+     * 
      * @param context Application context
      */
     @JvmStatic
     fun initialize(context: Context) {
         if (initialized.compareAndSet(false, true)) {
             MPVLib.setThumbnailJavaVM(context.applicationContext)
+            MPVLib.setThumbnailCacheDir(File(context.cacheDir, "thumbnails").absolutePath)
         }
     }
     
@@ -29,7 +48,8 @@ object FastThumbnails {
     fun isInitialized(): Boolean = initialized.get()
     
     /**
-     * Clear internal codec cache and hardware context.
+     * Clear the in-memory thumbnail cache, internal codec cache, hardware context
+     * and idle decode sessions.
      * Call this when you want to free up memory (e.g., onLowMemory callback).
      * The cache will be rebuilt automatically on next thumbnail generation.
      * 
@@ -39,18 +59,210 @@ object FastThumbnails {
     @JvmStatic
     fun clearCache() {
         if (initialized.get()) {
-            MPVLib.clearThumbnailCache()
+            MPVLib.clearThumbnailCache(0)
+        }
+    }
+    
+    /**
+     * Release memory according to an onTrimMemory level.
+     * Mild levels only shrink the in-memory thumbnail cache, severe ones clear
+     * everything like [clearCache].
+     * 
+     * @param level Level passed to ComponentCallbacks2.onTrimMemory
+     */
+    @JvmStatic
+    @Suppress("DEPRECATION")
+    fun trimMemory(level: Int) {
+        if (!initialized.get())
+            return
+        val keepPercent = when {
+            level >= ComponentCallbacks2.TRIM_MEMORY_MODERATE -> 0
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND -> 25
+            level >= ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN -> 50
+            level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL -> 0
+            level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW -> 25
+            level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_MODERATE -> 75
+            else -> return
         }
+        MPVLib.clearThumbnailCache(keepPercent)
     }
     
     /**
-     * Generate thumbnail using fast FFmpeg direct API
+     * Set the maximum size of the in-memory thumbnail cache (default: 32 MiB).
+     * Repeated requests for the same position and dimension are served from it
+     * without decoding.
+     * 
+     * @param bytes Cache size in bytes, 0 disables the cache
+     */
+    @JvmStatic
+    fun setMemoryCacheSize(bytes: Long) {
+        require(bytes >= 0) { "Cache size must not be negative" }
+        MPVLib.setThumbnailMemoryCacheSize(bytes)
+    }
+    
+    /**
+     * Counters of the in-memory thumbnail cache and of the scaler context pool.
+     */
+    data class CacheStats(
+        val hits: Long,
+        val misses: Long,
+        val entries: Long,
+        val bytes: Long,
+        val maxBytes: Long,
+        val scalerHits: Long,
+        val scalerMisses: Long
+    ) {
+        val hitRate: Double
+            get() = if (hits + misses > 0) hits.toDouble() / (hits + misses) else 0.0
+        
+        val scalerHitRate: Double
+            get() = if (scalerHits + scalerMisses > 0) scalerHits.toDouble() / (scalerHits + scalerMisses) else 0.0
+    }
+    
+    /**
+     * Get the current thumbnail cache counters.
+     */
+    @JvmStatic
+    fun getCacheStats(): CacheStats {
+        val v = MPVLib.getThumbnailCacheStats()?.takeIf { it.size >= 7 } ?: LongArray(7)
+        return CacheStats(v[0], v[1], v[2], v[3], v[4], v[5], v[6])
+    }
+    
+    /**
+     * Time spent in one stage of thumbnail generation, over all requests.
+     * [histogram] counts calls by duration: bucket i holds those under
+     * 2^i ms (the first one under 1ms), the last one everything longer.
+     */
+    data class StageStats(
+        val count: Long,
+        val totalMs: Double,
+        val maxMs: Double,
+        val histogram: LongArray
+    ) {
+        val averageMs: Double
+            get() = if (count > 0) totalMs / count else 0.0
+        
+        /**
+         * Upper bound of the bucket the given share of calls falls into,
+         * e.g. percentileMs(0.95). Infinite if that is the last bucket.
+         */
+        fun percentileMs(fraction: Double): Double {
+            if (count == 0L) return 0.0
+            val target = fraction.coerceIn(0.0, 1.0) * count
+            var seen = 0L
+            for (i in histogram.indices) {
+                seen += histogram[i]
+                if (seen >= target)
+                    return if (i == histogram.size - 1) Double.POSITIVE_INFINITY else (1L shl i).toDouble()
+            }
+            return Double.POSITIVE_INFINITY
+        }
+    }
+    
+    /**
+     * Where thumbnail generation spends its time, to tell slow storage from
+     * slow demuxing or decoding on a given device. Bytes read and seeks only
+     * cover local files and file descriptors.
+     */
+    data class Stats(
+        val requests: Long,
+        val cacheHits: Long,
+        val failures: Long,
+        val framesDecoded: Long,
+        val packetsRead: Long,
+        val bytesRead: Long,
+        val ioSeeks: Long,
+        /** avformat_open_input and decoder setup */
+        val open: StageStats,
+        /** Stream probing, skipped for sessions that are reused */
+        val probe: StageStats,
+        val seek: StageStats,
+        val decode: StageStats,
+        val scale: StageStats,
+        /** Creating or filling the Bitmap */
+        val bitmap: StageStats,
+        /** Whole requests, including cached ones */
+        val total: StageStats
+    )
+    
+    /**
+     * Get the per-stage timing of thumbnail generation since start (or the
+     * last [resetStats]).
+     */
+    @JvmStatic
+    fun getStats(): Stats? {
+        val v = MPVLib.getThumbnailStats() ?: return null
+        val counters = 7
+        val stageSize = 3 + STATS_BUCKETS
+        if (v.size < counters + 7 * stageSize) return null
+        fun stage(i: Int): StageStats {
+            val o = counters + i * stageSize
+            return StageStats(v[o], v[o + 1] / 1000.0, v[o + 2] / 1000.0,
+                v.copyOfRange(o + 3, o + stageSize))
+        }
+        return Stats(v[0], v[1], v[2], v[3], v[4], v[5], v[6],
+            stage(0), stage(1), stage(2), stage(3), stage(4), stage(5), stage(6))
+    }
+    
+    /**
+     * Start the numbers reported by [getStats] over.
+     */
+    @JvmStatic
+    fun resetStats() {
+        MPVLib.resetThumbnailStats()
+    }
+    
+    /**
+     * Set the maximum size of the persistent thumbnail cache (default: 64 MiB).
+     * Least recently used thumbnails are evicted once it is exceeded.
+     * 
+     * @param bytes Cache size in bytes
+     */
+    @JvmStatic
+    fun setDiskCacheSize(bytes: Long) {
+        require(bytes >= 0) { "Cache size must not be negative" }
+        MPVLib.setThumbnailDiskCacheSize(bytes)
+    }
+    
+    /**
+     * Delete all thumbnails stored in the persistent thumbnail cache.
+     */
+    @JvmStatic
+    fun clearDiskCache() {
+        if (initialized.get()) {
+            MPVLib.clearThumbnailDiskCache()
+        }
+    }
+    
+    /**
+     * Set how many thumbnails may be decoded in parallel.
+     * Requests beyond this wait for a free worker. The default depends on the
+     * number of CPU cores (at most 4).
+     * 
+     * @param count Number of workers, 0 to restore the default
+     */
+    @JvmStatic
+    fun setWorkerCount(count: Int) {
+        require(count in 0..16) { "Worker count must be between 0 and 16 (got $count)" }
+        MPVLib.setThumbnailWorkerCount(count)
+    }
+    
+    /**
+     * Generate thumbnail using fast FFmpeg direct API.
+     * Safe to call from several threads, calls for different files (or
+     * different positions of the same file) decode in parallel.
+     * 
+     * Besides paths and URLs, path can be "fd://N" for an open file descriptor,
+     * see the [Uri] overload. The descriptor only has to stay open during the call.
      * 
      * @param path File path or URL to the video
      * @param position Time position in seconds (default: 0.0)
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
-     * @return Bitmap thumbnail, or null if generation fails
+     * @param seekMode How closely the frame has to match position (default: [SeekMode.FAST])
+     * @param request Token to cancel the work with or give it a deadline, see [newRequest]
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
+     * @return Bitmap thumbnail, or null if generation fails or is cancelled
      * @throws IllegalStateException if not initialized
      */
     @JvmStatic
@@ -59,7 +271,10 @@ object FastThumbnails {
         path: String,
         position: Double = 0.0,
         dimension: Int = 512,
-        useHwDec: Boolean = true
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        request: Request? = null,
+        format: OutputFormat = OutputFormat.ARGB_8888
     ): Bitmap? {
         check(initialized.get()) {
             "FastThumbnails not initialized. Call initialize(context) first."
@@ -70,39 +285,335 @@ object FastThumbnails {
         }
         
         return try {
-            MPVLib.grabThumbnailFast(path, position, dimension, useHwDec)
+            MPVLib.grabThumbnailFast(path, position, dimension, useHwDec, seekMode.flag or format.flag,
+                null, request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            null
+        }
+    }
+    
+    /**
+     * Generate a thumbnail for a content:// (or file://) URI, read directly
+     * through its file descriptor instead of a copy of the file.
+     * 
+     * @param context Context to resolve the URI with
+     * @param uri URI of the video
+     * @param position Time position in seconds (default: 0.0)
+     * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
+     * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param seekMode How closely the frame has to match position (default: [SeekMode.FAST])
+     * @return Bitmap thumbnail, or null if the URI can't be opened or generation fails
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generate(
+        context: Context,
+        uri: Uri,
+        position: Double = 0.0,
+        dimension: Int = 512,
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST
+    ): Bitmap? {
+        val pfd = try {
+            context.contentResolver.openFileDescriptor(uri, "r")
         } catch (e: Exception) {
             e.printStackTrace()
             null
+        } ?: return null
+        return pfd.use { generate("fd://${it.fd}", position, dimension, useHwDec, seekMode) }
+    }
+    
+    /**
+     * How closely a thumbnail has to match the requested position.
+     */
+    enum class SeekMode(internal val flag: Int) {
+        /** Any frame within a few seconds of the position. Fastest, for seekbar previews. */
+        FAST(0),
+        /** The keyframe at or before the position, nothing else is decoded. */
+        KEYFRAME(1),
+        /** The frame at the position, decoded from the previous keyframe. For chapter or bookmark images. */
+        EXACT(2)
+    }
+    
+    /**
+     * Pixel format of generated thumbnails. Frames are always scaled in full
+     * colour and converted afterwards; the memory cache keeps the converted
+     * copy, so smaller formats also fit more thumbnails into its budget.
+     */
+    enum class OutputFormat(internal val flag: Int) {
+        /** 4 bytes per pixel, full quality. */
+        ARGB_8888(0),
+        /** 2 bytes per pixel, dithered. Good enough for seekbar previews and grids. */
+        RGB_565(0x10),
+        /**
+         * 1 byte per pixel of luma. Android has no grayscale bitmap, so this is an
+         * ALPHA_8 bitmap with the luma in its alpha channel; draw it with a [android.graphics.Paint]
+         * of the wanted colour over a black background.
+         */
+        GRAY_8(0x20)
+    }
+    
+    /**
+     * A thumbnail together with the time of the frame it shows.
+     */
+    data class Thumbnail(
+        val bitmap: Bitmap,
+        /** Time of the frame in seconds, may differ from the requested position; negative for cover art */
+        val position: Double
+    )
+    
+    /**
+     * Like [generate], but also reports which frame was actually used.
+     * 
+     * @return Thumbnail with the frame's time, or null if generation fails
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generateFrame(
+        path: String,
+        position: Double,
+        dimension: Int = 512,
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        request: Request? = null,
+        format: OutputFormat = OutputFormat.ARGB_8888
+    ): Thumbnail? {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
         }
+        
+        require(dimension in 1..4096) {
+            "Dimension must be between 1 and 4096 (got $dimension)"
+        }
+        
+        val pts = DoubleArray(1)
+        val bitmap = try {
+            MPVLib.grabThumbnailFast(path, position, dimension, useHwDec, seekMode.flag or format.flag,
+                pts, request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            null
+        }
+        return bitmap?.let { Thumbnail(it, pts[0]) }
+    }
+    
+    /**
+     * Generate a poster image for a file: the keyframe at [position], unless
+     * it is blank (black, a fade-in, a flat colour or a logo on black), in which
+     * case the following keyframes are tried until one shows something.
+     * All of that happens in a single call, so a black first frame costs no
+     * extra round trips.
+     * 
+     * Files with embedded cover art (album art, mkv/mp4 covers) use that
+     * instead, decoded straight from the attachment without seeking. Audio
+     * files with a cover always get the cover, whatever [preferCoverArt] says.
+     * 
+     * @param path File path or URL to the video
+     * @param position Where to start looking, in seconds (default: 0.0)
+     * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
+     * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param preferCoverArt Use embedded cover art rather than a frame if there is one (default: true)
+     * @return Thumbnail with the time of the frame picked, or null if generation fails
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generatePoster(
+        path: String,
+        position: Double = 0.0,
+        dimension: Int = 512,
+        useHwDec: Boolean = true,
+        preferCoverArt: Boolean = true
+    ): Thumbnail? {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        require(dimension in 1..4096) {
+            "Dimension must be between 1 and 4096 (got $dimension)"
+        }
+        
+        var flags = SeekMode.KEYFRAME.flag or FLAG_REPRESENTATIVE
+        if (preferCoverArt)
+            flags = flags or FLAG_COVER_ART
+        val pts = DoubleArray(1)
+        val bitmap = try {
+            MPVLib.grabThumbnailFast(path, position, dimension, useHwDec, flags, pts)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            null
+        }
+        return bitmap?.let { Thumbnail(it, pts[0]) }
     }
     
     /**
      * Generate thumbnail asynchronously (IO dispatcher).
+     * Cancelling the calling coroutine also stops the native work, e.g. for
+     * list rows that were scrolled away before their thumbnail was done.
      * 
      * @param path File path or URL
      * @param position Time position in seconds (default: 0.0)
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param seekMode How closely the frame has to match position (default: [SeekMode.FAST])
+     * @param timeoutMs Give up after this many milliseconds, 0 for no limit (default: 0)
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
      * @return Bitmap thumbnail, or null
      */
     suspend fun generateAsync(
         path: String,
         position: Double = 0.0,
         dimension: Int = 512,
-        useHwDec: Boolean = true
-    ): Bitmap? = withContext(Dispatchers.IO) {
-        generate(path, position, dimension, useHwDec)
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        timeoutMs: Long = 0,
+        format: OutputFormat = OutputFormat.ARGB_8888
+    ): Bitmap? = withRequest(timeoutMs) { request ->
+        generate(path, position, dimension, useHwDec, seekMode, request, format)
+    }
+    
+    /**
+     * Generate a thumbnail straight into an existing bitmap, without allocating
+     * a new one. The bitmap must be mutable; it is reconfigured to the thumbnail's
+     * size and format, so its allocation has to hold dimension x dimension pixels
+     * of that format (bitmaps from [BitmapPool] always do).
+     * 
+     * @param path File path or URL to the video
+     * @param position Time position in seconds
+     * @param bitmap Bitmap to draw into
+     * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
+     * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param seekMode How closely the frame has to match position (default: [SeekMode.FAST])
+     * @param request Token to cancel the work with or give it a deadline, see [newRequest]
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
+     * @return true if the thumbnail was drawn into bitmap
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generateInto(
+        path: String,
+        position: Double,
+        bitmap: Bitmap,
+        dimension: Int = 512,
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        request: Request? = null,
+        format: OutputFormat = OutputFormat.ARGB_8888
+    ): Boolean {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        require(dimension in 1..4096) {
+            "Dimension must be between 1 and 4096 (got $dimension)"
+        }
+        
+        return try {
+            MPVLib.grabThumbnailInto(path, position, dimension, useHwDec, seekMode.flag or format.flag,
+                bitmap, null, request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            false
+        }
+    }
+    
+    /**
+     * Generate a thumbnail into a bitmap taken from [pool].
+     * Hand the bitmap back with [BitmapPool.release] once it is no longer displayed.
+     * 
+     * @return Bitmap from the pool, or null if generation fails
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generate(
+        path: String,
+        position: Double,
+        pool: BitmapPool,
+        dimension: Int = 512,
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST
+    ): Bitmap? {
+        val bitmap = pool.acquire(dimension)
+        if (generateInto(path, position, bitmap, dimension, useHwDec, seekMode))
+            return bitmap
+        pool.release(bitmap)
+        return null
+    }
+    
+    /**
+     * Pool of reusable thumbnail bitmaps, so that scrubbing doesn't allocate
+     * (and garbage collect) a new bitmap for every frame.
+     * 
+     * @param maxSize Maximum number of idle bitmaps kept around
+     */
+    class BitmapPool @JvmOverloads constructor(private val maxSize: Int = 16) {
+        private val free = ArrayDeque<Bitmap>()
+        
+        /**
+         * Get a bitmap that can hold a thumbnail of up to dimension x dimension pixels.
+         */
+        @Synchronized
+        fun acquire(dimension: Int): Bitmap {
+            val needed = dimension * dimension * 4
+            val it = free.iterator()
+            while (it.hasNext()) {
+                val bitmap = it.next()
+                if (bitmap.isRecycled) {
+                    it.remove()
+                } else if (bitmap.allocationByteCount >= needed) {
+                    it.remove()
+                    return bitmap
+                }
+            }
+            return Bitmap.createBitmap(dimension, dimension, Bitmap.Config.ARGB_8888)
+        }
+        
+        /**
+         * Return a bitmap to the pool. It must not be used by the caller afterwards.
+         */
+        @Synchronized
+        fun release(bitmap: Bitmap) {
+            if (bitmap.isRecycled || !bitmap.isMutable)
+                return
+            if (free.size >= maxSize)
+                free.removeFirst().recycle()
+            free.addLast(bitmap)
+        }
+        
+        /**
+         * Recycle all idle bitmaps.
+         */
+        @Synchronized
+        fun clear() {
+            free.forEach { it.recycle() }
+            free.clear()
+        }
     }
     
     /**
      * Generate multiple thumbnails at different positions.
+     * The file is opened once and positions are visited in order, decoding forward
+     * instead of seeking when two positions fall into the same GOP.
+     * 
+     * With [SeekMode.KEYFRAME] only keyframes are read from the file at all and
+     * positions in the same GOP share a thumbnail. Use this for bulk sampling
+     * (storyboards, posters, scene overviews) of long files.
+     * [SeekMode.EXACT] is treated like [SeekMode.FAST] here.
      * 
      * @param path File path
      * @param positions List of time positions
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
-     * @return List of bitmaps (may contain nulls)
+     * @param seekMode How closely each frame has to match its position (default: [SeekMode.FAST])
+     * @param request Token to cancel the work with or give it a deadline; positions not
+     *   reached by then get null
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
+     * @return List of bitmaps in the order of positions (may contain nulls)
      */
     @JvmStatic
     @JvmOverloads
@@ -110,10 +621,70 @@ object FastThumbnails {
         path: String,
         positions: List<Double>,
         dimension: Int = 512,
-        useHwDec: Boolean = true
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        request: Request? = null,
+        format: OutputFormat = OutputFormat.ARGB_8888
     ): List<Bitmap?> {
-        return positions.map { position ->
-            generate(path, position, dimension, useHwDec)
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        require(dimension in 1..4096) {
+            "Dimension must be between 1 and 4096 (got $dimension)"
+        }
+        
+        val bitmaps = try {
+            MPVLib.grabThumbnailsBatch(path, positions.toDoubleArray(), dimension, useHwDec,
+                seekMode.flag or format.flag, null, request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            null
+        }
+        return bitmaps?.toList() ?: positions.map { null }
+    }
+    
+    /**
+     * Generate multiple thumbnails at different positions, streaming each one
+     * to [callback] as soon as it is decoded instead of returning them all at once.
+     * Thumbnails arrive in file order, not necessarily in the order of positions.
+     * The callback runs on the calling thread.
+     * 
+     * @param path File path
+     * @param positions List of time positions
+     * @param dimension Max dimension for longest side (width or height) in pixels
+     * @param useHwDec Whether to use hardware acceleration if available
+     * @param seekMode How closely each frame has to match its position (default: [SeekMode.FAST])
+     * @param request Token to cancel the work with or give it a deadline; positions not
+     *   reached by then get no callback
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
+     * @param callback Receives the index into positions, the position and the bitmap (or null)
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun generateMultiple(
+        path: String,
+        positions: List<Double>,
+        dimension: Int,
+        useHwDec: Boolean,
+        seekMode: SeekMode = SeekMode.FAST,
+        request: Request? = null,
+        format: OutputFormat = OutputFormat.ARGB_8888,
+        callback: MPVLib.ThumbnailCallback
+    ) {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        require(dimension in 1..4096) {
+            "Dimension must be between 1 and 4096 (got $dimension)"
+        }
+        
+        try {
+            MPVLib.grabThumbnailsBatch(path, positions.toDoubleArray(), dimension, useHwDec,
+                seekMode.flag or format.flag, callback, request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
         }
     }
     
@@ -124,19 +695,179 @@ object FastThumbnails {
      * @param positions List of positions
      * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
      * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param seekMode How closely each frame has to match its position (default: [SeekMode.FAST])
+     * @param timeoutMs Give up after this many milliseconds, 0 for no limit (default: 0)
+     * @param format Pixel format of the bitmap (default: [OutputFormat.ARGB_8888])
      * @return List of bitmaps
      */
     suspend fun generateMultipleAsync(
         path: String,
         positions: List<Double>,
         dimension: Int = 512,
-        useHwDec: Boolean = true
-    ): List<Bitmap?> = withContext(Dispatchers.IO) {
-        positions.map { position ->
-            generate(path, position, dimension, useHwDec)
+        useHwDec: Boolean = true,
+        seekMode: SeekMode = SeekMode.FAST,
+        timeoutMs: Long = 0,
+        format: OutputFormat = OutputFormat.ARGB_8888
+    ): List<Bitmap?> = withRequest(timeoutMs) { request ->
+        generateMultiple(path, positions, dimension, useHwDec, seekMode, request, format)
+    }
+    
+    /**
+     * Open a decode session for a file and keep it open until closed.
+     * While a session is open, thumbnails for the same file skip opening,
+     * probing and decoder setup and only seek and decode (e.g. for seekbar scrubbing).
+     * 
+     * Sessions are also created implicitly by [generate] and closed after a short idle
+     * period; an explicit session is exempt from that until [Session.close] is called.
+     * Opening the same file more than once keeps it open until every handle is closed.
+     * 
+     * @param path File path or URL to the video
+     * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @return Session handle, or null if the file could not be opened
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun openSession(path: String, useHwDec: Boolean = true): Session? {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        return if (MPVLib.openThumbnailSession(path, useHwDec)) Session(path, useHwDec) else null
+    }
+    
+    /**
+     * Handle to an open decode session, see [openSession].
+     */
+    class Session internal constructor(
+        val path: String,
+        val useHwDec: Boolean
+    ) : Closeable {
+        private val closed = AtomicBoolean(false)
+        
+        /**
+         * Generate a thumbnail from this session's file.
+         * 
+         * @param position Time position in seconds (default: 0.0)
+         * @param dimension Max dimension for longest side (width or height) in pixels (default: 512)
+         * @param seekMode How closely the frame has to match position (default: [SeekMode.FAST])
+         * @return Bitmap thumbnail, or null if generation fails
+         */
+        @JvmOverloads
+        fun generate(position: Double = 0.0, dimension: Int = 512, seekMode: SeekMode = SeekMode.FAST): Bitmap? {
+            check(!closed.get()) { "Session is closed" }
+            return FastThumbnails.generate(path, position, dimension, useHwDec, seekMode)
+        }
+        
+        override fun close() {
+            if (closed.compareAndSet(false, true)) {
+                MPVLib.closeThumbnailSession(path)
+            }
+        }
+    }
+    
+    /**
+     * Build a storyboard (trickplay sprite sheets) for a file: one tile every
+     * [interval] seconds, taken from the nearest keyframe, packed into JPEG
+     * sheets of [columns] x [rows] tiles next to a binary index.
+     * An up to date storyboard from an earlier call is reused as is.
+     * 
+     * This decodes through the whole file, so call it from a background thread.
+     * 
+     * @param path File path or URL to the video
+     * @param interval Seconds between tiles (default: 10.0)
+     * @param tileDimension Max dimension for the longest side of a tile (default: 160)
+     * @param columns Tiles per sheet row (default: 10)
+     * @param rows Tile rows per sheet (default: 10). A sheet may have 4096 x 4096 pixels at most.
+     * @param outDir Directory to write into, or null for one inside the thumbnail cache
+     * @param useHwDec Whether to use hardware acceleration if available (default: true)
+     * @param request Token to cancel the work with or give it a deadline, see [newRequest]
+     * @return The loaded storyboard, or null if it could not be built
+     * @throws IllegalStateException if not initialized
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun buildStoryboard(
+        path: String,
+        interval: Double = 10.0,
+        tileDimension: Int = 160,
+        columns: Int = 10,
+        rows: Int = 10,
+        outDir: File? = null,
+        useHwDec: Boolean = true,
+        request: Request? = null
+    ): Storyboard? {
+        check(initialized.get()) {
+            "FastThumbnails not initialized. Call initialize(context) first."
+        }
+        
+        require(interval > 0.0) { "Interval must be positive (got $interval)" }
+        require(tileDimension in 1..4096) {
+            "Tile dimension must be between 1 and 4096 (got $tileDimension)"
+        }
+        require(columns > 0 && rows > 0) { "Sheet must have at least one tile" }
+        require(columns.toLong() * rows * tileDimension * tileDimension <= 4096L * 4096) {
+            "Sheet of $columns x $rows tiles of $tileDimension is larger than 4096 x 4096 pixels"
+        }
+        
+        val index = try {
+            MPVLib.buildStoryboard(path, outDir?.absolutePath, interval, tileDimension, columns, rows, useHwDec,
+                request?.id ?: 0)
+        } catch (e: Exception) {
+            e.printStackTrace()
+            null
+        } ?: return null
+        return Storyboard.load(File(index))
+    }
+    
+    /**
+     * Create a request token. Pass it to any of the generate functions, then
+     * [Request.cancel] it from another thread once the result isn't wanted
+     * anymore (e.g. its list row was scrolled away). The native side stops at the
+     * next packet, or right away if it is still waiting for a worker or on a slow
+     * network read, and the call returns null.
+     * 
+     * @param timeoutMs Cancel automatically after this many milliseconds, 0 for no limit (default: 0)
+     * @return Request, close it when done
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun newRequest(timeoutMs: Long = 0): Request = Request(MPVLib.createThumbnailRequest(timeoutMs))
+    
+    /**
+     * Cancellation token for thumbnail work, see [newRequest].
+     */
+    class Request internal constructor(internal val id: Long) : Closeable {
+        private val closed = AtomicBoolean(false)
+        
+        /** Stop the work done for this request. */
+        fun cancel() {
+            if (!closed.get()) {
+                MPVLib.cancelThumbnailRequest(id)
+            }
+        }
+        
+        override fun close() {
+            if (closed.compareAndSet(false, true)) {
+                MPVLib.releaseThumbnailRequest(id)
+            }
         }
     }
     
+    // Run block on the IO dispatcher with a request that is cancelled along with the caller
+    private suspend fun <T> withRequest(timeoutMs: Long, block: (Request) -> T): T =
+        newRequest(timeoutMs).use { request ->
+            coroutineScope {
+                val work = async(Dispatchers.IO) { block(request) }
+                try {
+                    work.await()
+                } catch (e: CancellationException) {
+                    request.cancel()
+                    throw e
+                }
+            }
+        }
+    
     /**
      * Performance benchmark helper.
      * Generates a thumbnail and measures time taken.
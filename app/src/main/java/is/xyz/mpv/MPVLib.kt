@@ -3,6 +3,9 @@ package `is`.xyz.mpv
 import android.content.Context
 import android.graphics.Bitmap
 import android.view.Surface
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.atomic.AtomicInteger
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
@@ -31,13 +34,62 @@ object MPVLib {
 
     external fun command(vararg cmd: String)
     external fun commandNode(vararg cmd: String): MPVNode?
+    // node results encoded into buffer (see MPVNodeView), return the size or -1
+    private external fun commandNodeBuffer(cmd: Array<out String>, buffer: ByteBuffer): Int
+    private external fun getPropertyNodeBuffer(property: String, buffer: ByteBuffer): Int
+    // copies a result that didn't fit into the buffer of the previous call
+    private external fun takeNodeBuffer(buffer: ByteBuffer)
+
+    // size of the last result that didn't fit, so the next buffer is big enough
+    private val nodeBufferSize = AtomicInteger(4096)
+
+    private inline fun nodeView(fetch: (ByteBuffer) -> Int): MPVNodeView? {
+        var buffer = ByteBuffer.allocateDirect(nodeBufferSize.get())
+        val size = fetch(buffer)
+        if (size < 0)
+            return null
+        if (size > buffer.capacity()) {
+            nodeBufferSize.set(size)
+            buffer = ByteBuffer.allocateDirect(size)
+            takeNodeBuffer(buffer)
+        }
+        buffer.order(ByteOrder.nativeOrder())
+        buffer.limit(size)
+        return MPVNodeView(buffer, 0)
+    }
+
+    /**
+     * Like [commandNode], but the result comes back encoded in a single buffer
+     * and is only decoded as far as it is used.
+     */
+    @JvmStatic
+    fun commandNodeView(vararg cmd: String): MPVNodeView? = nodeView { commandNodeBuffer(cmd, it) }
 
     external fun setOptionString(name: String, value: String): Int
 
-    external fun grabThumbnail(dimension: Int): Bitmap?
-    external fun grabThumbnailFast(path: String, position: Double = 0.0, dimension: Int, useHwDec: Boolean = true): Bitmap?
+    // format: 0 ARGB_8888, 1 RGB_565, 2 grayscale as ALPHA_8
+    external fun grabThumbnail(dimension: Int, format: Int = 0): Bitmap?
+    // callback gets the bitmap (null on failure) on the event thread; returns 0 if nothing was requested
+    external fun grabThumbnailAsync(dimension: Int, format: Int = 0, callback: SnapshotCallback): Long
+    external fun grabThumbnailFast(path: String, position: Double = 0.0, dimension: Int, useHwDec: Boolean = true, flags: Int = 0, ptsOut: DoubleArray? = null, request: Long = 0): Bitmap?
+    external fun grabThumbnailInto(path: String, position: Double, dimension: Int, useHwDec: Boolean, flags: Int, bitmap: Bitmap, ptsOut: DoubleArray?, request: Long = 0): Boolean
     external fun setThumbnailJavaVM(appctx: Context)
-    external fun clearThumbnailCache()
+    external fun setThumbnailCacheDir(path: String)
+    external fun clearThumbnailCache(keepPercent: Int = 0)
+    external fun setThumbnailMemoryCacheSize(bytes: Long)
+    external fun setThumbnailWorkerCount(count: Int)
+    external fun getThumbnailCacheStats(): LongArray?
+    external fun getThumbnailStats(): LongArray?
+    external fun resetThumbnailStats()
+    external fun setThumbnailDiskCacheSize(bytes: Long)
+    external fun clearThumbnailDiskCache()
+    external fun openThumbnailSession(path: String, useHwDec: Boolean = true): Boolean
+    external fun closeThumbnailSession(path: String)
+    external fun grabThumbnailsBatch(path: String, positions: DoubleArray, dimension: Int, useHwDec: Boolean = true, flags: Int = 0, callback: ThumbnailCallback? = null, request: Long = 0): Array<Bitmap?>?
+    external fun buildStoryboard(path: String, outDir: String?, interval: Double, tileDimension: Int, columns: Int, rows: Int, useHwDec: Boolean = true, request: Long = 0): String?
+    external fun createThumbnailRequest(timeoutMs: Long = 0): Long
+    external fun cancelThumbnailRequest(request: Long)
+    external fun releaseThumbnailRequest(request: Long)
 
     external fun getPropertyInt(property: String): Int?
     external fun setPropertyInt(property: String, value: Int)
@@ -50,6 +102,14 @@ object MPVLib {
     external fun getPropertyNode(property: String): MPVNode?
     external fun setPropertyNode(property: String, node: MPVNode)
 
+    /**
+     * Like [getPropertyNode], but the value comes back encoded in a single buffer
+     * and is only decoded as far as it is used. Meant for large properties such
+     * as track-list, playlist or chapter-list.
+     */
+    @JvmStatic
+    fun getPropertyNodeView(property: String): MPVNodeView? = nodeView { getPropertyNodeBuffer(property, it) }
+
     @JvmStatic
     fun getPropertyFloat(property: String) = getPropertyDouble(property)?.toFloat()
     @JvmStatic
@@ -59,7 +119,61 @@ object MPVLib {
     @JvmStatic
     fun setPropertyLong(property: String, value: Long) = setPropertyInt(property, value.toInt())
 
-    external fun observeProperty(property: String, format: Int)
+    // id is passed back with every change of the property, see observeProperty
+    private external fun observePropertyId(property: String, format: Int, id: Int)
+    // false if format can't be batched
+    private external fun addBatchedProperty(property: String, format: Int, id: Int, minIntervalMs: Int, deadband: Double): Boolean
+    // how often batched property changes are delivered, 0 for as soon as they arrive
+    external fun setPropertyBatchInterval(intervalMs: Int)
+
+    // Observed properties get a small integer id, so that changes reach us
+    // without a name string. Ids start at 1 and stay the same for the process.
+    private val propertyIds = HashMap<Pair<String, Int>, Int>()
+    // names by id, replaced as a whole when one is added
+    @Volatile
+    private var propertyNames = arrayOfNulls<String>(1)
+
+    private fun propertyId(property: String, format: Int): Int = synchronized(propertyIds) {
+        propertyIds.getOrPut(Pair(property, format)) {
+            val id = propertyNames.size
+            propertyNames = propertyNames.copyOf(id + 1).also { it[id] = property }
+            id
+        }
+    }
+
+    @JvmStatic
+    fun propertyName(id: Int): String? = propertyNames.getOrNull(id)
+
+    /**
+     * Observe a property, its changes arrive through the eventProperty callbacks.
+     *
+     * @return Id of the property, the same for every observation of it in this format
+     */
+    @JvmStatic
+    fun observeProperty(property: String, format: Int): Int {
+        val id = propertyId(property, format)
+        observePropertyId(property, format, id)
+        return id
+    }
+
+    /**
+     * Observe a frequently changing property without an upcall per change.
+     * The native side keeps only its latest value and delivers the changes of
+     * all batched properties together, at most once per [setPropertyBatchInterval]
+     * (33ms by default). Observers see them through the usual eventProperty callbacks.
+     *
+     * @param minIntervalMs Deliver this property at most this often
+     * @param deadband Drop changes of numeric properties smaller than this
+     * @return Id of the property, see [observeProperty]
+     */
+    @JvmStatic
+    @JvmOverloads
+    fun observePropertyBatched(property: String, format: Int, minIntervalMs: Int = 0, deadband: Double = 0.0): Int {
+        val id = propertyId(property, format)
+        if (!addBatchedProperty(property, format, id, minIntervalMs, deadband))
+            observePropertyId(property, format, id)
+        return id
+    }
 
     private val observers: MutableList<EventObserver> = ArrayList()
 
@@ -178,6 +292,61 @@ object MPVLib {
         scope.launch { eventPropertyFlow.emit(property) }
     }
 
+    // Changes of properties observed with an id, only the id crosses JNI
+
+    @JvmStatic
+    fun eventProperty(id: Int) {
+        propertyName(id)?.let { eventProperty(it) }
+    }
+
+    @JvmStatic
+    fun eventProperty(id: Int, value: Long) {
+        propertyName(id)?.let { eventProperty(it, value) }
+    }
+
+    @JvmStatic
+    fun eventProperty(id: Int, value: Boolean) {
+        propertyName(id)?.let { eventProperty(it, value) }
+    }
+
+    @JvmStatic
+    fun eventProperty(id: Int, value: Double) {
+        propertyName(id)?.let { eventProperty(it, value) }
+    }
+
+    @JvmStatic
+    fun eventProperty(id: Int, value: String) {
+        propertyName(id)?.let { eventProperty(it, value) }
+    }
+
+    @JvmStatic
+    fun eventProperty(id: Int, value: MPVNode) {
+        propertyName(id)?.let { eventProperty(it, value) }
+    }
+
+    // buffer is only valid during the call, see property_batch.cpp for its layout
+    @JvmStatic
+    fun eventPropertyBatch(buffer: ByteBuffer, length: Int) {
+        val names = propertyNames
+        buffer.order(ByteOrder.nativeOrder())
+        buffer.position(0)
+        buffer.limit(length)
+        while (buffer.hasRemaining()) {
+            val name = names.getOrNull(buffer.int)
+            when (buffer.int) {
+                MpvFormat.MPV_FORMAT_FLAG -> buffer.int.let { if (name != null) eventProperty(name, it != 0) }
+                MpvFormat.MPV_FORMAT_INT64 -> buffer.long.let { if (name != null) eventProperty(name, it) }
+                MpvFormat.MPV_FORMAT_DOUBLE -> buffer.double.let { if (name != null) eventProperty(name, it) }
+                MpvFormat.MPV_FORMAT_STRING -> {
+                    val bytes = ByteArray(buffer.int)
+                    buffer.get(bytes)
+                    if (name != null) eventProperty(name, String(bytes, Charsets.UTF_8))
+                }
+                else -> if (name != null) eventProperty(name)
+            }
+        }
+    }
+
     @JvmStatic
     fun event(eventId: Int, data: MPVNode) {
         synchronized(observers) {
@@ -186,6 +355,14 @@ object MPVLib {
         scope.launch { eventFlow.emit(eventId) }
     }
 
+    // Log messages are filtered natively before they reach logMessage (on its own thread).
+    // prefix "" sets the default, which lets everything through; "vo" also covers "vo/gpu" etc.
+    external fun setLogLevelFilter(prefix: String, level: Int)
+    // messages less severe than warnings beyond this rate are dropped, 0 for no limit (default: 200/s, burst 400)
+    external fun setLogRateLimit(perSecond: Int, burst: Int)
+    // messages dropped by the rate limit or because logMessage fell behind
+    external fun getLogDroppedCount(): Long
+
     private val log_observers: MutableList<LogObserver> = ArrayList()
     val logFlow = MutableSharedFlow<Triple<String, Int, String>>()
 
@@ -221,6 +398,14 @@ object MPVLib {
         fun logMessage(prefix: String, level: Int, text: String)
     }
 
+    fun interface ThumbnailCallback {
+        fun onThumbnail(index: Int, position: Double, bitmap: Bitmap?)
+    }
+
+    fun interface SnapshotCallback {
+        fun onSnapshot(bitmap: Bitmap?)
+    }
+
     object MpvFormat {
         const val MPV_FORMAT_NONE: Int = 0
         const val MPV_FORMAT_STRING: Int = 1
@@ -0,0 +1,127 @@
+package `is`.xyz.mpv
+
+import `is`.xyz.mpv.MPVLib.MpvFormat
+import java.nio.ByteBuffer
+
+/**
+ * Read-only view of an mpv node in the compact encoding written by node.cpp,
+ * as returned by [MPVLib.getPropertyNodeView] and [MPVLib.commandNodeView].
+ * Nothing is decoded until it is accessed, so picking a few fields out of a
+ * large result (track-list, playlist, chapter-list) only allocates for those.
+ * Use [toNode] to get a regular [MPVNode] tree.
+ */
+class MPVNodeView internal constructor(private val buffer: ByteBuffer, private val offset: Int) {
+    /** One of [MpvFormat], NONE for unsupported values */
+    val format: Int
+        get() = buffer.get(offset).toInt()
+
+    // Start of each entry of an array or map; for maps the key, followed by the value
+    private val entries: IntArray by lazy(LazyThreadSafetyMode.NONE) {
+        val count = size()
+        val result = IntArray(count)
+        var at = offset + 9
+        for (i in 0 until count) {
+            result[i] = at
+            if (format == MpvFormat.MPV_FORMAT_NODE_MAP)
+                at += 4 + buffer.getInt(at)
+            at = end(at)
+        }
+        result
+    }
+
+    // Offset just past the node at [at]
+    private fun end(at: Int): Int = when (buffer.get(at).toInt()) {
+        MpvFormat.MPV_FORMAT_STRING, MpvFormat.MPV_FORMAT_BYTE_ARRAY -> at + 5 + buffer.getInt(at + 1)
+        MpvFormat.MPV_FORMAT_FLAG -> at + 2
+        MpvFormat.MPV_FORMAT_INT64, MpvFormat.MPV_FORMAT_DOUBLE -> at + 9
+        MpvFormat.MPV_FORMAT_NODE_ARRAY, MpvFormat.MPV_FORMAT_NODE_MAP -> at + 9 + buffer.getInt(at + 5)
+        else -> at + 1
+    }
+
+    // Length-prefixed bytes at [at]
+    private fun bytes(at: Int): ByteArray {
+        val bytes = ByteArray(buffer.getInt(at))
+        val source = buffer.duplicate()
+        source.position(at + 4)
+        source.get(bytes)
+        return bytes
+    }
+
+    private fun valueAt(entry: Int): Int =
+        if (format == MpvFormat.MPV_FORMAT_NODE_MAP) entry + 4 + buffer.getInt(entry) else entry
+
+    fun asString(): String? =
+        if (format == MpvFormat.MPV_FORMAT_STRING) String(bytes(offset + 1), Charsets.UTF_8) else null
+
+    fun asBoolean(): Boolean? =
+        if (format == MpvFormat.MPV_FORMAT_FLAG) buffer.get(offset + 1).toInt() != 0 else null
+
+    fun asInt(): Long? =
+        if (format == MpvFormat.MPV_FORMAT_INT64) buffer.getLong(offset + 1) else null
+
+    fun asDouble(): Double? =
+        if (format == MpvFormat.MPV_FORMAT_DOUBLE) buffer.getDouble(offset + 1) else null
+
+    fun asByteArray(): ByteArray? =
+        if (format == MpvFormat.MPV_FORMAT_BYTE_ARRAY) bytes(offset + 1) else null
+
+    /** Number of entries of an array or map, 0 for anything else */
+    fun size(): Int = when (format) {
+        MpvFormat.MPV_FORMAT_NODE_ARRAY, MpvFormat.MPV_FORMAT_NODE_MAP -> buffer.getInt(offset + 1)
+        else -> 0
+    }
+
+    /** Entry of an array, or value of the index-th entry of a map */
+    operator fun get(index: Int): MPVNodeView? {
+        if (index !in 0 until size())
+            return null
+        return MPVNodeView(buffer, valueAt(entries[index]))
+    }
+
+    operator fun get(key: String): MPVNodeView? {
+        if (format != MpvFormat.MPV_FORMAT_NODE_MAP)
+            return null
+        val wanted = key.toByteArray(Charsets.UTF_8)
+        for (entry in entries) {
+            if (keyEquals(entry, wanted))
+                return MPVNodeView(buffer, valueAt(entry))
+        }
+        return null
+    }
+
+    private fun keyEquals(entry: Int, wanted: ByteArray): Boolean {
+        if (buffer.getInt(entry) != wanted.size)
+            return false
+        for (i in wanted.indices) {
+            if (buffer.get(entry + 4 + i) != wanted[i])
+                return false
+        }
+        return true
+    }
+
+    /** Key of the index-th entry of a map */
+    fun key(index: Int): String? {
+        if (format != MpvFormat.MPV_FORMAT_NODE_MAP || index !in 0 until size())
+            return null
+        return String(bytes(entries[index]), Charsets.UTF_8)
+    }
+
+    fun keys(): List<String> = (0 until size()).mapNotNull { key(it) }
+
+    /** Decode everything into a regular node tree */
+    fun toNode(): MPVNode = when (format) {
+        MpvFormat.MPV_FORMAT_STRING -> MPVNode.StringNode(asString()!!)
+        MpvFormat.MPV_FORMAT_FLAG -> MPVNode.BooleanNode(asBoolean()!!)
+        MpvFormat.MPV_FORMAT_INT64 -> MPVNode.IntNode(asInt()!!)
+        MpvFormat.MPV_FORMAT_DOUBLE -> MPVNode.DoubleNode(asDouble()!!)
+        MpvFormat.MPV_FORMAT_BYTE_ARRAY -> MPVNode.ByteArrayNode(asByteArray()!!)
+        MpvFormat.MPV_FORMAT_NODE_ARRAY -> MPVNode.ArrayNode(Array(size()) { get(it)!!.toNode() })
+        MpvFormat.MPV_FORMAT_NODE_MAP -> MPVNode.MapNode(HashMap<String, MPVNode>(size() * 2).also { map ->
+            for (i in 0 until size())
+                map[key(i)!!] = get(i)!!.toNode()
+        })
+        else -> MPVNode.None
+    }
+
+    override fun toString(): String = toNode().toJson()
+}
@@ -0,0 +1,143 @@
+package `is`.xyz.mpv
+
+import android.graphics.Bitmap
+import android.graphics.BitmapFactory
+import android.util.LruCache
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * A storyboard built by [FastThumbnails.buildStoryboard]: tiles for evenly
+ * spaced positions of a file, packed into JPEG sprite sheets.
+ * 
+ * Looking up a tile is an index into the entry table and needs no decoding,
+ * which makes this suitable for seekbar previews. Sheets are decoded on demand
+ * and the most recently used ones are kept in memory.
+ */
+class Storyboard private constructor(
+    /** Directory holding the index and the sheets */
+    val directory: File,
+    /** Seconds between tiles, larger than requested for very long files */
+    val interval: Double,
+    val tileWidth: Int,
+    val tileHeight: Int,
+    val columns: Int,
+    val rows: Int,
+    val sheetCount: Int,
+    private val positions: DoubleArray,
+    private val sheets: IntArray,
+    private val xs: IntArray,
+    private val ys: IntArray
+) {
+    /**
+     * Location of one tile within a sheet.
+     */
+    data class Tile(
+        val sheet: Int,
+        val x: Int,
+        val y: Int,
+        val width: Int,
+        val height: Int,
+        /** Time of the frame shown in seconds */
+        val position: Double
+    )
+    
+    private val sheetCache = object : LruCache<Int, Bitmap>(SHEET_CACHE_SIZE) {}
+    
+    /** Number of tiles */
+    val size: Int get() = positions.size
+    
+    /**
+     * Tile to show for a position. Tile i stands for the keyframe closest to
+     * i * [interval], so this is the tile of the nearest slot.
+     */
+    fun tileAt(position: Double): Tile {
+        val slot = Math.round(position / interval).coerceIn(0L, positions.size - 1L).toInt()
+        return tile(slot)
+    }
+    
+    private fun tile(i: Int) = Tile(sheets[i], xs[i], ys[i], tileWidth, tileHeight, positions[i])
+    
+    /** JPEG file of a sheet */
+    fun sheetFile(sheet: Int): File = File(directory, String.format("sheet-%04d.jpg", sheet))
+    
+    /**
+     * Decoded sheet, from memory if it was used recently.
+     * @return Sheet bitmap, or null if it could not be read
+     */
+    fun loadSheet(sheet: Int): Bitmap? {
+        sheetCache.get(sheet)?.let { return it }
+        val bitmap = BitmapFactory.decodeFile(sheetFile(sheet).absolutePath) ?: return null
+        sheetCache.put(sheet, bitmap)
+        return bitmap
+    }
+    
+    /**
+     * Preview for a position cropped out of its sheet.
+     * @return Tile bitmap, or null if the sheet could not be read
+     */
+    fun frameAt(position: Double): Bitmap? {
+        val tile = tileAt(position)
+        val sheet = loadSheet(tile.sheet) ?: return null
+        return Bitmap.createBitmap(sheet, tile.x, tile.y, tile.width, tile.height)
+    }
+    
+    /** Drop decoded sheets from memory. */
+    fun clearCache() {
+        sheetCache.evictAll()
+    }
+    
+    companion object {
+        private const val MAGIC = 0x4942534d // "MSBI"
+        private const val VERSION = 2
+        private const val HEADER_SIZE = 56
+        private const val ENTRY_SIZE = 16
+        private const val SHEET_CACHE_SIZE = 4
+        
+        /**
+         * Read a storyboard index.
+         * @param index storyboard.idx file
+         * @return The storyboard, or null if the index is missing or invalid
+         */
+        @JvmStatic
+        fun load(index: File): Storyboard? {
+            val data = try {
+                index.readBytes()
+            } catch (e: IOException) {
+                e.printStackTrace()
+                return null
+            }
+            if (data.size < HEADER_SIZE)
+                return null
+            val buf = ByteBuffer.wrap(data).order(ByteOrder.LITTLE_ENDIAN)
+            if (buf.getInt() != MAGIC || buf.getInt() != VERSION)
+                return null
+            buf.getLong() // file hash
+            val interval = buf.getDouble()
+            val tileWidth = buf.getInt()
+            val tileHeight = buf.getInt()
+            val columns = buf.getInt()
+            val rows = buf.getInt()
+            val sheetCount = buf.getInt()
+            val count = buf.getInt()
+            buf.position(HEADER_SIZE) // requested tile dimension, reserved
+            if (count <= 0 || data.size < HEADER_SIZE + count.toLong() * ENTRY_SIZE)
+                return null
+            
+            val positions = DoubleArray(count)
+            val sheets = IntArray(count)
+            val xs = IntArray(count)
+            val ys = IntArray(count)
+            for (i in 0 until count) {
+                positions[i] = buf.getDouble()
+                sheets[i] = buf.getInt()
+                xs[i] = buf.getShort().toInt() and 0xffff
+                ys[i] = buf.getShort().toInt() and 0xffff
+            }
+            return Storyboard(index.parentFile ?: File("."), interval, tileWidth, tileHeight,
+                columns, rows, sheetCount, positions, sheets, xs, ys)
+        }
+    }
+}
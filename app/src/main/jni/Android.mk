@@ -72,12 +72,28 @@ LOCAL_SRC_FILES := \
 	main.cpp \
 	render.cpp \
 	log.cpp \
+	log_queue.cpp \
 	jni_utils.cpp \
 	property.cpp \
 	event.cpp \
 	node.cpp \
-	thumbnail.cpp
-LOCAL_LDLIBS    := -llog -lGLESv3 -lEGL -latomic
+	property_batch.cpp \
+	thumbnail.cpp \
+	thumbnail_session.cpp \
+	thumbnail_index.cpp \
+	thumbnail_storage.cpp \
+	thumbnail_image.cpp \
+	thumbnail_diskcache.cpp \
+	thumbnail_memcache.cpp \
+	thumbnail_pool.cpp \
+	thumbnail_kernel.cpp \
+	thumbnail_kernel_simd.cpp \
+	thumbnail_storyboard.cpp \
+	thumbnail_io.cpp \
+	thumbnail_request.cpp \
+	thumbnail_cover.cpp \
+	thumbnail_stats.cpp
+LOCAL_LDLIBS    := -llog -lGLESv3 -lEGL -ljnigraphics -latomic
 LOCAL_SHARED_LIBRARIES := swscale avcodec avformat avutil mpv
 
 include $(BUILD_SHARED_LIBRARY)
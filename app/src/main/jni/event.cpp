@@ -5,31 +5,50 @@
 #include "globals.h"
 #include "jni_utils.h"
 #include "log.h"
+#include "log_queue.h"
 #include "node.h"
+#include "property_batch.h"
+#include "thumbnail.h"
 
-static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop)
+// Properties observed with an id (all of MPVLib.observeProperty) are sent as
+// that id, Java already knows the name. Otherwise the name is sent along.
+static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop, uint64_t id)
 {
-    jstring jprop = env->NewStringUTF(prop->name);
-    jstring jvalue = NULL;
+    bool by_id = id != 0;
+    jstring jprop = NULL;
+    jstring jstr = NULL;
+    jvalue args[2];
+    if (by_id) {
+        args[0].i = (jint) id;
+    } else {
+        jprop = env->NewStringUTF(prop->name);
+        args[0].l = jprop;
+    }
     switch (prop->format) {
     case MPV_FORMAT_NONE:
-        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_S, jprop);
+        env->CallStaticVoidMethodA(mpv_MPVLib,
+            by_id ? mpv_MPVLib_eventProperty_I : mpv_MPVLib_eventProperty_S, args);
         break;
     case MPV_FORMAT_FLAG:
-        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_Sb, jprop,
-            (jboolean) (*(int*)prop->data != 0));
+        args[1].z = (jboolean) (*(int*)prop->data != 0);
+        env->CallStaticVoidMethodA(mpv_MPVLib,
+            by_id ? mpv_MPVLib_eventProperty_Ib : mpv_MPVLib_eventProperty_Sb, args);
         break;
     case MPV_FORMAT_INT64:
-        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_Sl, jprop,
-            (jlong) *(int64_t*)prop->data);
+        args[1].j = (jlong) *(int64_t*)prop->data;
+        env->CallStaticVoidMethodA(mpv_MPVLib,
+            by_id ? mpv_MPVLib_eventProperty_Il : mpv_MPVLib_eventProperty_Sl, args);
         break;
     case MPV_FORMAT_DOUBLE:
-        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_Sd, jprop,
-            (jdouble) *(double*)prop->data);
+        args[1].d = (jdouble) *(double*)prop->data;
+        env->CallStaticVoidMethodA(mpv_MPVLib,
+            by_id ? mpv_MPVLib_eventProperty_Id : mpv_MPVLib_eventProperty_Sd, args);
         break;
     case MPV_FORMAT_STRING:
-        jvalue = env->NewStringUTF(*(const char**)prop->data);
-        env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_SS, jprop, jvalue);
+        jstr = env->NewStringUTF(*(const char**)prop->data);
+        args[1].l = jstr;
+        env->CallStaticVoidMethodA(mpv_MPVLib,
+            by_id ? mpv_MPVLib_eventProperty_IS : mpv_MPVLib_eventProperty_SS, args);
         break;
     case MPV_FORMAT_NODE:
     case MPV_FORMAT_NODE_ARRAY:
@@ -37,7 +56,9 @@ static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop)
         {
             jobject jnode = mpv_node_to_jobject(env, (const mpv_node*)prop->data);
             if (jnode) {
-                env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventProperty_SN, jprop, jnode);
+                args[1].l = jnode;
+                env->CallStaticVoidMethodA(mpv_MPVLib,
+                    by_id ? mpv_MPVLib_eventProperty_IN : mpv_MPVLib_eventProperty_SN, args);
                 env->DeleteLocalRef(jnode);
             }
         }
@@ -48,8 +69,8 @@ static void sendPropertyUpdateToJava(JNIEnv *env, mpv_event_property *prop)
     }
     if (jprop)
         env->DeleteLocalRef(jprop);
-    if (jvalue)
-        env->DeleteLocalRef(jvalue);
+    if (jstr)
+        env->DeleteLocalRef(jstr);
 }
 
 static void sendEventToJava(JNIEnv *env, int event, mpv_node *event_node)
@@ -61,29 +82,6 @@ static void sendEventToJava(JNIEnv *env, int event, mpv_node *event_node)
     }
 }
 
-static void sendLogMessageToJava(JNIEnv *env, mpv_event_log_message *msg)
-{
-    // filter the most obvious cases of invalid utf-8, since Java would choke on it
-    const auto invalid_utf8 = [] (unsigned char c) {
-        return c == 0xc0 || c == 0xc1 || c >= 0xf5;
-    };
-    for (int i = 0; msg->text[i]; i++) {
-        if (invalid_utf8(static_cast<unsigned char>(msg->text[i])))
-            return;
-    }
-
-    jstring jprefix = env->NewStringUTF(msg->prefix);
-    jstring jtext = env->NewStringUTF(msg->text);
-
-    env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_logMessage_SiS,
-        jprefix, (jint) msg->log_level, jtext);
-
-    if (jprefix)
-        env->DeleteLocalRef(jprefix);
-    if (jtext)
-        env->DeleteLocalRef(jtext);
-}
-
 void *event_thread(void *arg)
 {
     JNIEnv *env = NULL;
@@ -96,34 +94,53 @@ void *event_thread(void *arg)
         mpv_event_property *mp_property = NULL;
         mpv_event_log_message *msg = NULL;
 
-        mp_event = mpv_wait_event(g_mpv, -1.0);
+        // Wakes up for the next batch of property changes if one is pending
+        mp_event = mpv_wait_event(g_mpv, property_batch_timeout());
 
         if (g_event_thread_request_exit)
             break;
 
-        if (mp_event->event_id == MPV_EVENT_NONE)
+        if (mp_event->event_id == MPV_EVENT_NONE) {
+            property_batch_flush(env, false);
             continue;
+        }
+
+        // Async thumbnails are answered here, they never reach Java as events
+        if (thumb_snapshot_reply(env, mp_event))
+            continue;
+
+        if (property_batch_update(mp_event)) {
+            property_batch_flush(env, false);
+            continue;
+        }
 
         switch (mp_event->event_id) {
         case MPV_EVENT_LOG_MESSAGE:
+            // Forwarded by log_thread, see log_queue.cpp
             msg = (mpv_event_log_message*)mp_event->data;
-            ALOGV("[%s:%s] %s", msg->prefix, msg->level, msg->text);
-            sendLogMessageToJava(env, msg);
+            log_queue_push(msg);
             break;
         case MPV_EVENT_PROPERTY_CHANGE:
             mp_property = (mpv_event_property*)mp_event->data;
-            sendPropertyUpdateToJava(env, mp_property);
+            // Batched changes that came before this one go first
+            property_batch_flush(env, true);
+            sendPropertyUpdateToJava(env, mp_property, mp_event->reply_userdata);
             break;
         default:
             ALOGV("event: %s\n", mpv_event_name(mp_event->event_id));
+            property_batch_flush(env, true);
             mpv_node event_node;
             mpv_event_to_node(&event_node, mp_event);
             sendEventToJava(env, mp_event->event_id, &event_node);
             mpv_free_node_contents(&event_node);
             break;
         }
+
+        property_batch_flush(env, false);
     }
 
+    thumb_snapshot_cancel_all(env);
+
     g_vm->DetachCurrentThread();
 
     return NULL;
@@ -0,0 +1,579 @@
+// Thumbnail benchmark for the host build (see Makefile).
+//
+// Generates synthetic clips with lavfi's testsrc2 in a few codecs, GOP sizes
+// and resolutions, then times opening and each seek mode on them through the
+// same session/decode/scale code the app uses. Also checks the fused scaling
+// kernel: every implementation has to match the scalar one exactly and stay
+// close to swscale.
+//
+// Batches go through every GOP of each clip, including one with 10 s GOPs,
+// and every target has to come back with a frame.
+//
+// Exits non-zero if a thumbnail fails or the kernel check doesn't hold, so
+// it can run in CI.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libavfilter/avfilter.h>
+    #include <libavfilter/buffersink.h>
+    #include <libavutil/opt.h>
+    #include <libavutil/mem.h>
+    #include <libavutil/pixdesc.h>
+    #include <libswscale/swscale.h>
+}
+
+#include "thumbnail_session.h"
+#include "thumbnail_image.h"
+#include "thumbnail_kernel.h"
+#include "thumbnail_pool.h"
+#include "thumbnail_stats.h"
+
+struct MediaSpec {
+    const char *codec;   // encoder name
+    int width, height;
+    int gop;             // frames between keyframes
+    int fps;
+    int seconds;
+};
+
+static const MediaSpec DEFAULT_MEDIA[] = {
+    { "libx264",    1280,  720,  48, 24, 60 },
+    { "libx264",    1920, 1080, 250, 24, 60 },
+    { "libx264",    1280,  720, 300, 30, 60 },  // 10 s GOPs, for batches
+    { "libx264",    3840, 2160,  48, 24, 20 },
+    { "mpeg4",      1280,  720,  12, 24, 60 },
+    { "libvpx-vp9", 1280,  720, 120, 24, 30 },
+    { "libx265",    1920, 1080, 120, 24, 30 },
+};
+
+struct Options {
+    std::string media_dir = "/tmp/thumbnail-bench";
+    int iterations = 50;
+    int dimension = 320;
+    std::string only_codec;
+    bool skip_kernel = false;
+};
+
+static std::string media_name(const MediaSpec &m) {
+    char name[128];
+    snprintf(name, sizeof(name), "%s-%dx%d-gop%d.mkv", m.codec, m.width, m.height, m.gop);
+    return name;
+}
+
+static bool file_exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_size > 0;
+}
+
+// ============================================================================
+// Test media
+// ============================================================================
+
+static bool encode_write(AVCodecContext *enc, AVFormatContext *oc, AVStream *st,
+    AVFrame *frame, AVPacket *pkt)
+{
+    if (avcodec_send_frame(enc, frame) < 0)
+        return false;
+    for (;;) {
+        int ret = avcodec_receive_packet(enc, pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return true;
+        if (ret < 0)
+            return false;
+        av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        if (av_interleaved_write_frame(oc, pkt) < 0)
+            return false;
+    }
+}
+
+// Render testsrc2 through libavfilter and encode it to path
+static bool generate_media(const MediaSpec &m, const std::string &path) {
+    const AVCodec *codec = avcodec_find_encoder_by_name(m.codec);
+    if (!codec) {
+        fprintf(stderr, "encoder %s not available, skipping\n", m.codec);
+        return false;
+    }
+
+    bool ok = false;
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *sink = NULL;
+    AVFilterInOut *inputs = avfilter_inout_alloc();
+    AVFilterInOut *outputs = NULL;
+    AVCodecContext *enc = NULL;
+    AVFormatContext *oc = NULL;
+    AVStream *st = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    int64_t n = 0;
+    char desc[256];
+
+    if (!graph || !inputs || !frame || !pkt)
+        goto end;
+    if (avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out",
+            NULL, NULL, graph) < 0)
+        goto end;
+
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+    snprintf(desc, sizeof(desc), "testsrc2=size=%dx%d:rate=%d:duration=%d,format=yuv420p",
+        m.width, m.height, m.fps, m.seconds);
+    if (avfilter_graph_parse_ptr(graph, desc, &inputs, &outputs, NULL) < 0 ||
+        avfilter_graph_config(graph, NULL) < 0)
+        goto end;
+
+    enc = avcodec_alloc_context3(codec);
+    if (!enc)
+        goto end;
+    enc->width = m.width;
+    enc->height = m.height;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = AVRational{1, m.fps};
+    enc->framerate = AVRational{m.fps, 1};
+    enc->gop_size = m.gop;
+    enc->max_b_frames = 2;
+    enc->bit_rate = (int64_t) m.width * m.height * m.fps / 8;
+    // Speed over quality, these only need to look like real files to the decoder
+    av_opt_set(enc->priv_data, "preset", "ultrafast", 0);
+    av_opt_set(enc->priv_data, "deadline", "realtime", 0);
+    av_opt_set_int(enc->priv_data, "cpu-used", 8, 0);
+
+    if (avformat_alloc_output_context2(&oc, NULL, "matroska", path.c_str()) < 0)
+        goto end;
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (avcodec_open2(enc, codec, NULL) < 0)
+        goto end;
+
+    st = avformat_new_stream(oc, NULL);
+    if (!st || avcodec_parameters_from_context(st->codecpar, enc) < 0)
+        goto end;
+    st->time_base = enc->time_base;
+    if (avio_open(&oc->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+        goto end;
+    if (avformat_write_header(oc, NULL) < 0)
+        goto end;
+
+    while (av_buffersink_get_frame(sink, frame) >= 0) {
+        frame->pts = n++;
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        bool written = encode_write(enc, oc, st, frame, pkt);
+        av_frame_unref(frame);
+        if (!written)
+            goto end;
+    }
+    if (!encode_write(enc, oc, st, NULL, pkt))
+        goto end;
+    ok = av_write_trailer(oc) >= 0;
+
+end:
+    if (oc) {
+        if (oc->pb)
+            avio_closep(&oc->pb);
+        avformat_free_context(oc);
+    }
+    avcodec_free_context(&enc);
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    avfilter_graph_free(&graph);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    if (!ok) {
+        fprintf(stderr, "failed to generate %s\n", path.c_str());
+        remove(path.c_str());
+    }
+    return ok;
+}
+
+// ============================================================================
+// Latency
+// ============================================================================
+
+struct Latencies {
+    std::vector<double> ms;
+    int failures = 0;
+
+    double percentile(double p) const {
+        if (ms.empty())
+            return 0;
+        std::vector<double> sorted(ms);
+        std::sort(sorted.begin(), sorted.end());
+        size_t i = (size_t) ceil(p * sorted.size());
+        return sorted[i > 0 ? i - 1 : 0];
+    }
+
+    double total() const {
+        double t = 0;
+        for (double v : ms)
+            t += v;
+        return t;
+    }
+};
+
+static void print_header() {
+    printf("%-34s %-9s %5s %8s %8s %8s %8s %9s\n",
+        "media", "mode", "n", "p50 ms", "p90 ms", "p99 ms", "max ms", "thumbs/s");
+}
+
+static void print_row(const std::string &media, const char *mode, const Latencies &l) {
+    double total = l.total();
+    printf("%-34s %-9s %5d %8.2f %8.2f %8.2f %8.2f %9.1f%s\n",
+        media.c_str(), mode, (int) l.ms.size(), l.percentile(0.5), l.percentile(0.9),
+        l.percentile(0.99), l.percentile(1.0), total > 0 ? l.ms.size() * 1000.0 / total : 0.0,
+        l.failures ? " FAILED" : "");
+}
+
+// Deterministic positions spread over the clip, visited in random order
+static std::vector<double> bench_positions(int count, double duration) {
+    std::vector<double> positions;
+    uint32_t seed = 12345;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        positions.push_back((seed >> 8) % 10000 / 10000.0 * duration * 0.95);
+    }
+    return positions;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Cold opens: demuxer + probe + decoder setup, no cached session
+static Latencies bench_open(const std::string &path, int iterations) {
+    Latencies l;
+    for (int i = 0; i < iterations; i++) {
+        thumb_session_clear(true);
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<ThumbSession> s = thumb_session_acquire(path.c_str(), false);
+        if (!s) {
+            l.failures++;
+            continue;
+        }
+        s->lock.unlock();
+        l.ms.push_back(elapsed_ms(start));
+    }
+    thumb_session_clear(true);
+    return l;
+}
+
+// Single thumbnails at scattered positions from a warm session, like scrubbing
+static Latencies bench_grab(const std::string &path, ThumbSeekMode mode, double duration,
+    int iterations, int dimension)
+{
+    Latencies l;
+    AVFrame *frame = thumb_frame_get();
+    ThumbImage image;
+    for (double position : bench_positions(iterations, duration)) {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<ThumbSession> s = thumb_session_acquire(path.c_str(), false);
+        if (!s) {
+            l.failures++;
+            continue;
+        }
+        std::lock_guard<std::mutex> session_lock(s->lock, std::adopt_lock);
+        double frame_time;
+        bool ok = thumb_session_grab(s.get(), position, mode, frame, &frame_time) &&
+            thumb_scale_frame(frame, dimension, &image);
+        av_frame_unref(frame);
+        if (!ok) {
+            s->broken = true;
+            l.failures++;
+            continue;
+        }
+        l.ms.push_back(elapsed_ms(start));
+    }
+    thumb_frame_put(frame);
+    return l;
+}
+
+// A batch (grabThumbnailsBatch) over the clip: the scattered positions plus
+// one early and one late target in every GOP, in ascending order. Every
+// target has to produce a frame, however far it is from its keyframe.
+static Latencies bench_batch(const std::string &path, const MediaSpec &m, double duration,
+    int iterations, int dimension)
+{
+    std::vector<double> positions = bench_positions(iterations, duration);
+    double gop = (double) m.gop / m.fps;
+    for (double keyframe = 0; keyframe + gop < duration; keyframe += gop) {
+        positions.push_back(keyframe + 0.5);
+        positions.push_back(keyframe + gop - 0.5);
+    }
+    std::sort(positions.begin(), positions.end());
+
+    Latencies l;
+    std::shared_ptr<ThumbSession> s = thumb_session_acquire(path.c_str(), false);
+    if (!s) {
+        l.failures++;
+        return l;
+    }
+    std::lock_guard<std::mutex> session_lock(s->lock, std::adopt_lock);
+    AVFrame *frame = thumb_frame_get();
+    ThumbImage image;
+    double last_time = -1;
+    for (double position : positions) {
+        auto start = std::chrono::steady_clock::now();
+        double frame_time;
+        bool seeked;
+        bool ok = thumb_session_grab_next(s.get(), position, last_time, frame, &frame_time, &seeked) &&
+            thumb_scale_frame(frame, dimension, &image);
+        av_frame_unref(frame);
+        if (!ok) {
+            printf("%-34s batch target %.2fs FAILED\n", media_name(m).c_str(), position);
+            last_time = -1;
+            l.failures++;
+            continue;
+        }
+        last_time = frame_time;
+        l.ms.push_back(elapsed_ms(start));
+    }
+    thumb_frame_put(frame);
+    return l;
+}
+
+static double media_duration(const std::string &path) {
+    std::shared_ptr<ThumbSession> s = thumb_session_acquire(path.c_str(), false);
+    if (!s)
+        return 0;
+    double duration = thumb_session_duration(s.get());
+    s->lock.unlock();
+    return duration;
+}
+
+// ============================================================================
+// Scaling kernel
+// ============================================================================
+
+// Decode the first frame of a file
+static AVFrame *first_frame(const std::string &path) {
+    std::shared_ptr<ThumbSession> s = thumb_session_acquire(path.c_str(), false);
+    if (!s)
+        return NULL;
+    std::lock_guard<std::mutex> session_lock(s->lock, std::adopt_lock);
+    AVFrame *frame = av_frame_alloc();
+    double frame_time;
+    if (!frame || !thumb_session_grab(s.get(), 0, THUMB_SEEK_EXACT, frame, &frame_time))
+        av_frame_free(&frame);
+    return frame;
+}
+
+// swscale with area averaging and the frame's own matrix, as the reference
+static bool scale_reference(const AVFrame *frame, int width, int height, std::vector<uint8_t> *out) {
+    SwsContext *sws = sws_getContext(frame->width, frame->height, (AVPixelFormat) frame->format,
+        width, height, AV_PIX_FMT_BGRA, SWS_AREA | SWS_ACCURATE_RND | SWS_FULL_CHR_H_INT,
+        NULL, NULL, NULL);
+    if (!sws)
+        return false;
+    int cs = frame->colorspace == AVCOL_SPC_BT709 ? SWS_CS_ITU709 :
+        frame->colorspace == AVCOL_SPC_BT2020_NCL ? SWS_CS_BT2020 : SWS_CS_DEFAULT;
+    int full = frame->color_range == AVCOL_RANGE_JPEG;
+    sws_setColorspaceDetails(sws, sws_getCoefficients(cs), full,
+        sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+    out->resize((size_t) width * height * 4);
+    uint8_t *dst[4] = { out->data() };
+    int dst_stride[4] = { width * 4 };
+    sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dst_stride);
+    sws_freeContext(sws);
+    return true;
+}
+
+// Largest allowed mean difference to swscale per channel, in 8 bit levels
+static const double KERNEL_MAX_MEAN_DIFF = 2.0;
+
+static bool bench_kernel(const std::string &media, const std::string &path, int dimension) {
+    AVFrame *frame = first_frame(path);
+    if (!frame) {
+        printf("%-34s kernel: no frame\n", media.c_str());
+        return false;
+    }
+
+    int width, height;
+    thumb_fit_dimension(frame->width, frame->height, dimension, &width, &height);
+    if (!thumb_kernel_supported(frame, width, height)) {
+        printf("%-34s kernel: %s at %dx%d not supported, skipped\n", media.c_str(),
+            av_get_pix_fmt_name((AVPixelFormat) frame->format), width, height);
+        av_frame_free(&frame);
+        return true;
+    }
+
+    std::vector<uint8_t> reference;
+    double sws_ms = 0;
+    const int runs = 20;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        scale_reference(frame, width, height, &reference);
+        sws_ms += elapsed_ms(start) / runs;
+    }
+
+    bool ok = true;
+    std::vector<uint8_t> scalar;
+    const char *impls[] = { "scalar", "neon", "sse4", "avx2" };
+    const char *selected = thumb_kernel_name();
+    for (const char *impl : impls) {
+        if (!thumb_kernel_select(impl))
+            continue;
+        std::vector<uint8_t> out((size_t) width * height * 4);
+        double ms = 0;
+        for (int i = 0; i < runs; i++) {
+            auto start = std::chrono::steady_clock::now();
+            thumb_kernel_scale(frame, width, height, out.data(), width * 4);
+            ms += elapsed_ms(start) / runs;
+        }
+
+        double sum_diff = 0;
+        int max_diff = 0;
+        for (size_t i = 0; i < out.size(); i++) {
+            if (i % 4 == 3)
+                continue;
+            int d = abs(out[i] - reference[i]);
+            sum_diff += d;
+            max_diff = std::max(max_diff, d);
+        }
+        double mean_diff = sum_diff / (out.size() / 4 * 3);
+
+        bool exact = true;
+        if (scalar.empty())
+            scalar = out;
+        else
+            exact = scalar == out;
+        bool pass = exact && mean_diff <= KERNEL_MAX_MEAN_DIFF;
+        ok &= pass;
+
+        printf("%-34s kernel %-6s %dx%d: %6.2fms (swscale %6.2fms, %4.1fx), vs swscale mean %.2f max %d%s%s\n",
+            media.c_str(), impl, width, height, ms, sws_ms, ms > 0 ? sws_ms / ms : 0.0,
+            mean_diff, max_diff, exact ? "" : ", differs from scalar", pass ? "" : " FAILED");
+    }
+    thumb_kernel_select(selected);
+    av_frame_free(&frame);
+    return ok;
+}
+
+// ============================================================================
+
+static void print_stage_stats() {
+    static const char *const names[THUMB_STAGE_COUNT] = {
+        "open", "probe", "seek", "decode", "scale", "bitmap", "total",
+    };
+    ThumbStageStats stages[THUMB_STAGE_COUNT];
+    int64_t counters[THUMB_COUNTER_COUNT];
+    thumb_stats_get(stages, counters);
+
+    printf("\nstage      calls   avg ms   max ms\n");
+    for (int i = 0; i < THUMB_STAGE_COUNT; i++) {
+        if (!stages[i].count)
+            continue;
+        printf("%-8s %7lld %8.2f %8.2f\n", names[i], (long long) stages[i].count,
+            stages[i].total_us / 1000.0 / stages[i].count, stages[i].max_us / 1000.0);
+    }
+    printf("%lld frames decoded from %lld packets, %lld MiB read, %lld seeks\n",
+        (long long) counters[THUMB_COUNT_FRAMES], (long long) counters[THUMB_COUNT_PACKETS],
+        (long long) (counters[THUMB_COUNT_BYTES_READ] >> 20), (long long) counters[THUMB_COUNT_IO_SEEKS]);
+}
+
+static void usage(const char *argv0) {
+    printf("usage: %s [options]\n"
+        "  -d DIR      where test media is generated and kept (default /tmp/thumbnail-bench)\n"
+        "  -n COUNT    thumbnails per mode and file (default 50)\n"
+        "  -s SIZE     thumbnail dimension (default 320)\n"
+        "  -c CODEC    only media encoded with this encoder\n"
+        "  -K          skip the scaling kernel check\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "-d") && value) {
+            opt.media_dir = value;
+            i++;
+        } else if (!strcmp(arg, "-n") && value) {
+            opt.iterations = atoi(value);
+            i++;
+        } else if (!strcmp(arg, "-s") && value) {
+            opt.dimension = atoi(value);
+            i++;
+        } else if (!strcmp(arg, "-c") && value) {
+            opt.only_codec = value;
+            i++;
+        } else if (!strcmp(arg, "-K")) {
+            opt.skip_kernel = true;
+        } else {
+            usage(argv[0]);
+            return strcmp(arg, "-h") ? 2 : 0;
+        }
+    }
+    if (opt.iterations <= 0 || opt.dimension <= 0 || opt.dimension > 4096) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+    mkdir(opt.media_dir.c_str(), 0755);
+    // One worker, so decoder threading matches a single request on the device
+    thumb_session_set_workers(1);
+
+    printf("kernel: %s\n\n", thumb_kernel_name());
+    print_header();
+
+    bool ok = true;
+    std::vector<std::pair<std::string, std::string>> media;
+    for (const MediaSpec &m : DEFAULT_MEDIA) {
+        if (!opt.only_codec.empty() && opt.only_codec != m.codec)
+            continue;
+        std::string name = media_name(m);
+        std::string path = opt.media_dir + "/" + name;
+        if (!file_exists(path) && !generate_media(m, path))
+            continue;
+        media.push_back(std::make_pair(name, path));
+
+        double duration = media_duration(path);
+        if (duration <= 0) {
+            printf("%-34s unknown duration FAILED\n", name.c_str());
+            ok = false;
+            continue;
+        }
+
+        Latencies open = bench_open(path, std::max(1, opt.iterations / 5));
+        print_row(name, "open", open);
+        static const struct { const char *name; ThumbSeekMode mode; } modes[] = {
+            { "keyframe", THUMB_SEEK_KEYFRAME },
+            { "fast", THUMB_SEEK_FAST },
+            { "exact", THUMB_SEEK_EXACT },
+        };
+        ok &= !open.failures;
+        for (const auto &mode : modes) {
+            Latencies l = bench_grab(path, mode.mode, duration, opt.iterations, opt.dimension);
+            print_row(name, mode.name, l);
+            ok &= !l.failures;
+        }
+        Latencies batch = bench_batch(path, m, duration, opt.iterations, opt.dimension);
+        print_row(name, "batch", batch);
+        ok &= !batch.failures;
+        thumb_session_clear(true);
+    }
+
+    if (!opt.skip_kernel) {
+        printf("\n");
+        for (const auto &m : media)
+            ok &= bench_kernel(m.first, m.second, opt.dimension);
+        thumb_session_clear(true);
+    }
+
+    print_stage_stats();
+    return ok ? 0 : 1;
+}
@@ -44,9 +44,15 @@ void init_methods_cache(JNIEnv *env)
     android_graphics_Bitmap = FIND_CLASS("android/graphics/Bitmap");
     // createBitmap(int[], int, int, android.graphics.Bitmap$Config)
     android_graphics_Bitmap_createBitmap = env->GetStaticMethodID(android_graphics_Bitmap, "createBitmap", "([IIILandroid/graphics/Bitmap$Config;)Landroid/graphics/Bitmap;");
+    // createBitmap(int, int, android.graphics.Bitmap$Config)
+    android_graphics_Bitmap_createBitmap_empty = env->GetStaticMethodID(android_graphics_Bitmap, "createBitmap", "(IILandroid/graphics/Bitmap$Config;)Landroid/graphics/Bitmap;");
+    // void reconfigure(int, int, android.graphics.Bitmap$Config)
+    android_graphics_Bitmap_reconfigure = env->GetMethodID(android_graphics_Bitmap, "reconfigure", "(IILandroid/graphics/Bitmap$Config;)V");
     android_graphics_Bitmap_Config = FIND_CLASS("android/graphics/Bitmap$Config");
     // static final android.graphics.Bitmap$Config ARGB_8888
     android_graphics_Bitmap_Config_ARGB_8888 = env->GetStaticFieldID(android_graphics_Bitmap_Config, "ARGB_8888", "Landroid/graphics/Bitmap$Config;");
+    android_graphics_Bitmap_Config_RGB_565 = env->GetStaticFieldID(android_graphics_Bitmap_Config, "RGB_565", "Landroid/graphics/Bitmap$Config;");
+    android_graphics_Bitmap_Config_ALPHA_8 = env->GetStaticFieldID(android_graphics_Bitmap_Config, "ALPHA_8", "Landroid/graphics/Bitmap$Config;");
 
     mpv_MPVLib = FIND_CLASS("is/xyz/mpv/MPVLib");
     mpv_MPVLib_eventProperty_S  = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(Ljava/lang/String;)V"); // eventProperty(String)
@@ -55,9 +61,21 @@ void init_methods_cache(JNIEnv *env)
     mpv_MPVLib_eventProperty_Sd = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(Ljava/lang/String;D)V"); // eventProperty(String, double)
     mpv_MPVLib_eventProperty_SS = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(Ljava/lang/String;Ljava/lang/String;)V"); // eventProperty(String, String)
     mpv_MPVLib_eventProperty_SN = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(Ljava/lang/String;Lis/xyz/mpv/MPVNode;)V"); // eventProperty(String, MPVNode)
+    mpv_MPVLib_eventProperty_I  = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(I)V"); // eventProperty(int)
+    mpv_MPVLib_eventProperty_Ib = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(IZ)V"); // eventProperty(int, boolean)
+    mpv_MPVLib_eventProperty_Il = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(IJ)V"); // eventProperty(int, long)
+    mpv_MPVLib_eventProperty_Id = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(ID)V"); // eventProperty(int, double)
+    mpv_MPVLib_eventProperty_IS = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(ILjava/lang/String;)V"); // eventProperty(int, String)
+    mpv_MPVLib_eventProperty_IN = env->GetStaticMethodID(mpv_MPVLib, "eventProperty", "(ILis/xyz/mpv/MPVNode;)V"); // eventProperty(int, MPVNode)
+    mpv_MPVLib_eventPropertyBatch = env->GetStaticMethodID(mpv_MPVLib, "eventPropertyBatch", "(Ljava/nio/ByteBuffer;I)V"); // eventPropertyBatch(ByteBuffer, int)
     mpv_MPVLib_event = env->GetStaticMethodID(mpv_MPVLib, "event", "(ILis/xyz/mpv/MPVNode;)V"); // event(int, MPVNode)
     mpv_MPVLib_logMessage_SiS = env->GetStaticMethodID(mpv_MPVLib, "logMessage", "(Ljava/lang/String;ILjava/lang/String;)V"); // logMessage(String, int, String)
 
+    mpv_MPVLib_ThumbnailCallback = FIND_CLASS("is/xyz/mpv/MPVLib$ThumbnailCallback");
+    mpv_MPVLib_ThumbnailCallback_onThumbnail = env->GetMethodID(mpv_MPVLib_ThumbnailCallback, "onThumbnail", "(IDLandroid/graphics/Bitmap;)V"); // onThumbnail(int, double, Bitmap)
+    mpv_MPVLib_SnapshotCallback = FIND_CLASS("is/xyz/mpv/MPVLib$SnapshotCallback");
+    mpv_MPVLib_SnapshotCallback_onSnapshot = env->GetMethodID(mpv_MPVLib_SnapshotCallback, "onSnapshot", "(Landroid/graphics/Bitmap;)V"); // onSnapshot(Bitmap)
+
     // for array node creation, tbh, it might be better to use "List" instead but i wanted consitent naming
     mpv_MPVNode = FIND_CLASS("is/xyz/mpv/MPVNode");
 
@@ -66,21 +84,27 @@ void init_methods_cache(JNIEnv *env)
 
     mpv_MPVNode_StringNode = FIND_CLASS("is/xyz/mpv/MPVNode$StringNode");
     mpv_MPVNode_StringNode_init = env->GetMethodID(mpv_MPVNode_StringNode, "<init>", "(Ljava/lang/String;)V");
+    mpv_MPVNode_StringNode_value = env->GetFieldID(mpv_MPVNode_StringNode, "value", "Ljava/lang/String;");
 
     mpv_MPVNode_BooleanNode = FIND_CLASS("is/xyz/mpv/MPVNode$BooleanNode");
     mpv_MPVNode_BooleanNode_init = env->GetMethodID(mpv_MPVNode_BooleanNode, "<init>", "(Z)V");
+    mpv_MPVNode_BooleanNode_value = env->GetFieldID(mpv_MPVNode_BooleanNode, "value", "Z");
 
     mpv_MPVNode_IntNode = FIND_CLASS("is/xyz/mpv/MPVNode$IntNode");
     mpv_MPVNode_IntNode_init = env->GetMethodID(mpv_MPVNode_IntNode, "<init>", "(J)V");
+    mpv_MPVNode_IntNode_value = env->GetFieldID(mpv_MPVNode_IntNode, "value", "J");
 
     mpv_MPVNode_DoubleNode = FIND_CLASS("is/xyz/mpv/MPVNode$DoubleNode");
     mpv_MPVNode_DoubleNode_init = env->GetMethodID(mpv_MPVNode_DoubleNode, "<init>", "(D)V");
+    mpv_MPVNode_DoubleNode_value = env->GetFieldID(mpv_MPVNode_DoubleNode, "value", "D");
 
     mpv_MPVNode_ArrayNode = FIND_CLASS("is/xyz/mpv/MPVNode$ArrayNode");
     mpv_MPVNode_ArrayNode_init = env->GetMethodID(mpv_MPVNode_ArrayNode, "<init>", "([Lis/xyz/mpv/MPVNode;)V");
+    mpv_MPVNode_ArrayNode_value = env->GetFieldID(mpv_MPVNode_ArrayNode, "value", "[Lis/xyz/mpv/MPVNode;");
 
     mpv_MPVNode_MapNode = FIND_CLASS("is/xyz/mpv/MPVNode$MapNode");
     mpv_MPVNode_MapNode_init = env->GetMethodID(mpv_MPVNode_MapNode, "<init>", "(Ljava/util/Map;)V");
+    mpv_MPVNode_MapNode_value = env->GetFieldID(mpv_MPVNode_MapNode, "value", "Ljava/util/Map;");
 
     java_util_ArrayList = FIND_CLASS("java/util/ArrayList");
     java_util_ArrayList_init = env->GetMethodID(java_util_ArrayList, "<init>", "()V");
@@ -90,6 +114,15 @@ void init_methods_cache(JNIEnv *env)
     java_util_HashMap_init = env->GetMethodID(java_util_HashMap, "<init>", "()V");
     java_util_HashMap_put = env->GetMethodID(java_util_HashMap, "put", "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
 
+    // interfaces, for reading any Map handed to us in a MapNode
+    java_util_Map = FIND_CLASS("java/util/Map");
+    java_util_Map_entrySet = env->GetMethodID(java_util_Map, "entrySet", "()Ljava/util/Set;");
+    java_util_Set = FIND_CLASS("java/util/Set");
+    java_util_Set_toArray = env->GetMethodID(java_util_Set, "toArray", "()[Ljava/lang/Object;");
+    java_util_Map_Entry = FIND_CLASS("java/util/Map$Entry");
+    java_util_Map_Entry_getKey = env->GetMethodID(java_util_Map_Entry, "getKey", "()Ljava/lang/Object;");
+    java_util_Map_Entry_getValue = env->GetMethodID(java_util_Map_Entry, "getValue", "()Ljava/lang/Object;");
+
     #undef FIND_CLASS
 
     methods_initialized = true;
@@ -16,8 +16,10 @@ UTIL_EXTERN jclass java_Integer, java_Double, java_Boolean;
 UTIL_EXTERN jmethodID java_Integer_init, java_Double_init, java_Boolean_init;
 
 UTIL_EXTERN jclass android_graphics_Bitmap, android_graphics_Bitmap_Config;
-UTIL_EXTERN jmethodID android_graphics_Bitmap_createBitmap;
-UTIL_EXTERN jfieldID android_graphics_Bitmap_Config_ARGB_8888;
+UTIL_EXTERN jmethodID android_graphics_Bitmap_createBitmap, android_graphics_Bitmap_createBitmap_empty,
+	android_graphics_Bitmap_reconfigure;
+UTIL_EXTERN jfieldID android_graphics_Bitmap_Config_ARGB_8888, android_graphics_Bitmap_Config_RGB_565,
+	android_graphics_Bitmap_Config_ALPHA_8;
 
 UTIL_EXTERN jclass mpv_MPVLib;
 UTIL_EXTERN jmethodID mpv_MPVLib_eventProperty_S,
@@ -26,16 +28,34 @@ UTIL_EXTERN jmethodID mpv_MPVLib_eventProperty_S,
 	mpv_MPVLib_eventProperty_Sd,
 	mpv_MPVLib_eventProperty_SS,
 	mpv_MPVLib_eventProperty_SN,
+	mpv_MPVLib_eventProperty_I,
+	mpv_MPVLib_eventProperty_Ib,
+	mpv_MPVLib_eventProperty_Il,
+	mpv_MPVLib_eventProperty_Id,
+	mpv_MPVLib_eventProperty_IS,
+	mpv_MPVLib_eventProperty_IN,
+	mpv_MPVLib_eventPropertyBatch,
 	mpv_MPVLib_event,
 	mpv_MPVLib_logMessage_SiS;
 
+UTIL_EXTERN jclass mpv_MPVLib_ThumbnailCallback;
+UTIL_EXTERN jmethodID mpv_MPVLib_ThumbnailCallback_onThumbnail;
+UTIL_EXTERN jclass mpv_MPVLib_SnapshotCallback;
+UTIL_EXTERN jmethodID mpv_MPVLib_SnapshotCallback_onSnapshot;
+
 UTIL_EXTERN jclass mpv_MPVNode_None, mpv_MPVNode_StringNode, mpv_MPVNode_BooleanNode,
 	mpv_MPVNode_IntNode, mpv_MPVNode_DoubleNode, mpv_MPVNode_ArrayNode, mpv_MPVNode_MapNode, mpv_MPVNode;
 UTIL_EXTERN jfieldID mpv_MPVNode_None_INSTANCE;
 UTIL_EXTERN jmethodID mpv_MPVNode_StringNode_init, mpv_MPVNode_BooleanNode_init,
 	mpv_MPVNode_IntNode_init, mpv_MPVNode_DoubleNode_init,
 	mpv_MPVNode_ArrayNode_init, mpv_MPVNode_MapNode_init;
+UTIL_EXTERN jfieldID mpv_MPVNode_StringNode_value, mpv_MPVNode_BooleanNode_value,
+	mpv_MPVNode_IntNode_value, mpv_MPVNode_DoubleNode_value,
+	mpv_MPVNode_ArrayNode_value, mpv_MPVNode_MapNode_value;
 
 UTIL_EXTERN jclass java_util_ArrayList, java_util_HashMap;
 UTIL_EXTERN jmethodID java_util_ArrayList_init, java_util_ArrayList_add,
 	java_util_HashMap_init, java_util_HashMap_put;
+UTIL_EXTERN jclass java_util_Map, java_util_Set, java_util_Map_Entry;
+UTIL_EXTERN jmethodID java_util_Map_entrySet, java_util_Set_toArray,
+	java_util_Map_Entry_getKey, java_util_Map_Entry_getValue;
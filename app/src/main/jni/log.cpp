@@ -2,6 +2,33 @@
 
 #include <stdlib.h>
 
+#ifndef __ANDROID__
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+static int level_rank(char prio)
+{
+    const char *order = "VDIWE";
+    const char *p = strchr(order, prio);
+    return p ? (int) (p - order) : 0;
+}
+
+void host_log_print(char prio, const char *fmt, ...)
+{
+    static const int min_rank = level_rank(getenv("THUMB_LOG") ? getenv("THUMB_LOG")[0] : 'W');
+    if (level_rank(prio) < min_rank)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%c/%s: ", prio, LOG_TAG);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+#endif
+
 void die(const char *msg)
 {
     ALOGE("%s", msg);
@@ -1,16 +1,25 @@
 #pragma once
 
-#include <android/log.h>
-
 #define DEBUG 1
 
 #define LOG_TAG "mpv"
-#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define ALOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOG_PRINT(prio, ...) __android_log_print(ANDROID_LOG_##prio, LOG_TAG, __VA_ARGS__)
+#else
+// Host builds (see host/Makefile) print to stderr, from the level in
+// $THUMB_LOG on (one of V, D, I, W, E; W if unset)
+void host_log_print(char prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#define LOG_PRINT(prio, ...) host_log_print(#prio[0], __VA_ARGS__)
+#endif
+
+#define ALOGE(...) LOG_PRINT(ERROR, __VA_ARGS__)
+#define ALOGW(...) LOG_PRINT(WARN, __VA_ARGS__)
+#define ALOGI(...) LOG_PRINT(INFO, __VA_ARGS__)
+#define ALOGD(...) LOG_PRINT(DEBUG, __VA_ARGS__)
 #if DEBUG
-#define ALOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
+#define ALOGV(...) LOG_PRINT(VERBOSE, __VA_ARGS__)
 #else
 #define ALOGV(...) (void)0
 #endif
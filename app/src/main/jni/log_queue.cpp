@@ -0,0 +1,361 @@
+#include "log_queue.h"
+
+#include <jni.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mpv/client.h>
+
+#include "globals.h"
+#include "jni_utils.h"
+#include "log.h"
+
+extern "C" {
+    jni_func(void, setLogLevelFilter, jstring jprefix, jint level);
+    jni_func(void, setLogRateLimit, jint per_second, jint burst);
+    jni_func(jlong, getLogDroppedCount);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// ============================================================================
+// Filters
+// ============================================================================
+
+struct LogFilter {
+    std::string prefix;
+    int level;
+};
+
+static std::mutex g_filter_mutex;
+static std::vector<LogFilter> g_filters;
+// Bumped on every change, so that event_thread knows to resolve levels again
+static std::atomic<unsigned> g_filter_generation(0);
+// Everything by default, msg-level (see create()) decides what mpv sends
+static int g_filter_default = MPV_LOG_LEVEL_TRACE;
+
+// "" sets the default, "vo" also covers "vo/gpu" and so on
+jni_func(void, setLogLevelFilter, jstring jprefix, jint level) {
+    const char *prefix = env->GetStringUTFChars(jprefix, NULL);
+    std::lock_guard<std::mutex> lock(g_filter_mutex);
+    if (!*prefix) {
+        g_filter_default = level;
+    } else {
+        auto it = std::find_if(g_filters.begin(), g_filters.end(),
+            [prefix] (const LogFilter &f) { return f.prefix == prefix; });
+        if (it != g_filters.end())
+            it->level = level;
+        else
+            g_filters.push_back({prefix, level});
+    }
+    g_filter_generation++;
+    env->ReleaseStringUTFChars(jprefix, prefix);
+}
+
+// The most specific filter for prefix decides
+static int resolve_level(const char *prefix)
+{
+    std::lock_guard<std::mutex> lock(g_filter_mutex);
+    int level = g_filter_default;
+    size_t best = 0;
+    for (const LogFilter &f : g_filters) {
+        size_t len = f.prefix.size();
+        if (len <= best || strncmp(prefix, f.prefix.c_str(), len) != 0)
+            continue;
+        if (prefix[len] == '\0' || prefix[len] == '/') {
+            level = f.level;
+            best = len;
+        }
+    }
+    return level;
+}
+
+// Levels resolved so far per prefix, only touched by event_thread. mpv uses a
+// small set of prefixes, so after the first few messages this is a lookup
+// without taking g_filter_mutex.
+static std::unordered_map<std::string, int> g_level_cache;
+static unsigned g_level_cache_generation;
+static const size_t LEVEL_CACHE_SIZE = 256;
+
+static int max_level(const char *prefix)
+{
+    unsigned generation = g_filter_generation.load(std::memory_order_acquire);
+    if (generation != g_level_cache_generation || g_level_cache.size() >= LEVEL_CACHE_SIZE) {
+        g_level_cache.clear();
+        g_level_cache_generation = generation;
+    }
+    auto it = g_level_cache.find(prefix);
+    if (it != g_level_cache.end())
+        return it->second;
+    int level = resolve_level(prefix);
+    g_level_cache.emplace(prefix, level);
+    return level;
+}
+
+// ============================================================================
+// Rate limit, a token bucket for everything less severe than warnings
+// ============================================================================
+
+static std::atomic<int> g_rate_per_second(200);
+static std::atomic<int> g_rate_burst(400);
+// only touched by event_thread
+static double g_tokens = -1;
+static Clock::time_point g_tokens_time;
+
+// 0 messages per second turns the limit off
+jni_func(void, setLogRateLimit, jint per_second, jint burst) {
+    g_rate_per_second = std::max(per_second, 0);
+    g_rate_burst = std::max(burst, 1);
+}
+
+static bool take_token()
+{
+    int rate = g_rate_per_second.load(std::memory_order_relaxed);
+    if (rate <= 0)
+        return true;
+    double burst = g_rate_burst.load(std::memory_order_relaxed);
+    Clock::time_point now = Clock::now();
+    if (g_tokens < 0)
+        g_tokens = burst;
+    else
+        g_tokens = std::min(burst, g_tokens + std::chrono::duration<double>(now - g_tokens_time).count() * rate);
+    g_tokens_time = now;
+    if (g_tokens < 1)
+        return false;
+    g_tokens -= 1;
+    return true;
+}
+
+// ============================================================================
+// Ring, single producer (event_thread) and single consumer (log_thread)
+// ============================================================================
+
+struct LogEntry {
+    int level;
+    char prefix[32];
+    char text[480];     // longer messages are cut
+};
+
+static const size_t LOG_RING_SIZE = 512;   // power of two
+static LogEntry g_ring[LOG_RING_SIZE];
+static std::atomic<size_t> g_ring_head(0);  // next slot written
+static std::atomic<size_t> g_ring_tail(0);  // next slot read
+
+static std::atomic<int64_t> g_dropped(0);
+static std::atomic<int64_t> g_dropped_unreported(0);
+
+jni_func(jlong, getLogDroppedCount) {
+    return g_dropped.load();
+}
+
+static std::mutex g_wake_mutex;
+static std::condition_variable g_wake;
+static bool g_log_thread_exit;
+static pthread_t g_log_thread_id;
+static bool g_log_thread_running;
+
+// How long log_thread lets messages pile up before forwarding them
+static const auto LOG_BATCH_INTERVAL = std::chrono::milliseconds(50);
+
+// Copy src into dst, cut to fit. A cut message keeps the line break mpv ends it with.
+static void copy_truncated(char *dst, size_t size, const char *src, bool newline)
+{
+    size_t len = strlen(src);
+    if (len < size) {
+        memcpy(dst, src, len + 1);
+        return;
+    }
+    len = size - 1 - newline;
+    // Cut before the start of a multi-byte UTF-8 sequence, not in the middle
+    // of it, Java would reject the string
+    while (len > 0 && (static_cast<unsigned char>(src[len]) & 0xc0) == 0x80)
+        len--;
+    memcpy(dst, src, len);
+    if (newline)
+        dst[len++] = '\n';
+    dst[len] = '\0';
+}
+
+static void drop()
+{
+    g_dropped++;
+    g_dropped_unreported++;
+}
+
+bool log_queue_push(const mpv_event_log_message *msg)
+{
+    if (msg->log_level > max_level(msg->prefix))
+        return false;
+    if (msg->log_level > MPV_LOG_LEVEL_WARN && !take_token()) {
+        drop();
+        return false;
+    }
+
+    size_t head = g_ring_head.load(std::memory_order_relaxed);
+    size_t tail = g_ring_tail.load(std::memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE) {
+        drop();
+        return false;
+    }
+
+    LogEntry &entry = g_ring[head & (LOG_RING_SIZE - 1)];
+    entry.level = msg->log_level;
+    copy_truncated(entry.prefix, sizeof(entry.prefix), msg->prefix, false);
+    copy_truncated(entry.text, sizeof(entry.text), msg->text, true);
+    g_ring_head.store(head + 1, std::memory_order_release);
+
+    // Otherwise log_thread picks it up with the next batch
+    if (head - tail + 1 >= LOG_RING_SIZE / 2 || msg->log_level <= MPV_LOG_LEVEL_ERROR)
+        g_wake.notify_one();
+    return true;
+}
+
+// ============================================================================
+// Forwarding to Java
+// ============================================================================
+
+// Prefixes repeat all the time, their Java strings are kept (log_thread only)
+static std::vector<std::pair<std::string, jstring>> g_prefix_cache;
+static const size_t PREFIX_CACHE_SIZE = 64;
+
+static jstring prefix_string(JNIEnv *env, const char *prefix, bool *local)
+{
+    for (auto &it : g_prefix_cache) {
+        if (it.first == prefix) {
+            *local = false;
+            return it.second;
+        }
+    }
+    jstring jprefix = env->NewStringUTF(prefix);
+    *local = true;
+    if (jprefix && g_prefix_cache.size() < PREFIX_CACHE_SIZE) {
+        jstring global = (jstring) env->NewGlobalRef(jprefix);
+        if (global) {
+            g_prefix_cache.emplace_back(prefix, global);
+            env->DeleteLocalRef(jprefix);
+            *local = false;
+            return global;
+        }
+    }
+    return jprefix;
+}
+
+static const char *level_name(int level)
+{
+    switch (level) {
+    case MPV_LOG_LEVEL_FATAL: return "fatal";
+    case MPV_LOG_LEVEL_ERROR: return "error";
+    case MPV_LOG_LEVEL_WARN: return "warn";
+    case MPV_LOG_LEVEL_INFO: return "info";
+    case MPV_LOG_LEVEL_V: return "v";
+    case MPV_LOG_LEVEL_DEBUG: return "debug";
+    default: return "trace";
+    }
+}
+
+static void sendLogMessageToJava(JNIEnv *env, const char *prefix, int level, const char *text)
+{
+    // filter the most obvious cases of invalid utf-8, since Java would choke on it
+    const auto invalid_utf8 = [] (unsigned char c) {
+        return c == 0xc0 || c == 0xc1 || c >= 0xf5;
+    };
+    for (int i = 0; text[i]; i++) {
+        if (invalid_utf8(static_cast<unsigned char>(text[i])))
+            return;
+    }
+
+    bool local_prefix;
+    jstring jprefix = prefix_string(env, prefix, &local_prefix);
+    jstring jtext = env->NewStringUTF(text);
+
+    env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_logMessage_SiS,
+        jprefix, (jint) level, jtext);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+    }
+
+    if (jprefix && local_prefix)
+        env->DeleteLocalRef(jprefix);
+    if (jtext)
+        env->DeleteLocalRef(jtext);
+}
+
+static void drain(JNIEnv *env)
+{
+    int64_t dropped = g_dropped_unreported.exchange(0);
+    if (dropped > 0) {
+        char text[64];
+        snprintf(text, sizeof(text), "%lld log messages dropped\n", (long long) dropped);
+        sendLogMessageToJava(env, "log", MPV_LOG_LEVEL_WARN, text);
+    }
+
+    size_t tail = g_ring_tail.load(std::memory_order_relaxed);
+    size_t head = g_ring_head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+        const LogEntry &entry = g_ring[tail & (LOG_RING_SIZE - 1)];
+        ALOGV("[%s:%s] %s", entry.prefix, level_name(entry.level), entry.text);
+        sendLogMessageToJava(env, entry.prefix, entry.level, entry.text);
+        g_ring_tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+static void *log_thread(void *arg)
+{
+    JNIEnv *env = NULL;
+    acquire_jni_env(g_vm, &env);
+    if (!env)
+        die("failed to acquire java env");
+
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(g_wake_mutex);
+            if (g_log_thread_exit)
+                break;
+            g_wake.wait_for(lock, LOG_BATCH_INTERVAL);
+            if (g_log_thread_exit)
+                break;
+        }
+        drain(env);
+    }
+    drain(env);
+
+    for (auto &it : g_prefix_cache)
+        env->DeleteGlobalRef(it.second);
+    g_prefix_cache.clear();
+
+    g_vm->DetachCurrentThread();
+    return NULL;
+}
+
+void log_queue_start()
+{
+    g_log_thread_exit = false;
+    if (pthread_create(&g_log_thread_id, NULL, log_thread, NULL) != 0)
+        die("thread create failed");
+    pthread_setname_np(g_log_thread_id, "log_thread");
+    g_log_thread_running = true;
+}
+
+void log_queue_stop()
+{
+    if (!g_log_thread_running)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(g_wake_mutex);
+        g_log_thread_exit = true;
+    }
+    g_wake.notify_one();
+    pthread_join(g_log_thread_id, NULL);
+    g_log_thread_running = false;
+}
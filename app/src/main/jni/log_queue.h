@@ -0,0 +1,15 @@
+#pragma once
+
+struct mpv_event_log_message;
+
+// mpv log messages take a detour on their way to MPVLib.logMessage:
+// event_thread filters them by prefix and level, rate limits them and
+// copies them into a lock-free ring, log_thread forwards them to Java in
+// batches. Log spam never holds up property changes and other events.
+
+void log_queue_start();
+// Stops log_thread after forwarding what is left. Call after event_thread exited.
+void log_queue_stop();
+
+// Called from event_thread only. Returns false if the message was dropped.
+bool log_queue_push(const mpv_event_log_message *msg);
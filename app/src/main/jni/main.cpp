@@ -16,7 +16,9 @@ extern "C" {
 #include "log.h"
 #include "jni_utils.h"
 #include "event.h"
+#include "log_queue.h"
 #include "node.h"
+#include "property_batch.h"
 
 #define ARRAYLEN(a) (sizeof(a)/sizeof(a[0]))
 
@@ -27,6 +29,7 @@ extern "C" {
 
     jni_func(void, command, jobjectArray jarray);
     jni_func(jobject, commandNode, jobjectArray jarray);
+    jni_func(jint, commandNodeBuffer, jobjectArray jarray, jobject buffer);
 };
 
 JavaVM *g_vm;
@@ -71,6 +74,8 @@ jni_func(void, init) {
     if (mpv_initialize(g_mpv) < 0)
         die("mpv init failed");
 
+    log_queue_start();
+
     g_event_thread_request_exit = false;
     if (pthread_create(&event_thread_id, NULL, event_thread, NULL) != 0)
         die("thread create failed");
@@ -87,9 +92,11 @@ jni_func(void, destroy) {
     g_event_thread_request_exit = true;
     mpv_wakeup(g_mpv);
     pthread_join(event_thread_id, NULL);
+    log_queue_stop();
 
     mpv_terminate_destroy(g_mpv);
     g_mpv = NULL;
+    property_batch_reset(env);
 }
 
 jni_func(void, command, jobjectArray jarray) {
@@ -109,37 +116,58 @@ jni_func(void, command, jobjectArray jarray) {
         env->ReleaseStringUTFChars((jstring)env->GetObjectArrayElement(jarray, i), arguments[i]);
 }
 
-jni_func(jobject, commandNode, jobjectArray jarray) {
-    CHECK_MPV_INIT();
-
+// Run a command given as strings, result is set if it returns >= 0
+static int command_node(JNIEnv *env, jobjectArray jarray, mpv_node *result)
+{
     int len = env->GetArrayLength(jarray);
     if (len == 0) die("commandNode called with empty array");
     if (len > 128) die("commandNode called with too many arguments");
 
-    mpv_node args;
-    args.format = MPV_FORMAT_NODE_ARRAY;
-    args.u.list = (mpv_node_list*)malloc(sizeof(mpv_node_list));
-    args.u.list->num = len;
-    args.u.list->values = (mpv_node*)malloc(len * sizeof(mpv_node));
+    // Same arena as setPropertyNode, nothing is freed piece by piece
+    NodeArena &arena = node_arena();
+    mpv_node_list list;
+    list.num = len;
+    list.values = (mpv_node*)arena.alloc(len * sizeof(mpv_node));
+    list.keys = NULL;
 
     for (int i = 0; i < len; ++i) {
-        const char *str = env->GetStringUTFChars((jstring)env->GetObjectArrayElement(jarray, i), NULL);
-        args.u.list->values[i].format = MPV_FORMAT_STRING;
-        args.u.list->values[i].u.string = strdup(str);
-        env->ReleaseStringUTFChars((jstring)env->GetObjectArrayElement(jarray, i), str);
+        jstring jstr = (jstring)env->GetObjectArrayElement(jarray, i);
+        list.values[i].format = MPV_FORMAT_STRING;
+        list.values[i].u.string = arena.copy(env, jstr);
+        if (jstr)
+            env->DeleteLocalRef(jstr);
     }
 
-    mpv_node result;
-    int error = mpv_command_node(g_mpv, &args, &result);
+    mpv_node args;
+    args.format = MPV_FORMAT_NODE_ARRAY;
+    args.u.list = &list;
+    int error = mpv_command_node(g_mpv, &args, result);
+
+    arena.reset();
+    return error;
+}
 
-    for (int i = 0; i < len; ++i) free(args.u.list->values[i].u.string);
-    free(args.u.list->values);
-    free(args.u.list);
+jni_func(jobject, commandNode, jobjectArray jarray) {
+    CHECK_MPV_INIT();
 
-    if (error < 0) return NULL;
+    mpv_node result;
+    if (command_node(env, jarray, &result) < 0) return NULL;
 
     jobject jresult = mpv_node_to_jobject(env, &result);
     mpv_free_node_contents(&result);
 
     return jresult;
 }
+
+// Like commandNode, but the result is encoded into buffer, see mpv_node_to_buffer
+jni_func(jint, commandNodeBuffer, jobjectArray jarray, jobject buffer) {
+    CHECK_MPV_INIT();
+
+    mpv_node result;
+    if (command_node(env, jarray, &result) < 0) return -1;
+
+    jint size = mpv_node_to_buffer(env, &result, buffer);
+    mpv_free_node_contents(&result);
+
+    return size;
+}
@@ -1,10 +1,15 @@
 #include <jni.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <mpv/client.h>
 #include "jni_utils.h"
+#include "log.h"
+#include "node.h"
 
-void free_mpv_node(mpv_node *node);
+extern "C" {
+    jni_func(void, takeNodeBuffer, jobject buffer);
+}
 
 jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
     if (!node) return NULL;
@@ -15,7 +20,9 @@ jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
         }
         case MPV_FORMAT_STRING: {
             jstring jstr = env->NewStringUTF(node->u.string);
-            return env->NewObject(mpv_MPVNode_StringNode, mpv_MPVNode_StringNode_init, jstr);
+            jobject jnode = env->NewObject(mpv_MPVNode_StringNode, mpv_MPVNode_StringNode_init, jstr);
+            env->DeleteLocalRef(jstr);
+            return jnode;
         }
         case MPV_FORMAT_FLAG: {
             return env->NewObject(mpv_MPVNode_BooleanNode, mpv_MPVNode_BooleanNode_init, (jboolean)node->u.flag);
@@ -35,27 +42,107 @@ jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node) {
                     env->DeleteLocalRef(childNode);
                 }
             }
-            return env->NewObject(mpv_MPVNode_ArrayNode, mpv_MPVNode_ArrayNode_init, nodeArray);
+            jobject jnode = env->NewObject(mpv_MPVNode_ArrayNode, mpv_MPVNode_ArrayNode_init, nodeArray);
+            env->DeleteLocalRef(nodeArray);
+            return jnode;
         }
         case MPV_FORMAT_NODE_MAP: {
             jobject hashMap = env->NewObject(java_util_HashMap, java_util_HashMap_init);
             for (int i = 0; i < node->u.list->num; i++) {
                 jstring key = env->NewStringUTF(node->u.list->keys[i]);
                 jobject childNode = mpv_node_to_jobject(env, &node->u.list->values[i]);
-                if (childNode) env->CallObjectMethod(hashMap, java_util_HashMap_put, key, childNode);
+                if (childNode) {
+                    jobject previous = env->CallObjectMethod(hashMap, java_util_HashMap_put, key, childNode);
+                    if (previous)
+                        env->DeleteLocalRef(previous);
+                    env->DeleteLocalRef(childNode);
+                }
+                env->DeleteLocalRef(key);
             }
-            return env->NewObject(mpv_MPVNode_MapNode, mpv_MPVNode_MapNode_init, hashMap);
+            jobject jnode = env->NewObject(mpv_MPVNode_MapNode, mpv_MPVNode_MapNode_init, hashMap);
+            env->DeleteLocalRef(hashMap);
+            return jnode;
         }
         default:
             return NULL;
     }
 }
 
-// recursively adding all nodes for map and arrays
-int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
-    if (!jnode || !node) return -1;
+// NodeArena
+
+static const size_t ARENA_CHUNK_SIZE = 4096;
 
-    jclass nodeClass = env->GetObjectClass(jnode);
+NodeArena::~NodeArena()
+{
+    for (char *chunk : chunks)
+        free(chunk);
+}
+
+void *NodeArena::alloc(size_t size)
+{
+    size = (size + 7) & ~(size_t) 7;
+    if (used + size > capacity) {
+        capacity = std::max(size, ARENA_CHUNK_SIZE);
+        char *chunk = (char*) malloc(capacity);
+        if (!chunk)
+            die("NodeArena: out of memory");
+        if (chunks.empty())
+            first_capacity = capacity;
+        chunks.push_back(chunk);
+        used = 0;
+    }
+    void *p = chunks.back() + used;
+    used += size;
+    return p;
+}
+
+void NodeArena::reset()
+{
+    // Keep the first chunk if it has the normal size, it is enough for most nodes
+    size_t keep = first_capacity == ARENA_CHUNK_SIZE ? 1 : 0;
+    while (chunks.size() > keep) {
+        free(chunks.back());
+        chunks.pop_back();
+    }
+    used = 0;
+    capacity = keep ? ARENA_CHUNK_SIZE : 0;
+}
+
+// Copy a Java string into the arena, without going through GetStringUTFChars
+char *NodeArena::copy(JNIEnv *env, jstring jstr)
+{
+    jsize size = jstr ? env->GetStringUTFLength(jstr) : 0;
+    char *str = (char*) alloc(size + 1);
+    if (size > 0)
+        env->GetStringUTFRegion(jstr, 0, env->GetStringLength(jstr), str);
+    str[size] = '\0';
+    return str;
+}
+
+NodeArena &node_arena()
+{
+    static thread_local NodeArena arena;
+    return arena;
+}
+
+static mpv_node_list *alloc_list(NodeArena *arena, int size, bool keys)
+{
+    mpv_node_list *list = (mpv_node_list*) arena->alloc(sizeof(mpv_node_list));
+    list->num = size;
+    list->values = size > 0 ? (mpv_node*) arena->alloc(size * sizeof(mpv_node)) : NULL;
+    list->keys = keys && size > 0 ? (char**) arena->alloc(size * sizeof(char*)) : NULL;
+    for (int i = 0; i < size; i++) {
+        list->values[i].format = MPV_FORMAT_NONE;
+        if (list->keys)
+            list->keys[i] = const_cast<char*>("");
+    }
+    return list;
+}
+
+// recursively adding all nodes for map and arrays, everything is allocated
+// from arena and goes away with it
+int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node, NodeArena *arena) {
+    if (!jnode || !node) return -1;
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_None)) {
         node->format = MPV_FORMAT_NONE;
@@ -63,166 +150,192 @@ int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node) {
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_StringNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_StringNode, "value", "Ljava/lang/String;");
-        jstring jstr = (jstring)env->GetObjectField(jnode, valueField);
-        if (jstr) {
-            const char *str = env->GetStringUTFChars(jstr, NULL);
-            node->format = MPV_FORMAT_STRING;
-            node->u.string = strdup(str);
-            env->ReleaseStringUTFChars(jstr, str);
-        } else {
-            node->format = MPV_FORMAT_STRING;
-            node->u.string = strdup("");
-        }
+        jstring jstr = (jstring)env->GetObjectField(jnode, mpv_MPVNode_StringNode_value);
+        node->format = MPV_FORMAT_STRING;
+        node->u.string = arena->copy(env, jstr);
+        if (jstr)
+            env->DeleteLocalRef(jstr);
         return 0;
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_BooleanNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_BooleanNode, "value", "Z");
-        jboolean flag = env->GetBooleanField(jnode, valueField);
         node->format = MPV_FORMAT_FLAG;
-        node->u.flag = flag;
+        node->u.flag = env->GetBooleanField(jnode, mpv_MPVNode_BooleanNode_value);
         return 0;
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_IntNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_IntNode, "value", "J");
-        jlong int64 = env->GetLongField(jnode, valueField);
         node->format = MPV_FORMAT_INT64;
-        node->u.int64 = int64;
+        node->u.int64 = env->GetLongField(jnode, mpv_MPVNode_IntNode_value);
         return 0;
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_DoubleNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_DoubleNode, "value", "D");
-        jdouble dbl = env->GetDoubleField(jnode, valueField);
         node->format = MPV_FORMAT_DOUBLE;
-        node->u.double_ = dbl;
+        node->u.double_ = env->GetDoubleField(jnode, mpv_MPVNode_DoubleNode_value);
         return 0;
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_ArrayNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_ArrayNode, "value", "[Lis/xyz/mpv/MPVNode;");
-        jobjectArray jarray = (jobjectArray)env->GetObjectField(jnode, valueField);
-
-        if (jarray) {
-            jint size = env->GetArrayLength(jarray);
+        jobjectArray jarray = (jobjectArray)env->GetObjectField(jnode, mpv_MPVNode_ArrayNode_value);
+        jint size = jarray ? env->GetArrayLength(jarray) : 0;
 
-            node->format = MPV_FORMAT_NODE_ARRAY;
-            node->u.list = (mpv_node_list*)malloc(sizeof(mpv_node_list));
-            node->u.list->num = size;
-            node->u.list->values = size > 0 ? (mpv_node*)calloc(size, sizeof(mpv_node)) : NULL;
-            node->u.list->keys = NULL;
+        node->format = MPV_FORMAT_NODE_ARRAY;
+        node->u.list = alloc_list(arena, size, false);
 
-            for (int i = 0; i < size; i++) {
-                jobject childNode = env->GetObjectArrayElement(jarray, i);
-                if (childNode) {
-                    jobject_to_mpv_node(env, childNode, &node->u.list->values[i]);
-                    env->DeleteLocalRef(childNode);
-                }
+        for (int i = 0; i < size; i++) {
+            jobject childNode = env->GetObjectArrayElement(jarray, i);
+            if (childNode) {
+                jobject_to_mpv_node(env, childNode, &node->u.list->values[i], arena);
+                env->DeleteLocalRef(childNode);
             }
-        } else {
-            node->format = MPV_FORMAT_NODE_ARRAY;
-            node->u.list = (mpv_node_list*)malloc(sizeof(mpv_node_list));
-            node->u.list->num = 0;
-            node->u.list->values = NULL;
-            node->u.list->keys = NULL;
         }
+        if (jarray)
+            env->DeleteLocalRef(jarray);
         return 0;
     }
 
     if (env->IsInstanceOf(jnode, mpv_MPVNode_MapNode)) {
-        jfieldID valueField = env->GetFieldID(mpv_MPVNode_MapNode, "value", "Ljava/util/Map;");
-        jobject jmap = env->GetObjectField(jnode, valueField);
-
-        if (jmap) {
-            jclass mapClass = env->GetObjectClass(jmap);
-            jmethodID sizeMethod = env->GetMethodID(mapClass, "size", "()I");
-            jmethodID entrySetMethod = env->GetMethodID(mapClass, "entrySet", "()Ljava/util/Set;");
-
-            jint size = env->CallIntMethod(jmap, sizeMethod);
-            jobject entrySet = env->CallObjectMethod(jmap, entrySetMethod);
-
-            jclass setClass = env->GetObjectClass(entrySet);
-            jmethodID toArrayMethod = env->GetMethodID(setClass, "toArray", "()[Ljava/lang/Object;");
-            jobjectArray entryArray = (jobjectArray)env->CallObjectMethod(entrySet, toArrayMethod);
-
-            node->format = MPV_FORMAT_NODE_MAP;
-            node->u.list = (mpv_node_list*)malloc(sizeof(mpv_node_list));
-            node->u.list->num = size;
-            node->u.list->values = size > 0 ? (mpv_node*)calloc(size, sizeof(mpv_node)) : NULL;
-            node->u.list->keys = size > 0 ? (char**)calloc(size, sizeof(char*)) : NULL;
-
-            for (int i = 0; i < size; i++) {
-                jobject entry = env->GetObjectArrayElement(entryArray, i);
-                if (entry) {
-                    jclass entryClass = env->GetObjectClass(entry);
-                    jmethodID getKeyMethod = env->GetMethodID(entryClass, "getKey", "()Ljava/lang/Object;");
-                    jmethodID getValueMethod = env->GetMethodID(entryClass, "getValue", "()Ljava/lang/Object;");
-
-                    jstring keyStr = (jstring)env->CallObjectMethod(entry, getKeyMethod);
-                    jobject valueObj = env->CallObjectMethod(entry, getValueMethod);
-
-                    if (keyStr) {
-                        const char *key = env->GetStringUTFChars(keyStr, NULL);
-                        node->u.list->keys[i] = strdup(key);
-                        env->ReleaseStringUTFChars(keyStr, key);
-                    }
-
-                    if (valueObj) {
-                        jobject_to_mpv_node(env, valueObj, &node->u.list->values[i]);
-                        env->DeleteLocalRef(valueObj);
-                    }
-
-                    env->DeleteLocalRef(entry);
-                }
+        jobject jmap = env->GetObjectField(jnode, mpv_MPVNode_MapNode_value);
+        jobject entrySet = jmap ? env->CallObjectMethod(jmap, java_util_Map_entrySet) : NULL;
+        jobjectArray entryArray = entrySet ?
+            (jobjectArray)env->CallObjectMethod(entrySet, java_util_Set_toArray) : NULL;
+        jint size = entryArray ? env->GetArrayLength(entryArray) : 0;
+
+        node->format = MPV_FORMAT_NODE_MAP;
+        node->u.list = alloc_list(arena, size, true);
+
+        for (int i = 0; i < size; i++) {
+            jobject entry = env->GetObjectArrayElement(entryArray, i);
+            if (!entry)
+                continue;
+            jstring keyStr = (jstring)env->CallObjectMethod(entry, java_util_Map_Entry_getKey);
+            jobject valueObj = env->CallObjectMethod(entry, java_util_Map_Entry_getValue);
+
+            node->u.list->keys[i] = arena->copy(env, keyStr);
+            if (keyStr)
+                env->DeleteLocalRef(keyStr);
+
+            if (valueObj) {
+                jobject_to_mpv_node(env, valueObj, &node->u.list->values[i], arena);
+                env->DeleteLocalRef(valueObj);
             }
 
+            env->DeleteLocalRef(entry);
+        }
+
+        if (entryArray)
             env->DeleteLocalRef(entryArray);
+        if (entrySet)
             env->DeleteLocalRef(entrySet);
-        } else {
-            node->format = MPV_FORMAT_NODE_MAP;
-            node->u.list = (mpv_node_list*)malloc(sizeof(mpv_node_list));
-            node->u.list->num = 0;
-            node->u.list->values = NULL;
-            node->u.list->keys = NULL;
-        }
+        if (jmap)
+            env->DeleteLocalRef(jmap);
         return 0;
     }
 
     return -1;
 }
 
-void free_mpv_node(mpv_node *node) {
-    if (!node) return;
+// Compact encoding, read by MPVNodeView.kt. Every node starts with its
+// format as one byte, followed by (native byte order):
+//   NONE        nothing
+//   STRING      int32 length, UTF-8 bytes
+//   FLAG        one byte, 0 or 1
+//   INT64       int64
+//   DOUBLE      double
+//   NODE_ARRAY  int32 count, int32 size of the entries in bytes, entries
+//   NODE_MAP    int32 count, int32 size of the entries in bytes,
+//               entries of int32 key length, key bytes, value
+//   BYTE_ARRAY  int32 length, bytes
+// The sizes let a reader skip over values it doesn't look at.
 
+template <typename T>
+static void put(std::vector<uint8_t> *out, const T &value)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(&value);
+    out->insert(out->end(), p, p + sizeof(T));
+}
+
+static void put_bytes(std::vector<uint8_t> *out, const void *data, size_t size)
+{
+    put<int32_t>(out, size);
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    out->insert(out->end(), p, p + size);
+}
+
+void mpv_node_encode(const mpv_node *node, std::vector<uint8_t> *out)
+{
     switch (node->format) {
-        case MPV_FORMAT_STRING:
-            if (node->u.string) {
-                free(node->u.string);
-                node->u.string = NULL;
+    case MPV_FORMAT_STRING:
+        out->push_back(MPV_FORMAT_STRING);
+        put_bytes(out, node->u.string, strlen(node->u.string));
+        break;
+    case MPV_FORMAT_FLAG:
+        out->push_back(MPV_FORMAT_FLAG);
+        out->push_back(node->u.flag ? 1 : 0);
+        break;
+    case MPV_FORMAT_INT64:
+        out->push_back(MPV_FORMAT_INT64);
+        put<int64_t>(out, node->u.int64);
+        break;
+    case MPV_FORMAT_DOUBLE:
+        out->push_back(MPV_FORMAT_DOUBLE);
+        put<double>(out, node->u.double_);
+        break;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        out->push_back(node->format);
+        put<int32_t>(out, node->u.list->num);
+        size_t size_at = out->size();
+        put<int32_t>(out, 0);
+        for (int i = 0; i < node->u.list->num; i++) {
+            if (node->format == MPV_FORMAT_NODE_MAP) {
+                const char *key = node->u.list->keys[i];
+                put_bytes(out, key, strlen(key));
             }
-            break;
-        case MPV_FORMAT_NODE_ARRAY:
-        case MPV_FORMAT_NODE_MAP:
-            if (node->u.list) {
-                for (int i = 0; i < node->u.list->num; i++)
-                    free_mpv_node(&node->u.list->values[i]);
-
-                if (node->format == MPV_FORMAT_NODE_MAP && node->u.list->keys) {
-                    for (int i = 0; i < node->u.list->num; i++)
-                        if (node->u.list->keys[i]) free(node->u.list->keys[i]);
-                    free(node->u.list->keys);
-                }
+            mpv_node_encode(&node->u.list->values[i], out);
+        }
+        int32_t size = out->size() - size_at - sizeof(int32_t);
+        memcpy(out->data() + size_at, &size, sizeof(size));
+        break;
+    }
+    case MPV_FORMAT_BYTE_ARRAY:
+        out->push_back(MPV_FORMAT_BYTE_ARRAY);
+        put_bytes(out, node->u.ba->data, node->u.ba->size);
+        break;
+    default:
+        out->push_back(MPV_FORMAT_NONE);
+        break;
+    }
+}
 
-                if (node->u.list->values)
-                    free(node->u.list->values);
-                free(node->u.list);
-                node->u.list = NULL;
-            }
-            break;
-        default:
-            break;
+// Encoded node that didn't fit into the caller's buffer, see takeNodeBuffer
+static thread_local std::vector<uint8_t> t_encoded;
+
+jint mpv_node_to_buffer(JNIEnv *env, const mpv_node *node, jobject buffer)
+{
+    t_encoded.clear();
+    mpv_node_encode(node, &t_encoded);
+
+    void *dst = env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (!dst || capacity < 0)
+        return -1;
+    if ((size_t) capacity >= t_encoded.size()) {
+        memcpy(dst, t_encoded.data(), t_encoded.size());
+        jint size = t_encoded.size();
+        t_encoded.clear();
+        return size;
     }
-    node->format = MPV_FORMAT_NONE;
+    return t_encoded.size();
+}
+
+// Second half of a fetch whose result was bigger than the buffer passed first
+jni_func(void, takeNodeBuffer, jobject buffer) {
+    void *dst = env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (dst && capacity >= 0 && (size_t) capacity >= t_encoded.size())
+        memcpy(dst, t_encoded.data(), t_encoded.size());
+    t_encoded.clear();
+    t_encoded.shrink_to_fit();
 }
@@ -1,9 +1,42 @@
 #pragma once
 
 #include <jni.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
 
 struct mpv_node;
 
 jobject mpv_node_to_jobject(JNIEnv *env, const mpv_node *node);
-int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node);
-void free_mpv_node(mpv_node *node);
+
+// Bump allocator for temporary mpv_node trees going to mpv. Everything is
+// released at once with reset() or the destructor, instead of node by node.
+class NodeArena {
+public:
+    NodeArena() {}
+    ~NodeArena();
+    NodeArena(const NodeArena&) = delete;
+    NodeArena &operator=(const NodeArena&) = delete;
+
+    void *alloc(size_t size);
+    // NUL terminated copy of a Java string, "" for null
+    char *copy(JNIEnv *env, jstring jstr);
+    // Free everything allocated so far, keeps some memory for reuse
+    void reset();
+
+private:
+    std::vector<char*> chunks;
+    size_t used = 0, capacity = 0, first_capacity = 0;
+};
+
+// Per thread arena for converting nodes in JNI calls, reset it when done
+NodeArena &node_arena();
+
+int jobject_to_mpv_node(JNIEnv *env, jobject jnode, mpv_node *node, NodeArena *arena);
+
+// Serialise node in the compact encoding described in node.cpp
+void mpv_node_encode(const mpv_node *node, std::vector<uint8_t> *out);
+// Encode node into a direct ByteBuffer. Returns the encoded size, -1 on error.
+// If that is more than the buffer holds, the result is kept for
+// MPVLib.takeNodeBuffer on the same thread.
+jint mpv_node_to_buffer(JNIEnv *env, const mpv_node *node, jobject buffer);
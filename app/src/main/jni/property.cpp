@@ -21,8 +21,9 @@ extern "C" {
     jni_func(void, setPropertyString, jstring jproperty, jstring jvalue);
     jni_func(jobject, getPropertyNode, jstring jproperty);
     jni_func(void, setPropertyNode, jstring jproperty, jobject jnode);
+    jni_func(jint, getPropertyNodeBuffer, jstring jproperty, jobject buffer);
 
-    jni_func(void, observeProperty, jstring property, jint format);
+    jni_func(void, observePropertyId, jstring property, jint format, jint id);
 }
 
 jni_func(jint, setOptionString, jstring joption, jstring jvalue) {
@@ -136,30 +137,51 @@ jni_func(jobject, getPropertyNode, jstring jproperty) {
     return jresult;
 }
 
-jni_func(void, setPropertyNode, jstring jproperty, jobject jnode) {
+// Like getPropertyNode, but encoded into buffer, see mpv_node_to_buffer
+jni_func(jint, getPropertyNodeBuffer, jstring jproperty, jobject buffer) {
     CHECK_MPV_INIT();
 
     const char *property = env->GetStringUTFChars(jproperty, NULL);
 
+    mpv_node result;
+    int error = mpv_get_property(g_mpv, property, MPV_FORMAT_NODE, &result);
+
+    env->ReleaseStringUTFChars(jproperty, property);
+
+    if (error < 0) return -1;
+
+    jint size = mpv_node_to_buffer(env, &result, buffer);
+    mpv_free_node_contents(&result);
+
+    return size;
+}
+
+jni_func(void, setPropertyNode, jstring jproperty, jobject jnode) {
+    CHECK_MPV_INIT();
+
+    // mpv copies the node, the whole tree is dropped with the arena afterwards
+    NodeArena &arena = node_arena();
+    const char *property = arena.copy(env, jproperty);
+
     mpv_node node;
     memset(&node, 0, sizeof(node));
-    int parse_error = jobject_to_mpv_node(env, jnode, &node);
+    int parse_error = jobject_to_mpv_node(env, jnode, &node, &arena);
 
     if (parse_error == 0) {
         int result = mpv_set_property(g_mpv, property, MPV_FORMAT_NODE, &node);
-        free_mpv_node(&node);
 
         if (result < 0)
             ALOGE("mpv_set_property(%s) returned error %s", property, mpv_error_string(result));
     }
 
-    env->ReleaseStringUTFChars(jproperty, property);
+    arena.reset();
 }
 
-jni_func(void, observeProperty, jstring property, jint format) {
+// id becomes reply_userdata, event_thread hands it to Java instead of the name
+jni_func(void, observePropertyId, jstring property, jint format, jint id) {
     CHECK_MPV_INIT();
     const char *prop = env->GetStringUTFChars(property, NULL);
-    int result = mpv_observe_property(g_mpv, 0, prop, (mpv_format)format);
+    int result = mpv_observe_property(g_mpv, (uint32_t) id, prop, (mpv_format)format);
     if (result < 0)
         ALOGE("mpv_observe_property(%s) format %d returned error %s", prop, format, mpv_error_string(result));
     env->ReleaseStringUTFChars(property, prop);
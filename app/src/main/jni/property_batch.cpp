@@ -0,0 +1,284 @@
+#include "property_batch.h"
+
+#include <jni.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mpv/client.h>
+
+#include "globals.h"
+#include "jni_utils.h"
+#include "log.h"
+
+extern "C" {
+    jni_func(jboolean, addBatchedProperty, jstring property, jint format, jint id,
+        jint min_interval_ms, jdouble deadband);
+    jni_func(void, setPropertyBatchInterval, jint interval_ms);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+struct BatchedProperty {
+    bool observed = false;
+    Clock::duration min_interval;
+    double deadband;
+
+    // latest value, format is MPV_FORMAT_NONE while the property is unavailable
+    mpv_format value_format = MPV_FORMAT_NONE;
+    int64_t value_int = 0;
+    double value_double = 0;
+    std::string value_string;
+    bool pending = false;
+
+    // what Java got last, for the deadband and the rate limit
+    bool delivered = false;
+    double delivered_value = 0;
+    Clock::time_point delivered_time;
+};
+
+static std::mutex g_batch_mutex;
+static std::vector<BatchedProperty> g_batched;  // by property id, see MPVLib.observeProperty
+static int g_batch_pending = 0;
+static Clock::time_point g_batch_next_flush;
+static Clock::time_point g_batch_last_flush;
+// 30 Hz by default, enough for position and cache displays
+static std::atomic<int> g_batch_interval_ms(33);
+
+// Packed batch handed to Java, only touched by event_thread. Each record is
+//   int32 id, int32 format, value
+// in native byte order, where the value is nothing for NONE, int32 for FLAG,
+// int64 for INT64, double for DOUBLE and int32 length + UTF-8 bytes for STRING.
+static std::vector<uint8_t> g_batch_data;
+static jobject g_batch_buffer;      // global ref, direct ByteBuffer over g_batch_data
+static const uint8_t *g_batch_buffer_data;
+static size_t g_batch_buffer_capacity;
+
+template <typename T>
+static void put(const T &value)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(&value);
+    g_batch_data.insert(g_batch_data.end(), p, p + sizeof(T));
+}
+
+static void serialize(int id, const BatchedProperty &prop)
+{
+    put<int32_t>(id);
+    put<int32_t>(prop.value_format);
+    switch (prop.value_format) {
+    case MPV_FORMAT_FLAG:
+        put<int32_t>(prop.value_int != 0);
+        break;
+    case MPV_FORMAT_INT64:
+        put<int64_t>(prop.value_int);
+        break;
+    case MPV_FORMAT_DOUBLE:
+        put<double>(prop.value_double);
+        break;
+    case MPV_FORMAT_STRING:
+        put<int32_t>(prop.value_string.size());
+        g_batch_data.insert(g_batch_data.end(), prop.value_string.begin(), prop.value_string.end());
+        break;
+    default:
+        break;
+    }
+}
+
+static bool batchable(mpv_format format)
+{
+    switch (format) {
+    case MPV_FORMAT_NONE:
+    case MPV_FORMAT_FLAG:
+    case MPV_FORMAT_INT64:
+    case MPV_FORMAT_DOUBLE:
+    case MPV_FORMAT_STRING:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns false if format can't be batched
+jni_func(jboolean, addBatchedProperty, jstring jproperty, jint format, jint id,
+    jint min_interval_ms, jdouble deadband)
+{
+    CHECK_MPV_INIT();
+
+    if (!batchable((mpv_format) format)) {
+        ALOGV("addBatchedProperty: format %d can't be batched", format);
+        return JNI_FALSE;
+    }
+    if (id <= 0) {
+        ALOGE("addBatchedProperty: invalid id %d", id);
+        return JNI_FALSE;
+    }
+
+    // Observing the same property again only changes its limits
+    std::unique_lock<std::mutex> lock(g_batch_mutex);
+    if ((size_t) id >= g_batched.size())
+        g_batched.resize(id + 1);
+    BatchedProperty &p = g_batched[id];
+    p.min_interval = std::chrono::milliseconds(std::max(min_interval_ms, 0));
+    p.deadband = std::max(deadband, 0.0);
+    bool observe = !p.observed;
+    p.observed = true;
+    lock.unlock();
+
+    if (observe) {
+        const char *prop = env->GetStringUTFChars(jproperty, NULL);
+        int result = mpv_observe_property(g_mpv, PROPERTY_BATCH_TAG | (uint32_t) id, prop, (mpv_format) format);
+        if (result < 0)
+            ALOGE("mpv_observe_property(%s) format %d returned error %s", prop, format, mpv_error_string(result));
+        env->ReleaseStringUTFChars(jproperty, prop);
+    }
+    return JNI_TRUE;
+}
+
+jni_func(void, setPropertyBatchInterval, jint interval_ms) {
+    g_batch_interval_ms = std::max(interval_ms, 0);
+}
+
+bool property_batch_update(mpv_event *event)
+{
+    if (event->event_id != MPV_EVENT_PROPERTY_CHANGE || !(event->reply_userdata & PROPERTY_BATCH_TAG))
+        return false;
+
+    uint64_t id = event->reply_userdata & ~PROPERTY_BATCH_TAG;
+    mpv_event_property *prop = static_cast<mpv_event_property*>(event->data);
+
+    std::lock_guard<std::mutex> lock(g_batch_mutex);
+    if (id >= g_batched.size() || !g_batched[id].observed)
+        return true;
+    BatchedProperty &p = g_batched[id];
+
+    double numeric = 0;
+    switch (prop->format) {
+    case MPV_FORMAT_FLAG:
+        p.value_int = *(int*)prop->data;
+        break;
+    case MPV_FORMAT_INT64:
+        p.value_int = *(int64_t*)prop->data;
+        numeric = p.value_int;
+        break;
+    case MPV_FORMAT_DOUBLE:
+        p.value_double = *(double*)prop->data;
+        numeric = p.value_double;
+        break;
+    case MPV_FORMAT_STRING:
+        p.value_string = *(const char**)prop->data;
+        break;
+    default:
+        break;
+    }
+
+    // Small changes of a number are dropped until they add up to the deadband
+    bool numeric_format = prop->format == MPV_FORMAT_INT64 || prop->format == MPV_FORMAT_DOUBLE;
+    bool within_deadband = numeric_format && p.value_format == prop->format && p.delivered &&
+        fabs(numeric - p.delivered_value) < p.deadband;
+    p.value_format = prop->format;
+    if (within_deadband || p.pending)
+        return true;
+
+    p.pending = true;
+    if (g_batch_pending++ == 0) {
+        // A change after a quiet period goes out right away, the rest waits for the tick
+        Clock::time_point now = Clock::now();
+        g_batch_next_flush = std::max(now,
+            g_batch_last_flush + std::chrono::milliseconds(g_batch_interval_ms.load()));
+    }
+    return true;
+}
+
+static void send_batch(JNIEnv *env)
+{
+    if (g_batch_buffer && (g_batch_buffer_data != g_batch_data.data() ||
+            g_batch_buffer_capacity != g_batch_data.capacity())) {
+        env->DeleteGlobalRef(g_batch_buffer);
+        g_batch_buffer = NULL;
+    }
+    if (!g_batch_buffer) {
+        jobject buffer = env->NewDirectByteBuffer(g_batch_data.data(), g_batch_data.capacity());
+        if (!buffer) {
+            ALOGE("property_batch: failed to create buffer");
+            env->ExceptionClear();
+            return;
+        }
+        g_batch_buffer = env->NewGlobalRef(buffer);
+        env->DeleteLocalRef(buffer);
+        g_batch_buffer_data = g_batch_data.data();
+        g_batch_buffer_capacity = g_batch_data.capacity();
+    }
+
+    env->CallStaticVoidMethod(mpv_MPVLib, mpv_MPVLib_eventPropertyBatch, g_batch_buffer,
+        (jint) g_batch_data.size());
+    if (env->ExceptionCheck()) {
+        ALOGE("property_batch: exception in eventPropertyBatch");
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+    }
+}
+
+void property_batch_flush(JNIEnv *env, bool force)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_batch_mutex);
+        if (!g_batch_pending)
+            return;
+        Clock::time_point now = Clock::now();
+        if (!force && now < g_batch_next_flush)
+            return;
+
+        // Properties with their own rate limit may have to sit this tick out
+        Clock::time_point held_until = Clock::time_point::max();
+        g_batch_data.clear();
+        for (size_t i = 0; i < g_batched.size(); i++) {
+            BatchedProperty &p = g_batched[i];
+            if (!p.pending)
+                continue;
+            if (!force && p.delivered && now - p.delivered_time < p.min_interval) {
+                held_until = std::min(held_until, p.delivered_time + p.min_interval);
+                continue;
+            }
+            serialize(i, p);
+            p.pending = false;
+            p.delivered = p.value_format != MPV_FORMAT_NONE;
+            p.delivered_value = p.value_format == MPV_FORMAT_DOUBLE ? p.value_double : p.value_int;
+            p.delivered_time = now;
+            g_batch_pending--;
+        }
+        g_batch_last_flush = now;
+        if (g_batch_pending) {
+            g_batch_next_flush = std::max(held_until,
+                now + std::chrono::milliseconds(g_batch_interval_ms.load()));
+        }
+    }
+
+    // Outside the lock, observers may well observe more properties
+    if (!g_batch_data.empty())
+        send_batch(env);
+}
+
+double property_batch_timeout()
+{
+    std::lock_guard<std::mutex> lock(g_batch_mutex);
+    if (!g_batch_pending)
+        return -1.0;
+    Clock::duration left = g_batch_next_flush - Clock::now();
+    return std::max(std::chrono::duration<double>(left).count(), 0.0);
+}
+
+void property_batch_reset(JNIEnv *env)
+{
+    std::lock_guard<std::mutex> lock(g_batch_mutex);
+    g_batched.clear();
+    g_batch_pending = 0;
+    if (g_batch_buffer) {
+        env->DeleteGlobalRef(g_batch_buffer);
+        g_batch_buffer = NULL;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <jni.h>
+#include <stdint.h>
+
+struct mpv_event;
+
+// Batched property observations: event_thread only keeps the latest value of
+// each of these and hands all changes of a tick to Java in one call
+// (MPVLib.eventPropertyBatch) instead of one upcall per change.
+
+// Marks reply_userdata of batched observations, the low bits are the id
+static const uint64_t PROPERTY_BATCH_TAG = 1ULL << 62;
+
+// Remember the value of a batched property change. Returns false if the
+// event isn't one.
+bool property_batch_update(mpv_event *event);
+
+// Deliver the pending values if the tick is due, or all of them right away
+// with force (before other events, so that Java sees them in order)
+void property_batch_flush(JNIEnv *env, bool force);
+
+// Timeout for mpv_wait_event until the next flush, -1 if nothing is pending
+double property_batch_timeout();
+
+// Forget all batched observations and release the Java buffer, for when the
+// mpv handle goes away (after event_thread exited)
+void property_batch_reset(JNIEnv *env);
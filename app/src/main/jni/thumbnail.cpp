@@ -1,8 +1,12 @@
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <mutex>
 #include <stdint.h>
 #include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
 
 #include <jni.h>
@@ -21,12 +25,43 @@ extern "C" {
 #include "jni_utils.h"
 #include "globals.h"
 #include "log.h"
+#include "thumbnail.h"
+#include "thumbnail_session.h"
+#include "thumbnail_storage.h"
+#include "thumbnail_image.h"
+#include "thumbnail_diskcache.h"
+#include "thumbnail_memcache.h"
+#include "thumbnail_pool.h"
+#include "thumbnail_storyboard.h"
+#include "thumbnail_request.h"
+#include "thumbnail_stats.h"
 
 extern "C" {
-    jni_func(jobject, grabThumbnail, jint dimension);
-    jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec);
+    jni_func(jobject, grabThumbnail, jint dimension, jint format);
+    jni_func(jlong, grabThumbnailAsync, jint dimension, jint format, jobject callback);
+    jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec,
+        jint flags, jdoubleArray pts_out, jlong request);
+    jni_func(jboolean, grabThumbnailInto, jstring jpath, jdouble position, jint dimension,
+        jboolean use_hw_dec, jint flags, jobject bitmap, jdoubleArray pts_out, jlong request);
     jni_func(void, setThumbnailJavaVM, jobject appctx);
-    jni_func(void, clearThumbnailCache);
+    jni_func(void, setThumbnailCacheDir, jstring jdir);
+    jni_func(void, clearThumbnailCache, jint keep_percent);
+    jni_func(void, setThumbnailMemoryCacheSize, jlong bytes);
+    jni_func(void, setThumbnailWorkerCount, jint count);
+    jni_func(jlongArray, getThumbnailCacheStats);
+    jni_func(jlongArray, getThumbnailStats);
+    jni_func(void, resetThumbnailStats);
+    jni_func(void, setThumbnailDiskCacheSize, jlong bytes);
+    jni_func(void, clearThumbnailDiskCache);
+    jni_func(jboolean, openThumbnailSession, jstring jpath, jboolean use_hw_dec);
+    jni_func(void, closeThumbnailSession, jstring jpath);
+    jni_func(jobjectArray, grabThumbnailsBatch, jstring jpath, jdoubleArray jpositions, jint dimension,
+        jboolean use_hw_dec, jint flags, jobject callback, jlong request);
+    jni_func(jstring, buildStoryboard, jstring jpath, jstring jout_dir, jdouble interval,
+        jint tile_dimension, jint columns, jint rows, jboolean use_hw_dec, jlong request);
+    jni_func(jlong, createThumbnailRequest, jlong timeout_ms);
+    jni_func(void, cancelThumbnailRequest, jlong request);
+    jni_func(void, releaseThumbnailRequest, jlong request);
 };
 
 // ============================================================================
@@ -42,36 +77,21 @@ static inline mpv_node make_node_str(const char *s)
     return r;
 }
 
-jni_func(jobject, grabThumbnail, jint dimension) {
-    auto total_start = std::chrono::high_resolution_clock::now();
-    CHECK_MPV_INIT();
-    init_methods_cache(env);
+static jobject image_to_bitmap(JNIEnv *env, const ThumbImage &image);
 
-    mpv_node result{};
-    {
-        mpv_node c{}, c_args[2];
-        mpv_node_list c_array{};
-        c_args[0] = make_node_str("screenshot-raw");
-        c_args[1] = make_node_str("video");
-        c_array.num = 2;
-        c_array.values = c_args;
-        c.format = MPV_FORMAT_NODE_ARRAY;
-        c.u.list = &c_array;
-        
-        if (mpv_command_node(g_mpv, &c, &result) < 0) {
-            ALOGE("Thumbnail (MPV) | Screenshot failed");
-            return NULL;
-        }
-    }
+// Pull the frame out of a screenshot-raw reply, crop and shrink it. The
+// reply isn't needed after this returns.
+static bool reduce_snapshot(const mpv_node *result, int dimension, ThumbImage *reduced)
+{
     int w = 0, h = 0, stride = 0;
     bool format_ok = false;
     struct mpv_byte_array *data = NULL;
     do {
-        if (result.format != MPV_FORMAT_NODE_MAP)
+        if (result->format != MPV_FORMAT_NODE_MAP)
             break;
-        for (int i = 0; i < result.u.list->num; i++) {
-            std::string key(result.u.list->keys[i]);
-            const mpv_node *val = &result.u.list->values[i];
+        for (int i = 0; i < result->u.list->num; i++) {
+            std::string key(result->u.list->keys[i]);
+            const mpv_node *val = &result->u.list->values[i];
             if (key == "w" || key == "h" || key == "stride") {
                 if (val->format != MPV_FORMAT_INT64)
                     break;
@@ -94,53 +114,75 @@ jni_func(jobject, grabThumbnail, jint dimension) {
     } while (0);
     if (!w || !h || !stride || !format_ok || !data) {
         ALOGE("Thumbnail (MPV) | Failed to extract frame data");
-        mpv_free_node_contents(&result);
+        return false;
+    }
+    return thumb_reduce_snapshot(static_cast<const uint8_t*>(data->data), w, h, stride,
+        dimension, reduced);
+}
+
+static jobject reduced_to_bitmap(JNIEnv *env, const ThumbImage &reduced, int dimension,
+    ThumbFormat format)
+{
+    ThumbImage image;
+    if (!thumb_scale_snapshot(reduced, dimension, &image)) {
+        ALOGE("Thumbnail (MPV) | Failed to create scaler");
         return NULL;
     }
+    thumb_convert_image(&image, format);
+    return image_to_bitmap(env, image);
+}
 
-    // Crop to square
-    int crop_left = 0, crop_top = 0;
-    int new_w = w, new_h = h;
-    if (w > h) {
-        crop_left = (w - h) / 2;
-        new_w = h;
-    } else if (h > w) {
-        crop_top = (h - w) / 2;
-        new_h = w;
+static bool check_snapshot_args(int dimension, int format)
+{
+    if (dimension <= 0 || dimension > 4096) {
+        ALOGE("Thumbnail (MPV) | Invalid dimension");
+        return false;
     }
+    if (format < THUMB_FORMAT_BGRA || format > THUMB_FORMAT_GRAY8) {
+        ALOGE("Thumbnail (MPV) | Invalid output format");
+        return false;
+    }
+    return true;
+}
+
+static void make_screenshot_command(mpv_node *c, mpv_node_list *c_array, mpv_node c_args[2])
+{
+    c_args[0] = make_node_str("screenshot-raw");
+    c_args[1] = make_node_str("video");
+    c_array->num = 2;
+    c_array->values = c_args;
+    c->format = MPV_FORMAT_NODE_ARRAY;
+    c->u.list = c_array;
+}
 
-    uint8_t *new_data = reinterpret_cast<uint8_t*>(data->data);
-    new_data += crop_left * sizeof(uint32_t);
-    new_data += stride * crop_top;
+jni_func(jobject, grabThumbnail, jint dimension, jint format) {
+    auto total_start = std::chrono::high_resolution_clock::now();
+    CHECK_MPV_INIT();
+    init_methods_cache(env);
 
-    // Scale to target size
-    struct SwsContext *ctx = sws_getContext(
-        new_w, new_h, AV_PIX_FMT_BGR0,
-        dimension, dimension, AV_PIX_FMT_RGB32,
-        SWS_BICUBIC, NULL, NULL, NULL);
-    if (!ctx) {
-        ALOGE("Thumbnail (MPV) | Failed to create scaler");
-        mpv_free_node_contents(&result);
+    if (!check_snapshot_args(dimension, format))
         return NULL;
-    }
 
-    jintArray arr = env->NewIntArray(dimension * dimension);
-    jint *scaled = env->GetIntArrayElements(arr, NULL);
+    mpv_node result{};
+    {
+        mpv_node c{}, c_args[2];
+        mpv_node_list c_array{};
+        make_screenshot_command(&c, &c_array, c_args);
 
-    uint8_t *src_p[4] = { new_data }, *dst_p[4] = { (uint8_t*) scaled };
-    int src_stride[4] = { stride },
-        dst_stride[4] = { (int) sizeof(jint) * dimension };
-    
-    sws_scale(ctx, src_p, src_stride, 0, new_h, dst_p, dst_stride);
-    sws_freeContext(ctx);
+        if (mpv_command_node(g_mpv, &c, &result) < 0) {
+            ALOGE("Thumbnail (MPV) | Screenshot failed");
+            return NULL;
+        }
+    }
+
+    // Full size frame is dropped before the final scale
+    ThumbImage reduced;
+    bool ok = reduce_snapshot(&result, dimension, &reduced);
     mpv_free_node_contents(&result);
-    env->ReleaseIntArrayElements(arr, scaled, 0);
+    if (!ok)
+        return NULL;
 
-    jobject bitmap_config = env->GetStaticObjectField(android_graphics_Bitmap_Config, android_graphics_Bitmap_Config_ARGB_8888);
-    jobject bitmap = env->CallStaticObjectMethod(android_graphics_Bitmap, android_graphics_Bitmap_createBitmap,
-        arr, dimension, dimension, bitmap_config);
-    env->DeleteLocalRef(arr);
-    env->DeleteLocalRef(bitmap_config);
+    jobject bitmap = reduced_to_bitmap(env, reduced, dimension, (ThumbFormat) format);
 
     auto total_end = std::chrono::high_resolution_clock::now();
     auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(total_end - total_start);
@@ -149,102 +191,139 @@ jni_func(jobject, grabThumbnail, jint dimension) {
     return bitmap;
 }
 
-// ============================================================================
-// FAST THUMBNAIL GENERATION USING DIRECT FFMPEG API
-// Bypasses MPV entirely, uses FFmpeg API directly
-// Expected performance: 50-100ms per thumbnail
-// ============================================================================
+// Async snapshots: mpv takes the screenshot on its own thread and the reply
+// is handled on event_thread, see thumb_snapshot_reply.
 
-static JavaVM *g_thumb_vm = nullptr;
-static jobject g_thumb_appctx = nullptr;
-static std::mutex g_thumb_mutex;
+// Marks reply_userdata of our screenshot commands
+static const uint64_t SNAPSHOT_REPLY_TAG = 1ULL << 63;
 
-// Codec cache for faster initialization
-struct CodecCacheEntry {
-    AVCodecID codec_id;
-    const AVCodec *codec;
-    std::chrono::steady_clock::time_point last_used;
+struct PendingSnapshot {
+    int dimension;
+    ThumbFormat format;
+    jobject callback;  // global ref
+    std::chrono::steady_clock::time_point start;
 };
 
-static std::unordered_map<AVCodecID, CodecCacheEntry> g_codec_cache;
-static std::mutex g_codec_cache_mutex;
+static std::mutex g_snapshot_mutex;
+static std::unordered_map<uint64_t, PendingSnapshot> g_snapshots;
+static uint64_t g_snapshot_next = 1;
 
-// Hardware device context cache (expensive to create)
-static AVBufferRef *g_hw_device_ctx = nullptr;
-static std::mutex g_hw_ctx_mutex;
-static bool g_hw_ctx_initialized = false;
-static bool g_hw_ctx_available = false;
+jni_func(jlong, grabThumbnailAsync, jint dimension, jint format, jobject callback) {
+    CHECK_MPV_INIT();
+    init_methods_cache(env);
 
-// Get codec from cache or find it
-static const AVCodec* get_cached_codec(AVCodecID codec_id) {
-    std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
-    
-    auto it = g_codec_cache.find(codec_id);
-    if (it != g_codec_cache.end()) {
-        it->second.last_used = std::chrono::steady_clock::now();
-        ALOGV("Thumbnail | Codec found in cache: %s", avcodec_get_name(codec_id));
-        return it->second.codec;
+    if (!check_snapshot_args(dimension, format))
+        return 0;
+
+    PendingSnapshot pending;
+    pending.dimension = dimension;
+    pending.format = (ThumbFormat) format;
+    pending.callback = env->NewGlobalRef(callback);
+    pending.start = std::chrono::steady_clock::now();
+    if (!pending.callback)
+        return 0;
+
+    // Registered first, the reply can arrive before mpv_command_node_async returns
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        id = SNAPSHOT_REPLY_TAG | g_snapshot_next++;
+        g_snapshots[id] = pending;
     }
-    
-    // Not in cache, find it
-    const AVCodec *codec = avcodec_find_decoder(codec_id);
-    if (codec) {
-        g_codec_cache[codec_id] = {codec_id, codec, std::chrono::steady_clock::now()};
-        ALOGV("Thumbnail | Codec added to cache: %s", codec->name);
+
+    mpv_node c{}, c_args[2];
+    mpv_node_list c_array{};
+    make_screenshot_command(&c, &c_array, c_args);
+    if (mpv_command_node_async(g_mpv, id, &c) < 0) {
+        ALOGE("Thumbnail (MPV) | Screenshot failed");
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        g_snapshots.erase(id);
+        env->DeleteGlobalRef(pending.callback);
+        return 0;
     }
-    
-    return codec;
+    return (jlong) (id & ~SNAPSHOT_REPLY_TAG);
 }
 
-// Initialize hardware device context once and reuse it
-static bool init_hw_device_context() {
-    std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
-    
-    if (g_hw_ctx_initialized) {
-        return g_hw_ctx_available;
+static void deliver_snapshot(JNIEnv *env, jobject callback, jobject bitmap)
+{
+    env->CallVoidMethod(callback, mpv_MPVLib_SnapshotCallback_onSnapshot, bitmap);
+    if (env->ExceptionCheck()) {
+        ALOGE("Thumbnail (MPV) | Exception in snapshot callback");
+        env->ExceptionDescribe();
+        env->ExceptionClear();
     }
-    
-    g_hw_ctx_initialized = true;
-    
-    enum AVHWDeviceType hw_type = av_hwdevice_find_type_by_name("mediacodec");
-    if (hw_type == AV_HWDEVICE_TYPE_NONE) {
-        ALOGD("Thumbnail | MediaCodec not found, HW accel unavailable");
-        g_hw_ctx_available = false;
+}
+
+bool thumb_snapshot_reply(JNIEnv *env, mpv_event *event)
+{
+    if (event->event_id != MPV_EVENT_COMMAND_REPLY || !(event->reply_userdata & SNAPSHOT_REPLY_TAG))
         return false;
+
+    PendingSnapshot pending;
+    {
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        auto it = g_snapshots.find(event->reply_userdata);
+        if (it == g_snapshots.end())
+            return true;
+        pending = it->second;
+        g_snapshots.erase(it);
     }
-    
-    if (av_hwdevice_ctx_create(&g_hw_device_ctx, hw_type, NULL, NULL, 0) < 0) {
-        ALOGD("Thumbnail | Failed to create HW device context");
-        g_hw_ctx_available = false;
-        return false;
+
+    // Only the reduced copy outlives this call, mpv frees the full size
+    // frame as soon as event_thread asks for the next event
+    ThumbImage reduced;
+    bool ok = false;
+    if (event->error < 0) {
+        ALOGE("Thumbnail (MPV) | Screenshot failed: %s", mpv_error_string(event->error));
+    } else {
+        mpv_event_command *cmd = static_cast<mpv_event_command*>(event->data);
+        ok = reduce_snapshot(&cmd->result, pending.dimension, &reduced);
     }
-    
-    ALOGI("Thumbnail | Hardware device context initialized successfully");
-    g_hw_ctx_available = true;
+
+    jobject bitmap = ok ? reduced_to_bitmap(env, reduced, pending.dimension, pending.format) : NULL;
+    deliver_snapshot(env, pending.callback, bitmap);
+    if (bitmap)
+        env->DeleteLocalRef(bitmap);
+    env->DeleteGlobalRef(pending.callback);
+
+    auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - pending.start);
+    ALOGI("Thumbnail (MPV) | async %lldms", (long long)total_duration.count());
     return true;
 }
 
-// Automatic cleanup on library unload
-static void cleanup_thumbnail_resources() __attribute__((destructor));
-static void cleanup_thumbnail_resources() {
-    // Clear codec cache
+void thumb_snapshot_cancel_all(JNIEnv *env)
+{
+    std::unordered_map<uint64_t, PendingSnapshot> pending;
     {
-        std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
-        g_codec_cache.clear();
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        pending.swap(g_snapshots);
     }
-    
-    // Release hardware context
-    {
-        std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
-        if (g_hw_device_ctx) {
-            av_buffer_unref(&g_hw_device_ctx);
-            g_hw_device_ctx = nullptr;
-        }
+    for (auto &it : pending) {
+        deliver_snapshot(env, it.second.callback, NULL);
+        env->DeleteGlobalRef(it.second.callback);
     }
-    
+}
+
+// ============================================================================
+// FAST THUMBNAIL GENERATION USING DIRECT FFMPEG API
+// Bypasses MPV entirely, uses FFmpeg API directly
+// Expected performance: 50-100ms per thumbnail
+// ============================================================================
+
+static JavaVM *g_thumb_vm = nullptr;
+static jobject g_thumb_appctx = nullptr;
+static std::mutex g_thumb_vm_mutex;
+
+// Automatic cleanup on library unload
+static void cleanup_thumbnail_resources() __attribute__((destructor));
+static void cleanup_thumbnail_resources() {
+    thumb_codec_cache_clear();
+    thumb_hw_context_release();
+
     // Release JNI global references
     {
-        std::lock_guard<std::mutex> lock(g_thumb_mutex);
+        std::lock_guard<std::mutex> lock(g_thumb_vm_mutex);
         if (g_thumb_appctx && g_thumb_vm) {
             JNIEnv* env = nullptr;
             if (g_thumb_vm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK && env) {
@@ -256,7 +335,7 @@ static void cleanup_thumbnail_resources() {
 }
 
 jni_func(void, setThumbnailJavaVM, jobject appctx) {
-    std::lock_guard<std::mutex> lock(g_thumb_mutex);
+    std::lock_guard<std::mutex> lock(g_thumb_vm_mutex);
     
     if (g_thumb_appctx) {
         env->DeleteGlobalRef(g_thumb_appctx);
@@ -275,90 +354,230 @@ jni_func(void, setThumbnailJavaVM, jobject appctx) {
     }
 }
 
-// Clear codec cache and hardware context
-jni_func(void, clearThumbnailCache) {
-    {
-        std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
-        g_codec_cache.clear();
+// Directory for persistent thumbnail data such as keyframe indexes
+jni_func(void, setThumbnailCacheDir, jstring jdir) {
+    const char *dir = env->GetStringUTFChars(jdir, NULL);
+    if (!dir)
+        return;
+    thumb_set_cache_dir(dir);
+    env->ReleaseStringUTFChars(jdir, dir);
+}
+
+// Shrink the thumbnail memory cache to keep_percent of its size and drop idle
+// decode sessions. At 0 the codec cache and hardware context go as well.
+jni_func(void, clearThumbnailCache, jint keep_percent) {
+    thumb_mem_cache_trim(keep_percent);
+    thumb_session_clear(false);
+    if (keep_percent <= 0) {
+        thumb_codec_cache_clear();
+        thumb_hw_context_release();
+        thumb_pool_clear();
     }
-    
-    {
-        std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
-        if (g_hw_device_ctx) {
-            av_buffer_unref(&g_hw_device_ctx);
-            g_hw_device_ctx = nullptr;
-        }
-        g_hw_ctx_initialized = false;
-        g_hw_ctx_available = false;
+}
+
+jni_func(void, setThumbnailMemoryCacheSize, jlong bytes) {
+    thumb_mem_cache_set_limit(bytes);
+}
+
+// Number of thumbnails decoded in parallel, 0 for the default
+jni_func(void, setThumbnailWorkerCount, jint count) {
+    thumb_session_set_workers(count);
+}
+
+// Memory cache counters: hits, misses, entries, bytes, byte limit,
+// followed by scaler pool hits and misses
+jni_func(jlongArray, getThumbnailCacheStats) {
+    ThumbMemCacheStats stats = thumb_mem_cache_stats();
+    ThumbPoolStats pool = thumb_pool_stats();
+    jlong values[] = { stats.hits, stats.misses, stats.entries, stats.bytes, stats.limit,
+        pool.scaler_hits, pool.scaler_misses };
+    jsize count = sizeof(values) / sizeof(values[0]);
+    jlongArray arr = env->NewLongArray(count);
+    if (!arr)
+        return NULL;
+    env->SetLongArrayRegion(arr, 0, count, values);
+    return arr;
+}
+
+// Counters (ThumbCounter order), then per ThumbStage: count, total us, max us
+// and the histogram buckets
+jni_func(jlongArray, getThumbnailStats) {
+    ThumbStageStats stages[THUMB_STAGE_COUNT];
+    int64_t counters[THUMB_COUNTER_COUNT];
+    thumb_stats_get(stages, counters);
+
+    std::vector<jlong> values(counters, counters + THUMB_COUNTER_COUNT);
+    for (int i = 0; i < THUMB_STAGE_COUNT; i++) {
+        values.push_back(stages[i].count);
+        values.push_back(stages[i].total_us);
+        values.push_back(stages[i].max_us);
+        values.insert(values.end(), stages[i].buckets, stages[i].buckets + THUMB_STATS_BUCKETS);
+    }
+    jlongArray arr = env->NewLongArray(values.size());
+    if (!arr)
+        return NULL;
+    env->SetLongArrayRegion(arr, 0, values.size(), values.data());
+    return arr;
+}
+
+jni_func(void, resetThumbnailStats) {
+    thumb_stats_reset();
+}
+
+// Byte budget of the persistent thumbnail cache
+jni_func(void, setThumbnailDiskCacheSize, jlong bytes) {
+    thumb_disk_cache_set_limit(bytes);
+}
+
+jni_func(void, clearThumbnailDiskCache) {
+    thumb_disk_cache_clear();
+}
+
+// Keep a decode session for path open until closeThumbnailSession is called
+jni_func(jboolean, openThumbnailSession, jstring jpath, jboolean use_hw_dec) {
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path) {
+        ALOGE("Thumbnail | Invalid path");
+        return JNI_FALSE;
+    }
+    bool ok = thumb_session_open(path, use_hw_dec);
+    env->ReleaseStringUTFChars(jpath, path);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+jni_func(void, closeThumbnailSession, jstring jpath) {
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path)
+        return;
+    thumb_session_close(path);
+    env->ReleaseStringUTFChars(jpath, path);
+}
+
+// A storyboard sheet is held in memory as RGBA while it's filled, 64 MiB at most
+static const int64_t STORYBOARD_MAX_SHEET_PIXELS = 4096 * 4096;
+
+// Build (or reuse) the storyboard for a file, returns the path of its index
+jni_func(jstring, buildStoryboard, jstring jpath, jstring jout_dir, jdouble interval,
+    jint tile_dimension, jint columns, jint rows, jboolean use_hw_dec, jlong request)
+{
+    if (tile_dimension <= 0 || tile_dimension > 4096 || columns <= 0 || rows <= 0 || !(interval > 0) ||
+        (int64_t) columns * tile_dimension > 16384 || (int64_t) rows * tile_dimension > 16384 ||
+        (int64_t) columns * rows * tile_dimension * tile_dimension > STORYBOARD_MAX_SHEET_PIXELS) {
+        ALOGE("Thumbnail | Invalid storyboard parameters");
+        return NULL;
     }
+
+    StoryboardParams params;
+    params.interval = interval;
+    params.tile_dimension = tile_dimension;
+    params.columns = columns;
+    params.rows = rows;
+    params.use_hw_dec = use_hw_dec;
+
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path) {
+        ALOGE("Thumbnail | Invalid path");
+        return NULL;
+    }
+    const char *out_dir = jout_dir ? env->GetStringUTFChars(jout_dir, NULL) : NULL;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string index = thumb_storyboard_build(path, out_dir, params, thumb_request_get(request));
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start);
+
+    if (out_dir)
+        env->ReleaseStringUTFChars(jout_dir, out_dir);
+    env->ReleaseStringUTFChars(jpath, path);
+
+    if (index.empty())
+        return NULL;
+    ALOGI("Thumbnail | Storyboard %lldms", (long long)elapsed.count());
+    return env->NewStringUTF(index.c_str());
+}
+
+// Request tokens: a deadline and a cancel switch shared between the caller
+// and the native work done for it
+jni_func(jlong, createThumbnailRequest, jlong timeout_ms) {
+    return thumb_request_create(timeout_ms);
+}
+
+jni_func(void, cancelThumbnailRequest, jlong request) {
+    thumb_request_cancel(request);
+}
+
+jni_func(void, releaseThumbnailRequest, jlong request) {
+    thumb_request_release(request);
 }
 
 // Fast extraction is the only mode - optimized for speed
 
-// Convert AVFrame to Android Bitmap
-static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, int target_dimension) {
-    init_methods_cache(env);
-    
-    // Calculate scaled dimensions while preserving aspect ratio
-    int width = frame->width;
-    int height = frame->height;
-    
-    if (width > 0 && height > 0) {
-        float scale = 1.0f;
-        if (width >= height) {
-            if (width > target_dimension) {
-                scale = (float)target_dimension / width;
-            }
-        } else {
-            if (height > target_dimension) {
-                scale = (float)target_dimension / height;
-            }
-        }
-        
-        width = (int)(width * scale);
-        height = (int)(height * scale);
+static jobject bitmap_config(JNIEnv *env, ThumbFormat format) {
+    jfieldID field;
+    switch (format) {
+    case THUMB_FORMAT_RGB565: field = android_graphics_Bitmap_Config_RGB_565; break;
+    case THUMB_FORMAT_GRAY8: field = android_graphics_Bitmap_Config_ALPHA_8; break;
+    default: field = android_graphics_Bitmap_Config_ARGB_8888; break;
     }
-    
-    if (width < 1) width = 1;
-    if (height < 1) height = 1;
-
-    // Use fast bilinear scaling for speed
-    int sws_algorithm = SWS_FAST_BILINEAR;
-
-    // Create SwsContext for scaling and format conversion
-    // Android Bitmap.Config.ARGB_8888 expects BGRA byte order (little-endian)
-    struct SwsContext *sws_ctx = sws_getContext(
-        frame->width, frame->height, (AVPixelFormat)frame->format,
-        width, height, AV_PIX_FMT_BGRA,
-        sws_algorithm, NULL, NULL, NULL
-    );
-    
-    if (!sws_ctx) {
-        ALOGE("Thumbnail | Failed to create scaler");
+    return env->GetStaticObjectField(android_graphics_Bitmap_Config, field);
+}
+
+static int android_bitmap_format(ThumbFormat format) {
+    switch (format) {
+    case THUMB_FORMAT_RGB565: return ANDROID_BITMAP_FORMAT_RGB_565;
+    case THUMB_FORMAT_GRAY8: return ANDROID_BITMAP_FORMAT_A_8;
+    default: return ANDROID_BITMAP_FORMAT_RGBA_8888;
+    }
+}
+
+static bool lock_target_bitmap(JNIEnv *env, jobject bitmap, int width, int height,
+    ThumbFormat format, uint8_t **pixels, int *stride);
+static void copy_rows(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int row_bytes, int rows);
+
+// Compact formats have no int[] constructor, their pixels are copied into a new bitmap
+static jobject compact_image_to_bitmap(JNIEnv *env, const ThumbImage &image) {
+    jobject config = bitmap_config(env, image.format);
+    if (!config) {
+        ALOGE("Thumbnail | Failed to get bitmap config");
         return NULL;
     }
-    
-    jintArray arr = env->NewIntArray(width * height);
-    if (!arr) {
-        ALOGE("Thumbnail | Failed to allocate array");
-        sws_freeContext(sws_ctx);
+    jobject bitmap = env->CallStaticObjectMethod(android_graphics_Bitmap,
+        android_graphics_Bitmap_createBitmap_empty, image.width, image.height, config);
+    env->DeleteLocalRef(config);
+    if (env->ExceptionCheck() || !bitmap) {
+        ALOGE("Thumbnail | Exception creating bitmap");
+        env->ExceptionClear();
         return NULL;
     }
-    
-    jint *pixels = env->GetIntArrayElements(arr, NULL);
-    if (!pixels) {
-        ALOGE("Thumbnail | Failed to get array elements");
-        env->DeleteLocalRef(arr);
-        sws_freeContext(sws_ctx);
+
+    uint8_t *pixels;
+    int stride;
+    if (!lock_target_bitmap(env, bitmap, image.width, image.height, image.format, &pixels, &stride)) {
+        env->DeleteLocalRef(bitmap);
         return NULL;
     }
-    
-    uint8_t *dst_data[4] = { (uint8_t*)pixels };
-    int dst_linesize[4] = { width * 4 };
-    sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
-    sws_freeContext(sws_ctx);
-    env->ReleaseIntArrayElements(arr, pixels, 0);
-    
+    copy_rows(pixels, stride, image.pixels.data(), image.stride(), image.stride(), image.height);
+    AndroidBitmap_unlockPixels(env, bitmap);
+    return bitmap;
+}
+
+// Convert a scaled thumbnail to Android Bitmap
+static jobject image_to_bitmap(JNIEnv *env, const ThumbImage &image) {
+    ThumbStageTimer timer(THUMB_STAGE_BITMAP);
+    init_methods_cache(env);
+
+    if (image.format != THUMB_FORMAT_BGRA)
+        return compact_image_to_bitmap(env, image);
+
+    int count = image.width * image.height;
+    jintArray arr = env->NewIntArray(count);
+    if (!arr) {
+        ALOGE("Thumbnail | Failed to allocate array");
+        return NULL;
+    }
+    env->SetIntArrayRegion(arr, 0, count, reinterpret_cast<const jint*>(image.pixels.data()));
+
     jobject bitmap_config = env->GetStaticObjectField(
         android_graphics_Bitmap_Config, 
         android_graphics_Bitmap_Config_ARGB_8888
@@ -373,7 +592,7 @@ static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, int target_dimension
     jobject bitmap = env->CallStaticObjectMethod(
         android_graphics_Bitmap, 
         android_graphics_Bitmap_createBitmap,
-        arr, width, height, bitmap_config
+        arr, image.width, image.height, bitmap_config
     );
     
     if (env->ExceptionCheck()) {
@@ -390,217 +609,474 @@ static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, int target_dimension
     return bitmap;
 }
 
-jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec) {
+// Resize a caller-provided Bitmap to width x height in format and lock its pixels.
+// Fails if the bitmap is immutable or its allocation is too small.
+static bool lock_target_bitmap(JNIEnv *env, jobject bitmap, int width, int height,
+    ThumbFormat format, uint8_t **pixels, int *stride)
+{
+    AndroidBitmapInfo info;
+    if (AndroidBitmap_getInfo(env, bitmap, &info) != ANDROID_BITMAP_RESULT_SUCCESS)
+        return false;
+    if ((int)info.format != android_bitmap_format(format) ||
+        (int)info.width != width || (int)info.height != height) {
+        jobject config = bitmap_config(env, format);
+        env->CallVoidMethod(bitmap, android_graphics_Bitmap_reconfigure, width, height, config);
+        env->DeleteLocalRef(config);
+        if (env->ExceptionCheck()) {
+            ALOGE("Thumbnail | Target bitmap can't hold %dx%d", width, height);
+            env->ExceptionClear();
+            return false;
+        }
+        if (AndroidBitmap_getInfo(env, bitmap, &info) != ANDROID_BITMAP_RESULT_SUCCESS)
+            return false;
+    }
+
+    void *addr = NULL;
+    if (AndroidBitmap_lockPixels(env, bitmap, &addr) != ANDROID_BITMAP_RESULT_SUCCESS || !addr) {
+        ALOGE("Thumbnail | Failed to lock bitmap pixels");
+        return false;
+    }
+    *pixels = static_cast<uint8_t*>(addr);
+    *stride = info.stride;
+    return true;
+}
+
+static void copy_rows(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int row_bytes, int rows)
+{
+    for (int y = 0; y < rows; y++)
+        memcpy(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, row_bytes);
+}
+
+// Draw a scaled thumbnail into a caller-provided Bitmap
+static jobject image_into_bitmap(JNIEnv *env, const ThumbImage &image, jobject target) {
+    ThumbStageTimer timer(THUMB_STAGE_BITMAP);
+    uint8_t *pixels;
+    int stride;
+    if (!lock_target_bitmap(env, target, image.width, image.height, image.format, &pixels, &stride))
+        return NULL;
+    copy_rows(pixels, stride, image.pixels.data(), image.stride(), image.stride(), image.height);
+    AndroidBitmap_unlockPixels(env, target);
+    return target;
+}
+
+// Scale a decoded frame, remember it in the thumbnail caches and convert it to
+// an Android Bitmap in format. With a BGRA target bitmap the scaler writes
+// straight into its pixels.
+static jobject frame_to_bitmap(JNIEnv *env, AVFrame *frame, double frame_time, int target_dimension,
+    const ThumbKey &key, ThumbFormat format, jobject target = NULL)
+{
+    std::shared_ptr<ThumbImage> image = std::make_shared<ThumbImage>();
+    image->pts = frame_time;
+    jobject bitmap = NULL;
+    if (target && format == THUMB_FORMAT_BGRA) {
+        int width, height;
+        thumb_fit_dimension(frame->width, frame->height, target_dimension, &width, &height);
+        uint8_t *pixels;
+        int stride;
+        if (!lock_target_bitmap(env, target, width, height, format, &pixels, &stride))
+            return NULL;
+        bool scaled;
+        {
+            ThumbStageTimer timer(THUMB_STAGE_SCALE);
+            scaled = thumb_scale_frame_into(frame, width, height, pixels, stride);
+        }
+        if (scaled) {
+            // The caches keep their own copy, the bitmap is the caller's to reuse
+            image->width = width;
+            image->height = height;
+            image->pixels.resize((size_t)width * height * 4);
+            copy_rows(image->pixels.data(), image->stride(), pixels, stride, image->stride(), height);
+            bitmap = target;
+        }
+        AndroidBitmap_unlockPixels(env, target);
+        if (!bitmap)
+            return NULL;
+    } else {
+        ThumbStageTimer timer(THUMB_STAGE_SCALE);
+        if (!thumb_scale_frame(frame, target_dimension, image.get()))
+            return NULL;
+    }
+    // The disk cache stores JPEG, so it gets the image before conversion
+    if (key.persistent)
+        thumb_disk_cache_put(key.hash, *image);
+    if (format != THUMB_FORMAT_BGRA) {
+        ThumbStageTimer timer(THUMB_STAGE_SCALE);
+        thumb_convert_image(image.get(), format);
+    }
+    thumb_mem_cache_put(key.hash, image);
+    if (bitmap)
+        return bitmap;
+    return target ? image_into_bitmap(env, *image, target) : image_to_bitmap(env, *image);
+}
+
+// Look the thumbnail up in the memory and disk caches, null on a miss
+static jobject cached_bitmap(JNIEnv *env, const ThumbKey &key, ThumbFormat format,
+    jobject target = NULL, double *pts = NULL)
+{
+    std::shared_ptr<const ThumbImage> image = thumb_mem_cache_get(key.hash);
+    if (!image && key.persistent) {
+        std::shared_ptr<ThumbImage> loaded = std::make_shared<ThumbImage>();
+        if (thumb_disk_cache_get(key.hash, loaded.get())) {
+            thumb_convert_image(loaded.get(), format);
+            thumb_mem_cache_put(key.hash, loaded);
+            image = loaded;
+        }
+    }
+    if (!image)
+        return NULL;
+    thumb_stats_add(THUMB_COUNT_CACHE_HITS);
+    if (pts)
+        *pts = image->pts;
+    return target ? image_into_bitmap(env, *image, target) : image_to_bitmap(env, *image);
+}
+
+// Bits of the flags argument of grabThumbnailFast/grabThumbnailInto, see FastThumbnails
+static const int THUMB_FLAG_SEEK_MASK = 0x3;   // ThumbSeekMode
+static const int THUMB_FLAG_REPRESENTATIVE = 0x4;  // skip blank frames, see thumb_session_grab_representative
+static const int THUMB_FLAG_COVER_ART = 0x8;       // prefer embedded cover art over a video frame
+static const int THUMB_FLAG_FORMAT_MASK = 0x30;    // ThumbFormat of the bitmap
+static const int THUMB_FLAG_FORMAT_SHIFT = 4;
+
+static bool format_from_flags(int flags, ThumbFormat *format) {
+    int f = (flags & THUMB_FLAG_FORMAT_MASK) >> THUMB_FLAG_FORMAT_SHIFT;
+    if (f > THUMB_FORMAT_GRAY8) {
+        ALOGE("Thumbnail | Invalid output format");
+        return false;
+    }
+    *format = (ThumbFormat) f;
+    return true;
+}
+
+// Shared by grabThumbnailFast and grabThumbnailInto: returns a new Bitmap, or
+// target itself if one was given and the thumbnail was drawn into it.
+// The time of the frame used ends up in *pts.
+static jobject grab_thumbnail(JNIEnv *env, jstring jpath, double position, int dimension,
+    bool use_hw_dec, int flags, jobject target, double *pts, int64_t request_id)
+{
     auto total_start = std::chrono::high_resolution_clock::now();
-    
-    std::lock_guard<std::mutex> lock(g_thumb_mutex);
+
     init_methods_cache(env);
-    
+
     // Validate parameters
     if (dimension <= 0 || dimension > 4096) {
         ALOGE("Thumbnail | Invalid dimension");
         return NULL;
     }
-    
+
     if (position < 0.0) {
         ALOGE("Thumbnail | Invalid position");
         return NULL;
     }
-    
+
     const char *path = env->GetStringUTFChars(jpath, NULL);
     if (!path) {
         ALOGE("Thumbnail | Invalid path");
         return NULL;
     }
-    
-    // Open video file
-    AVFormatContext *format_ctx = NULL;
-    if (avformat_open_input(&format_ctx, path, NULL, NULL) < 0) {
-        ALOGE("Thumbnail | Failed to open file");
+
+    ThumbStatsScope stats("Frame");
+    ThumbSeekMode mode = (ThumbSeekMode) (flags & THUMB_FLAG_SEEK_MASK);
+    if (mode > THUMB_SEEK_EXACT) {
+        ALOGE("Thumbnail | Invalid seek mode");
         env->ReleaseStringUTFChars(jpath, path);
         return NULL;
     }
-    env->ReleaseStringUTFChars(jpath, path);
-    
-    // Find stream information (ultra-fast minimal analysis)
-    format_ctx->max_analyze_duration = 100000;
-    format_ctx->probesize = 500000;
-    format_ctx->fps_probe_size = 1;
-    format_ctx->max_ts_probe = 1;
-    
-    if (avformat_find_stream_info(format_ctx, NULL) < 0) {
-        ALOGE("Thumbnail | Failed to find stream info");
-        avformat_close_input(&format_ctx);
+
+    ThumbFormat format;
+    if (!format_from_flags(flags, &format)) {
+        env->ReleaseStringUTFChars(jpath, path);
         return NULL;
     }
-    
-    // Find video stream
-    int video_stream_idx = -1;
-    AVCodecParameters *codec_params = NULL;
-    
-    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
-        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_stream_idx = i;
-            codec_params = format_ctx->streams[i]->codecpar;
-            break;
-        }
+
+    bool representative = flags & THUMB_FLAG_REPRESENTATIVE;
+    bool prefer_cover = flags & THUMB_FLAG_COVER_ART;
+
+    // Previously generated thumbnails skip decoding entirely
+    ThumbKey key = thumb_key(path, position, dimension,
+        mode | (flags & (THUMB_FLAG_REPRESENTATIVE | THUMB_FLAG_COVER_ART | THUMB_FLAG_FORMAT_MASK)),
+        mode == THUMB_SEEK_EXACT);
+    jobject cached = cached_bitmap(env, key, format, target, pts);
+    if (cached) {
+        env->ReleaseStringUTFChars(jpath, path);
+        auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - total_start);
+        ALOGI("Thumbnail | Cached, %lldms", (long long)total_duration.count());
+        stats.ok = true;
+        return cached;
     }
-    
-    if (video_stream_idx == -1) {
-        ALOGE("Thumbnail | No video stream found");
-        avformat_close_input(&format_ctx);
+
+    // Wait for a free worker, then reuse an idle demuxer/decoder for this file if there is one
+    std::shared_ptr<ThumbRequest> request = thumb_request_get(request_id);
+    ThumbWorkerSlot slot(request.get());
+    std::shared_ptr<ThumbSession> session = slot.acquired() ?
+        thumb_session_acquire(path, use_hw_dec, request) : nullptr;
+    env->ReleaseStringUTFChars(jpath, path);
+    if (!session) {
+        if (request && request->expired())
+            ALOGV("Thumbnail | Request cancelled");
         return NULL;
     }
-    
-    AVStream *video_stream = format_ctx->streams[video_stream_idx];
-    
-    // Initialize codec
-    const AVCodec *codec = get_cached_codec(codec_params->codec_id);
-    if (!codec) {
-        ALOGE("Thumbnail | Codec not found");
-        avformat_close_input(&format_ctx);
+
+    std::lock_guard<std::mutex> session_lock(session->lock, std::adopt_lock);
+
+    AVFrame *frame = thumb_frame_get();
+    if (!frame) {
+        ALOGE("Thumbnail | Failed to allocate frame");
         return NULL;
     }
-    
-    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        ALOGE("Thumbnail | Failed to allocate codec context");
-        avformat_close_input(&format_ctx);
-        return NULL;
+
+    jobject bitmap = NULL;
+    double frame_time = -1;
+    bool frame_found;
+    if (session->cover_only || (prefer_cover && session->cover_stream_idx >= 0))
+        frame_found = thumb_session_grab_cover(session.get(), dimension, frame);
+    else if (representative)
+        frame_found = thumb_session_grab_representative(session.get(), position, mode, frame, &frame_time);
+    else
+        frame_found = thumb_session_grab(session.get(), position, mode, frame, &frame_time);
+    if (frame_found) {
+        *pts = frame_time;
+        bitmap = frame_to_bitmap(env, frame, frame_time, dimension, key, format, target);
+        if (!bitmap)
+            ALOGE("Thumbnail | Failed to convert frame");
+    } else if (!request || !request->expired()) {
+        // Don't trust this decoder for the next request
+        session->broken = true;
     }
-    
-    if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
-        ALOGE("Thumbnail | Failed to copy codec params");
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
+
+    thumb_frame_put(frame);
+
+    auto total_end = std::chrono::high_resolution_clock::now();
+    auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(total_end - total_start);
+
+    if (!frame_found || !bitmap) {
+        ALOGE("Thumbnail | Failed: no frame found");
         return NULL;
     }
-    
-    // Optimized for speed
-    codec_ctx->thread_count = 0;
-    codec_ctx->thread_type = FF_THREAD_SLICE;
-    codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
-    codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
-    codec_ctx->skip_frame = AVDISCARD_NONREF;
-    codec_ctx->skip_idct = AVDISCARD_BIDIR;
-    codec_ctx->skip_loop_filter = AVDISCARD_ALL;
-    codec_ctx->export_side_data = 0;
-    codec_ctx->err_recognition = 0;
-    codec_ctx->workaround_bugs = 0;
-    codec_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
-    
-    // Enable hardware decoding if requested
-    if (use_hw_dec && init_hw_device_context()) {
-        std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
-        if (g_hw_device_ctx) {
-            codec_ctx->hw_device_ctx = av_buffer_ref(g_hw_device_ctx);
+
+    ALOGI("Thumbnail | %.3fs -> %.3fs, %lldms", position, frame_time, (long long)total_duration.count());
+    stats.ok = true;
+    return bitmap;
+}
+
+// Report the time of the frame a thumbnail was made from to the caller
+static void store_pts(JNIEnv *env, jdoubleArray pts_out, double pts) {
+    if (pts_out && env->GetArrayLength(pts_out) > 0)
+        env->SetDoubleArrayRegion(pts_out, 0, 1, &pts);
+}
+
+jni_func(jobject, grabThumbnailFast, jstring jpath, jdouble position, jint dimension, jboolean use_hw_dec,
+    jint flags, jdoubleArray pts_out, jlong request)
+{
+    double pts = -1;
+    jobject bitmap = grab_thumbnail(env, jpath, position, dimension, use_hw_dec, flags, NULL, &pts, request);
+    store_pts(env, pts_out, pts);
+    return bitmap;
+}
+
+// Like grabThumbnailFast, but draws into a reusable mutable ARGB_8888 bitmap.
+// The bitmap is reconfigured to the thumbnail's size, so its allocation must
+// hold dimension x dimension pixels.
+jni_func(jboolean, grabThumbnailInto, jstring jpath, jdouble position, jint dimension,
+    jboolean use_hw_dec, jint flags, jobject bitmap, jdoubleArray pts_out, jlong request)
+{
+    if (!bitmap) {
+        ALOGE("Thumbnail | No target bitmap");
+        return JNI_FALSE;
+    }
+    double pts = -1;
+    bool ok = grab_thumbnail(env, jpath, position, dimension, use_hw_dec, flags, bitmap, &pts, request) != NULL;
+    store_pts(env, pts_out, pts);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+// Hand a finished batch thumbnail to the caller: either stored into the result
+// array or streamed through the callback.
+static void deliver_batch_result(JNIEnv *env, jobjectArray results, jobject callback,
+    int index, double position, jobject bitmap)
+{
+    if (callback) {
+        env->CallVoidMethod(callback, mpv_MPVLib_ThumbnailCallback_onThumbnail,
+            (jint) index, (jdouble) position, bitmap);
+        if (env->ExceptionCheck()) {
+            ALOGE("Thumbnail | Exception in batch callback");
+            env->ExceptionClear();
         }
+    } else {
+        env->SetObjectArrayElement(results, index, bitmap);
     }
-    
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        ALOGE("Thumbnail | Failed to open codec");
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
+}
+
+jni_func(jobjectArray, grabThumbnailsBatch, jstring jpath, jdoubleArray jpositions, jint dimension,
+    jboolean use_hw_dec, jint flags, jobject callback, jlong request_id)
+{
+    auto total_start = std::chrono::high_resolution_clock::now();
+
+    init_methods_cache(env);
+
+    if (dimension <= 0 || dimension > 4096) {
+        ALOGE("Thumbnail | Invalid dimension");
         return NULL;
     }
-    
-    // Seek to position (skip if near start)
-    if (position > 1.0 && position < INT64_MAX / AV_TIME_BASE) {
-        int64_t timestamp = (int64_t)(position * AV_TIME_BASE);
-        if (av_seek_frame(format_ctx, video_stream_idx, 
-                          timestamp * video_stream->time_base.den / video_stream->time_base.num / AV_TIME_BASE,
-                          AVSEEK_FLAG_ANY) < 0) {
-            ALOGW("Thumbnail | Seek failed, using first frame");
+
+    // KEYFRAME reads nothing but keyframes, for bulk sampling of long files.
+    // Otherwise every target gets a frame close to it, EXACT is treated as FAST.
+    bool keyframes = (flags & THUMB_FLAG_SEEK_MASK) == THUMB_SEEK_KEYFRAME;
+    int variant = keyframes ? THUMB_SEEK_KEYFRAME : THUMB_SEEK_FAST;
+    variant |= flags & (THUMB_FLAG_COVER_ART | THUMB_FLAG_FORMAT_MASK);
+    ThumbFormat format;
+    if (!format_from_flags(flags, &format))
+        return NULL;
+
+    int count = jpositions ? env->GetArrayLength(jpositions) : 0;
+    std::vector<double> positions(count);
+    if (count > 0)
+        env->GetDoubleArrayRegion(jpositions, 0, count, positions.data());
+
+    jobjectArray results = NULL;
+    if (!callback) {
+        results = env->NewObjectArray(count, android_graphics_Bitmap, NULL);
+        if (!results) {
+            ALOGE("Thumbnail | Failed to allocate result array");
+            return NULL;
         }
-        avcodec_flush_buffers(codec_ctx);
     }
-    
-    // Decode frame
-    AVPacket *packet = av_packet_alloc();
-    AVFrame *frame = av_frame_alloc();
-    if (!packet || !frame) {
-        ALOGE("Thumbnail | Failed to allocate packet/frame");
-        if (packet) av_packet_free(&packet);
-        if (frame) av_frame_free(&frame);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&format_ctx);
-        return NULL;
+    if (count == 0)
+        return results;
+
+    const char *path = env->GetStringUTFChars(jpath, NULL);
+    if (!path) {
+        ALOGE("Thumbnail | Invalid path");
+        return results;
     }
-    
-    AVFrame *rgb_frame = NULL;
-    jobject bitmap = NULL;
-    
-    bool frame_found = false;
-    int frames_decoded = 0;
-    int packets_read = 0;
-    const int MAX_FRAMES = 100;  // Reduced safety limit for speed (was 300)
-    
-    while (av_read_frame(format_ctx, packet) >= 0 && frames_decoded < MAX_FRAMES) {
-        packets_read++;
-        
-        if (packet->stream_index == video_stream_idx) {
-            // Send packet to decoder
-            if (avcodec_send_packet(codec_ctx, packet) >= 0) {
-                // Receive decoded frame
-                while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
-                    frames_decoded++;
-                    
-                    // Calculate frame timestamp
-                    double frame_time = 0.0;
-                    if (frame->pts != AV_NOPTS_VALUE) {
-                        frame_time = frame->pts * av_q2d(video_stream->time_base);
-                    } else if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
-                        frame_time = frame->best_effort_timestamp * av_q2d(video_stream->time_base);
-                    }
-                    
-                    // ULTRA FAST: Accept first frame if within reasonable range
-                    // For maximum speed, we accept very lenient matching
-                    const double skip_tolerance = 5.0;   // Skip frames more than 5s before target
-                    const double match_tolerance = 5.0;  // Accept frames within 5s of target
-                    
-                    if (position > 0.0 && frame_time < position - skip_tolerance) {
-                        av_frame_unref(frame);
-                        continue;
-                    }
-                    
-                    // Accept frame if close to target
-                    if (position == 0.0 || frame_time >= position - match_tolerance) {
-                        bitmap = frame_to_bitmap(env, frame, dimension);
-                        if (bitmap) {
-                            frame_found = true;
-                        } else {
-                            ALOGE("Thumbnail | Failed to convert frame");
-                        }
-                        break;
-                    }
-                    
-                    av_frame_unref(frame);
-                }
+
+    ThumbStatsScope stats("Batch");
+
+    // Serve what we can from the disk cache, only the rest needs decoding
+    std::vector<ThumbKey> keys(count);
+    std::vector<int> order;
+    int cached = 0;
+    for (int i = 0; i < count; i++) {
+        if (positions[i] < 0.0) {
+            deliver_batch_result(env, results, callback, i, positions[i], NULL);
+            continue;
+        }
+        keys[i] = thumb_key(path, positions[i], dimension, variant);
+        jobject bitmap = cached_bitmap(env, keys[i], format);
+        if (bitmap) {
+            deliver_batch_result(env, results, callback, i, positions[i], bitmap);
+            env->DeleteLocalRef(bitmap);
+            cached++;
+            continue;
+        }
+        order.push_back(i);
+    }
+    if (order.empty()) {
+        env->ReleaseStringUTFChars(jpath, path);
+        ALOGI("Thumbnail | Batch %d/%d cached", cached, count);
+        stats.ok = true;
+        return results;
+    }
+
+    std::shared_ptr<ThumbRequest> request = thumb_request_get(request_id);
+    ThumbWorkerSlot slot(request.get());
+    std::shared_ptr<ThumbSession> session = slot.acquired() ?
+        thumb_session_acquire(path, use_hw_dec, request) : nullptr;
+    env->ReleaseStringUTFChars(jpath, path);
+    if (!session)
+        return results;
+
+    std::lock_guard<std::mutex> session_lock(session->lock, std::adopt_lock);
+    ThumbSession *s = session.get();
+    // Every target gets the same picture
+    bool use_cover = s->cover_only || ((flags & THUMB_FLAG_COVER_ART) && s->cover_stream_idx >= 0);
+
+    // Visit the targets in file order, results keep the caller's order
+    std::stable_sort(order.begin(), order.end(), [&positions] (int a, int b) {
+        return positions[a] < positions[b];
+    });
+
+    AVFrame *frame = thumb_frame_get();
+    if (!frame) {
+        ALOGE("Thumbnail | Failed to allocate frame");
+        return results;
+    }
+
+    double last_time = -1;        // time of the last decoded frame, -1 if none
+    double last_position = -1;
+    jobject last_bitmap = NULL;
+    int seeks = 0, produced = 0;
+
+    for (size_t n = 0; n < order.size(); n++) {
+        int index = order[n];
+        double position = positions[index];
+
+        // Abandoned: the remaining targets get no thumbnail (and no callback)
+        if (request && request->expired()) {
+            ALOGV("Thumbnail | Batch cancelled, %d targets left", (int) (order.size() - n));
+            break;
+        }
+
+        // Same target as before, hand out the same bitmap
+        if (last_bitmap && position == last_position) {
+            deliver_batch_result(env, results, callback, index, position, last_bitmap);
+            continue;
+        }
+
+        double frame_time = -1;
+        bool found;
+        if (use_cover) {
+            if (last_bitmap) {
+                deliver_batch_result(env, results, callback, index, position, last_bitmap);
+                continue;
             }
-            
-            if (frame_found) {
-                av_packet_unref(packet);
-                break;
+            found = thumb_session_grab_cover(s, dimension, frame);
+        } else if (keyframes) {
+            // Targets within the same GOP share its keyframe's thumbnail
+            double keyframe = thumb_session_keyframe_before(s, position);
+            if (last_bitmap && keyframe >= 0 && keyframe == last_time) {
+                deliver_batch_result(env, results, callback, index, position, last_bitmap);
+                continue;
             }
+            found = thumb_session_grab(s, position, THUMB_SEEK_KEYFRAME, frame, &frame_time);
+            seeks++;
+        } else {
+            bool seeked;
+            found = thumb_session_grab_next(s, position, last_time, frame, &frame_time, &seeked);
+            seeks += seeked;
         }
-        
-        av_packet_unref(packet);
+
+        if (last_bitmap)
+            env->DeleteLocalRef(last_bitmap);
+        last_bitmap = NULL;
+        last_position = position;
+
+        if (found) {
+            last_time = frame_time;
+            last_bitmap = frame_to_bitmap(env, frame, frame_time, dimension, keys[index], format);
+            av_frame_unref(frame);
+            if (last_bitmap)
+                produced++;
+            else
+                ALOGE("Thumbnail | Failed to convert frame");
+        } else {
+            // Decoder state is unknown, the next target seeks again
+            last_time = -1;
+        }
+
+        deliver_batch_result(env, results, callback, index, position, last_bitmap);
     }
-    
-    // Cleanup
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codec_ctx);
-    avformat_close_input(&format_ctx);
-    
+
+    if (last_bitmap)
+        env->DeleteLocalRef(last_bitmap);
+    thumb_frame_put(frame);
+
     auto total_end = std::chrono::high_resolution_clock::now();
     auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(total_end - total_start);
-    
-    if (!frame_found) {
-        ALOGE("Thumbnail | Failed: no frame found");
-        return NULL;
-    }
-    
-    ALOGI("Thumbnail | %lldms", (long long)total_duration.count());
-    return bitmap;
+    ALOGI("Thumbnail | Batch %d/%d frames (%d cached), %d seeks, %lldms", produced + cached, count,
+        cached, seeks, (long long)total_duration.count());
+
+    stats.ok = produced + cached > 0;
+    return results;
 }
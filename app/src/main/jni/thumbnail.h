@@ -0,0 +1,13 @@
+#pragma once
+
+#include <jni.h>
+#include <mpv/client.h>
+
+// Called by event_thread for every event. Handles the replies to
+// grabThumbnailAsync (scaling the frame and calling back into Java) and
+// returns true for those, false for everything else.
+bool thumb_snapshot_reply(JNIEnv *env, mpv_event *event);
+
+// Call back all pending grabThumbnailAsync requests with null, for when
+// event_thread stops before their replies arrive
+void thumb_snapshot_cancel_all(JNIEnv *env);
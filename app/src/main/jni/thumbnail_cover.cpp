@@ -0,0 +1,111 @@
+#include <string.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/dict.h>
+}
+
+#include "thumbnail_cover.h"
+#include "log.h"
+
+static bool is_cover(const AVStream *st) {
+    return (st->disposition & AV_DISPOSITION_ATTACHED_PIC) && st->attached_pic.size > 0;
+}
+
+int thumb_cover_stream(AVFormatContext *format_ctx) {
+    int found = -1;
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        AVStream *st = format_ctx->streams[i];
+        if (!is_cover(st))
+            continue;
+        // ID3 and FLAC tag the picture type, take the front cover over the others
+        AVDictionaryEntry *e = av_dict_get(st->metadata, "comment", NULL, 0);
+        if (e && !strcmp(e->value, "Cover (front)"))
+            return i;
+        if (found < 0)
+            found = i;
+    }
+    return found;
+}
+
+bool thumb_has_video(AVFormatContext *format_ctx) {
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        AVStream *st = format_ctx->streams[i];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            !(st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+            return true;
+    }
+    return false;
+}
+
+// Image size from a JPEG's frame header, without decoding anything
+static bool jpeg_size(const uint8_t *data, int size, int *width, int *height) {
+    int i = 2;
+    if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+        return false;
+    while (i + 9 < size) {
+        if (data[i] != 0xff) {
+            i++;
+            continue;
+        }
+        uint8_t marker = data[i + 1];
+        // SOF0..SOF15, except DHT (c4), JPG (c8) and DAC (cc)
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            *height = (data[i + 5] << 8) | data[i + 6];
+            *width = (data[i + 7] << 8) | data[i + 8];
+            return *width > 0 && *height > 0;
+        }
+        if (marker == 0xff || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            // Fill byte or a marker without a length
+            i += marker == 0xff ? 1 : 2;
+            continue;
+        }
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+    }
+    return false;
+}
+
+bool thumb_cover_decode(AVStream *st, int dimension, AVCodecContext **ctx, AVFrame *frame) {
+    const AVPacket *pkt = &st->attached_pic;
+    const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec) {
+        ALOGE("Thumbnail | No decoder for cover art");
+        return false;
+    }
+
+    // The JPEG decoder can skip straight to 1/2, 1/4 or 1/8 of the size
+    int lowres = 0, w, h;
+    if (st->codecpar->codec_id == AV_CODEC_ID_MJPEG && jpeg_size(pkt->data, pkt->size, &w, &h)) {
+        while (lowres < codec->max_lowres && ((w < h ? w : h) >> (lowres + 1)) >= dimension)
+            lowres++;
+    }
+
+    if (*ctx && ((*ctx)->codec_id != codec->id || (*ctx)->lowres != lowres))
+        avcodec_free_context(ctx);
+    if (!*ctx) {
+        AVCodecContext *c = avcodec_alloc_context3(codec);
+        if (!c)
+            return false;
+        if (avcodec_parameters_to_context(c, st->codecpar) < 0) {
+            avcodec_free_context(&c);
+            return false;
+        }
+        c->lowres = lowres;
+        c->thread_count = 1;
+        if (avcodec_open2(c, codec, NULL) < 0) {
+            ALOGE("Thumbnail | Failed to open cover art decoder");
+            avcodec_free_context(&c);
+            return false;
+        }
+        *ctx = c;
+    }
+
+    bool ok = avcodec_send_packet(*ctx, pkt) >= 0 && avcodec_receive_frame(*ctx, frame) >= 0;
+    avcodec_flush_buffers(*ctx);
+    if (!ok)
+        ALOGE("Thumbnail | Failed to decode cover art");
+    else
+        ALOGV("Thumbnail | Cover art %dx%d (lowres %d)", frame->width, frame->height, lowres);
+    return ok;
+}
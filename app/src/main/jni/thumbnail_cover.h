@@ -0,0 +1,24 @@
+#pragma once
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+// Embedded cover art: attached pictures (ID3 APIC, MP4 covr, FLAC pictures,
+// Matroska image attachments) are a single JPEG or PNG packet that the
+// demuxer reads along with the header. Decoding that one packet is all a
+// thumbnail of such a file takes, no other stream is ever read.
+
+// Index of the stream carrying the cover art (the front cover if there are
+// several), -1 if there is none
+int thumb_cover_stream(AVFormatContext *format_ctx);
+
+// Whether the file has a video stream that is more than cover art
+bool thumb_has_video(AVFormatContext *format_ctx);
+
+// Decode the cover art of st into frame. JPEGs are scaled down by the decoder
+// itself (lowres) as far as possible while staying at least dimension pixels
+// on the shorter side. *ctx keeps the decoder between calls, free it with
+// avcodec_free_context.
+bool thumb_cover_decode(AVStream *st, int dimension, AVCodecContext **ctx, AVFrame *frame);
@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <string>
+#include <mutex>
+#include <map>
+#include <iterator>
+#include <vector>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "thumbnail_diskcache.h"
+#include "thumbnail_storage.h"
+#include "log.h"
+
+static const size_t PACK_SIZE = 4 * 1024 * 1024;
+static const int64_t DEFAULT_LIMIT = 64 * 1024 * 1024;
+// Don't touch a pack's mtime more often than this
+static const time_t ACCESS_UPDATE_INTERVAL = 60;
+
+static const uint32_t RECORD_MAGIC = 0x32544854; // "THT2"
+
+// Written in front of every thumbnail in a pack. The magic is stored last,
+// so records cut short by a crash are never picked up.
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint64_t key;
+    double pts;
+};
+
+struct Pack {
+    int fd = -1;
+    uint8_t *map = nullptr;
+    size_t used = 0;
+    time_t last_access = 0;
+    time_t last_touch = 0;
+};
+
+struct Location {
+    uint32_t pack;
+    uint32_t offset;
+    uint32_t size;
+    double pts;
+};
+
+static std::mutex g_disk_mutex;
+static bool g_disk_loaded = false;
+static std::string g_disk_dir;
+static std::map<uint32_t, Pack> g_packs;      // by sequence number, the last one is written to
+static std::unordered_map<uint64_t, Location> g_entries;
+static int64_t g_disk_limit = DEFAULT_LIMIT;
+
+static std::string pack_path(uint32_t seq) {
+    char name[32];
+    snprintf(name, sizeof(name), "/pack-%08u.bin", seq);
+    return g_disk_dir + name;
+}
+
+static size_t align8(size_t v) {
+    return (v + 7) & ~(size_t)7;
+}
+
+static bool map_pack(uint32_t seq, Pack *pack) {
+    std::string path = pack_path(seq);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size != (off_t)PACK_SIZE && ftruncate(fd, PACK_SIZE) < 0)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, PACK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    pack->fd = fd;
+    pack->map = static_cast<uint8_t*>(map);
+    pack->last_access = st.st_mtime;
+    pack->last_touch = st.st_mtime;
+    return true;
+}
+
+static void unmap_pack(Pack *pack) {
+    if (pack->map)
+        munmap(pack->map, PACK_SIZE);
+    if (pack->fd >= 0)
+        close(pack->fd);
+    pack->map = nullptr;
+    pack->fd = -1;
+}
+
+// Walk the records of a pack and add them to the lookup table
+static void scan_pack(uint32_t seq, Pack *pack) {
+    size_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= PACK_SIZE) {
+        const RecordHeader *hdr = reinterpret_cast<const RecordHeader*>(pack->map + offset);
+        if (hdr->magic != RECORD_MAGIC || hdr->size == 0 ||
+            offset + sizeof(RecordHeader) + hdr->size > PACK_SIZE)
+            break;
+        g_entries[hdr->key] = Location{seq, (uint32_t)(offset + sizeof(RecordHeader)), hdr->size, hdr->pts};
+        offset += align8(sizeof(RecordHeader) + hdr->size);
+    }
+    pack->used = offset;
+}
+
+static void load_locked() {
+    if (g_disk_loaded)
+        return;
+    g_disk_dir = thumb_cache_subdir("packs");
+    if (g_disk_dir.empty())
+        return; // try again once a cache dir is set
+    g_disk_loaded = true;
+
+    DIR *dir = opendir(g_disk_dir.c_str());
+    if (!dir)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        unsigned seq;
+        if (sscanf(ent->d_name, "pack-%08u.bin", &seq) != 1)
+            continue;
+        Pack pack;
+        if (!map_pack(seq, &pack))
+            continue;
+        g_packs[seq] = pack;
+    }
+    closedir(dir);
+
+    // Later packs override older entries with the same key
+    for (auto it = g_packs.begin(); it != g_packs.end(); ++it)
+        scan_pack(it->first, &it->second);
+    ALOGV("Thumbnail | Disk cache: %zu packs, %zu entries", g_packs.size(), g_entries.size());
+}
+
+static void drop_pack_locked(std::map<uint32_t, Pack>::iterator it) {
+    uint32_t seq = it->first;
+    for (auto e = g_entries.begin(); e != g_entries.end();) {
+        if (e->second.pack == seq)
+            e = g_entries.erase(e);
+        else
+            ++e;
+    }
+    unmap_pack(&it->second);
+    unlink(pack_path(seq).c_str());
+    g_packs.erase(it);
+}
+
+// Evict least recently used packs until within budget, never the one being written
+static void enforce_limit_locked() {
+    while (!g_packs.empty() && (int64_t)(g_packs.size() * PACK_SIZE) > g_disk_limit) {
+        auto victim = g_packs.end();
+        auto current = std::prev(g_packs.end());
+        for (auto it = g_packs.begin(); it != current; ++it) {
+            if (victim == g_packs.end() || it->second.last_access < victim->second.last_access)
+                victim = it;
+        }
+        if (victim == g_packs.end())
+            break;
+        ALOGV("Thumbnail | Disk cache: evicting pack %u", victim->first);
+        drop_pack_locked(victim);
+    }
+}
+
+bool thumb_disk_cache_get(uint64_t key, ThumbImage *image) {
+    std::vector<uint8_t> data;
+    double pts;
+    {
+        std::lock_guard<std::mutex> lock(g_disk_mutex);
+        load_locked();
+        auto it = g_entries.find(key);
+        if (it == g_entries.end())
+            return false;
+        auto pack = g_packs.find(it->second.pack);
+        if (pack == g_packs.end())
+            return false;
+        // Copy out so the pack may be evicted while we decode
+        const uint8_t *p = pack->second.map + it->second.offset;
+        data.assign(p, p + it->second.size);
+        pts = it->second.pts;
+
+        time_t now = time(NULL);
+        pack->second.last_access = now;
+        if (now - pack->second.last_touch > ACCESS_UPDATE_INTERVAL) {
+            // Remember recency across restarts
+            futimens(pack->second.fd, NULL);
+            pack->second.last_touch = now;
+        }
+    }
+    if (!thumb_decode_jpeg(data.data(), data.size(), image))
+        return false;
+    image->pts = pts;
+    return true;
+}
+
+void thumb_disk_cache_put(uint64_t key, const ThumbImage &image) {
+    std::vector<uint8_t> jpeg;
+    if (!thumb_encode_jpeg(image, &jpeg) || jpeg.empty())
+        return;
+    size_t record = align8(sizeof(RecordHeader) + jpeg.size());
+    if (record > PACK_SIZE)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_disk_mutex);
+    load_locked();
+    if (!g_disk_loaded)
+        return;
+
+    if (g_packs.empty() || std::prev(g_packs.end())->second.used + record > PACK_SIZE) {
+        uint32_t seq = g_packs.empty() ? 0 : std::prev(g_packs.end())->first + 1;
+        Pack pack;
+        if (!map_pack(seq, &pack)) {
+            ALOGW("Thumbnail | Disk cache: failed to create pack");
+            return;
+        }
+        pack.last_access = time(NULL);
+        g_packs[seq] = pack;
+        enforce_limit_locked();
+    }
+
+    auto current = std::prev(g_packs.end());
+    Pack &pack = current->second;
+    RecordHeader *hdr = reinterpret_cast<RecordHeader*>(pack.map + pack.used);
+    memcpy(pack.map + pack.used + sizeof(RecordHeader), jpeg.data(), jpeg.size());
+    hdr->size = jpeg.size();
+    hdr->key = key;
+    hdr->pts = image.pts;
+    __atomic_store_n(&hdr->magic, RECORD_MAGIC, __ATOMIC_RELEASE);
+
+    g_entries[key] = Location{current->first, (uint32_t)(pack.used + sizeof(RecordHeader)),
+        (uint32_t)jpeg.size(), image.pts};
+    pack.used += record;
+    pack.last_access = time(NULL);
+}
+
+void thumb_disk_cache_set_limit(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(g_disk_mutex);
+    // At least the pack being written to
+    g_disk_limit = bytes < (int64_t)PACK_SIZE ? (int64_t)PACK_SIZE : bytes;
+    if (g_disk_loaded)
+        enforce_limit_locked();
+}
+
+void thumb_disk_cache_clear() {
+    std::lock_guard<std::mutex> lock(g_disk_mutex);
+    load_locked();
+    while (!g_packs.empty())
+        drop_pack_locked(g_packs.begin());
+    g_entries.clear();
+}
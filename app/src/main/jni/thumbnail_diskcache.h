@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "thumbnail_image.h"
+
+// Persistent thumbnail cache: JPEG encoded thumbnails appended to
+// memory-mapped pack files under <cache dir>/packs. Whole packs are
+// evicted least recently used first once the byte budget is exceeded.
+
+// Keys are thumb_key() hashes, only persistent keys belong here
+bool thumb_disk_cache_get(uint64_t key, ThumbImage *image);
+void thumb_disk_cache_put(uint64_t key, const ThumbImage &image);
+
+void thumb_disk_cache_set_limit(int64_t bytes);
+void thumb_disk_cache_clear();
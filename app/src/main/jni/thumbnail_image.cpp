@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/imgutils.h>
+    #include <libswscale/swscale.h>
+}
+
+#include "thumbnail_image.h"
+#include "thumbnail_pool.h"
+#include "thumbnail_kernel.h"
+#include "log.h"
+
+// Quantizer for stored thumbnails (2 = best, 31 = worst)
+static const int JPEG_QSCALE = 4;
+
+// 4x4 Bayer matrix for dithering down to RGB565
+static const uint8_t BAYER4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+int thumb_format_bpp(ThumbFormat format) {
+    switch (format) {
+    case THUMB_FORMAT_RGB565: return 2;
+    case THUMB_FORMAT_GRAY8: return 1;
+    default: return 4;
+    }
+}
+
+void thumb_convert_rows(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride,
+    int width, int height, ThumbFormat format)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t *s = src + (size_t)y * src_stride;
+        uint8_t *d = dst + (size_t)y * dst_stride;
+        switch (format) {
+        case THUMB_FORMAT_RGB565: {
+            // Threshold spans one step of the 5 and 6 bit channels
+            const uint8_t *bayer = BAYER4[y & 3];
+            for (int x = 0; x < width; x++, s += 4) {
+                int t = bayer[x & 3];
+                int b = std::min(255, s[0] + (t >> 1)) >> 3;
+                int g = std::min(255, s[1] + (t >> 2)) >> 2;
+                int r = std::min(255, s[2] + (t >> 1)) >> 3;
+                uint16_t v = (uint16_t) (r << 11 | g << 5 | b);
+                d[x * 2] = v & 0xff;
+                d[x * 2 + 1] = v >> 8;
+            }
+            break;
+        }
+        case THUMB_FORMAT_GRAY8:
+            // Full range BT.601 luma
+            for (int x = 0; x < width; x++, s += 4)
+                d[x] = (uint8_t) ((s[2] * 77 + s[1] * 150 + s[0] * 29 + 128) >> 8);
+            break;
+        default:
+            if (d != s)
+                memmove(d, s, (size_t)width * 4);
+            break;
+        }
+    }
+}
+
+void thumb_convert_image(ThumbImage *image, ThumbFormat format) {
+    if (image->format != THUMB_FORMAT_BGRA || format == THUMB_FORMAT_BGRA)
+        return;
+    int src_stride = image->stride();
+    image->format = format;
+    // Rows only ever move towards the start, so this works in place
+    thumb_convert_rows(image->pixels.data(), src_stride, image->pixels.data(), image->stride(),
+        image->width, image->height, format);
+    image->pixels.resize((size_t)image->stride() * image->height);
+    image->pixels.shrink_to_fit();
+}
+
+void thumb_fit_dimension(int src_w, int src_h, int dimension, int *out_w, int *out_h) {
+    // Calculate scaled dimensions while preserving aspect ratio
+    int width = src_w;
+    int height = src_h;
+
+    if (width > 0 && height > 0) {
+        float scale = 1.0f;
+        if (width >= height) {
+            if (width > dimension) {
+                scale = (float)dimension / width;
+            }
+        } else {
+            if (height > dimension) {
+                scale = (float)dimension / height;
+            }
+        }
+
+        width = (int)(width * scale);
+        height = (int)(height * scale);
+    }
+
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+
+    *out_w = width;
+    *out_h = height;
+}
+
+bool thumb_scale_frame(const AVFrame *frame, int dimension, ThumbImage *image) {
+    int width, height;
+    thumb_fit_dimension(frame->width, frame->height, dimension, &width, &height);
+
+    image->width = width;
+    image->height = height;
+    image->pixels.resize((size_t)width * height * 4);
+    return thumb_scale_frame_into(frame, width, height, image->pixels.data(), image->stride());
+}
+
+bool thumb_scale_frame_into(const AVFrame *frame, int width, int height, uint8_t *dst, int dst_stride) {
+    // Common decoder formats at thumbnail sizes take the fused kernel
+    if (thumb_kernel_scale(frame, width, height, dst, dst_stride))
+        return true;
+
+    // Use fast bilinear scaling for speed
+    int sws_algorithm = SWS_FAST_BILINEAR;
+
+    // Android Bitmap.Config.ARGB_8888 expects BGRA byte order (little-endian)
+    ThumbScaler scaler(frame->width, frame->height, (AVPixelFormat)frame->format,
+        width, height, AV_PIX_FMT_BGRA, sws_algorithm);
+    if (!scaler)
+        return false;
+
+    uint8_t *dst_data[4] = { dst };
+    int dst_linesize[4] = { dst_stride };
+    sws_scale(scaler.get(), frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
+    return true;
+}
+
+bool thumb_reduce_snapshot(const uint8_t *data, int width, int height, int stride,
+    int dimension, ThumbImage *image)
+{
+    if (width <= 0 || height <= 0 || dimension <= 0)
+        return false;
+
+    // Crop to square
+    int side = width < height ? width : height;
+    const uint8_t *src = data + (size_t)((height - side) / 2) * stride + (width - side) / 2 * 4;
+
+    // Leave at least 2x the target for the bicubic pass, so averaging
+    // doesn't cost any sharpness
+    int factor = side / (2 * dimension);
+    if (factor < 1)
+        factor = 1;
+    int out_side = side / factor;
+
+    image->width = out_side;
+    image->height = out_side;
+    image->pixels.resize((size_t)out_side * out_side * 4);
+    uint8_t *dst = image->pixels.data();
+
+    if (factor == 1) {
+        for (int y = 0; y < out_side; y++)
+            memcpy(dst + (size_t)y * image->stride(), src + (size_t)y * stride, out_side * 4);
+        return true;
+    }
+
+    const uint32_t area = factor * factor;
+    std::vector<uint32_t> acc((size_t)out_side * 4);
+    for (int y = 0; y < out_side; y++) {
+        std::fill(acc.begin(), acc.end(), 0);
+        for (int fy = 0; fy < factor; fy++) {
+            const uint8_t *row = src + (size_t)(y * factor + fy) * stride;
+            for (int x = 0; x < out_side; x++) {
+                uint32_t *a = &acc[x * 4];
+                for (int fx = 0; fx < factor; fx++, row += 4) {
+                    a[0] += row[0];
+                    a[1] += row[1];
+                    a[2] += row[2];
+                }
+            }
+        }
+        uint8_t *out = dst + (size_t)y * image->stride();
+        for (int x = 0; x < out_side * 4; x += 4) {
+            out[x] = (acc[x] + area / 2) / area;
+            out[x + 1] = (acc[x + 1] + area / 2) / area;
+            out[x + 2] = (acc[x + 2] + area / 2) / area;
+            out[x + 3] = 0xff;
+        }
+    }
+    return true;
+}
+
+bool thumb_scale_snapshot(const ThumbImage &reduced, int dimension, ThumbImage *image) {
+    ThumbScaler scaler(reduced.width, reduced.height, AV_PIX_FMT_BGR0,
+        dimension, dimension, AV_PIX_FMT_BGRA, SWS_BICUBIC);
+    if (!scaler)
+        return false;
+
+    image->width = dimension;
+    image->height = dimension;
+    image->pixels.resize((size_t)dimension * dimension * 4);
+
+    const uint8_t *src_data[4] = { reduced.pixels.data() };
+    int src_linesize[4] = { reduced.stride() };
+    uint8_t *dst_data[4] = { image->pixels.data() };
+    int dst_linesize[4] = { image->stride() };
+    sws_scale(scaler.get(), src_data, src_linesize, 0, reduced.height, dst_data, dst_linesize);
+    return true;
+}
+
+bool thumb_encode_jpeg(const ThumbImage &image, std::vector<uint8_t> *out) {
+    if (image.format != THUMB_FORMAT_BGRA)
+        return false;
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec)
+        return false;
+
+    AVCodecContext *enc = avcodec_alloc_context3(codec);
+    AVFrame *yuv = thumb_frame_get();
+    AVPacket *pkt = thumb_packet_get();
+    bool ok = false;
+
+    do {
+        if (!enc || !yuv || !pkt)
+            break;
+
+        enc->width = image.width;
+        enc->height = image.height;
+        enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        enc->color_range = AVCOL_RANGE_JPEG;
+        enc->time_base = AVRational{1, 25};
+        enc->flags |= AV_CODEC_FLAG_QSCALE;
+        enc->global_quality = FF_QP2LAMBDA * JPEG_QSCALE;
+        if (avcodec_open2(enc, codec, NULL) < 0)
+            break;
+
+        yuv->width = image.width;
+        yuv->height = image.height;
+        yuv->format = AV_PIX_FMT_YUVJ420P;
+        yuv->quality = enc->global_quality;
+        if (av_frame_get_buffer(yuv, 0) < 0)
+            break;
+
+        ThumbScaler scaler(image.width, image.height, AV_PIX_FMT_BGRA,
+            image.width, image.height, AV_PIX_FMT_YUVJ420P, SWS_POINT);
+        if (!scaler)
+            break;
+        const uint8_t *src_data[4] = { image.pixels.data() };
+        int src_linesize[4] = { image.stride() };
+        sws_scale(scaler.get(), src_data, src_linesize, 0, image.height, yuv->data, yuv->linesize);
+
+        if (avcodec_send_frame(enc, yuv) < 0 || avcodec_receive_packet(enc, pkt) < 0)
+            break;
+        out->assign(pkt->data, pkt->data + pkt->size);
+        ok = true;
+    } while (0);
+
+    thumb_packet_put(pkt);
+    thumb_frame_put(yuv);
+    avcodec_free_context(&enc);
+    if (!ok)
+        ALOGW("Thumbnail | JPEG encoding failed");
+    return ok;
+}
+
+bool thumb_decode_jpeg(const uint8_t *data, size_t size, ThumbImage *image) {
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+    if (!codec)
+        return false;
+
+    AVCodecContext *dec = avcodec_alloc_context3(codec);
+    AVFrame *frame = thumb_frame_get();
+    AVPacket *pkt = thumb_packet_get();
+    bool ok = false;
+
+    do {
+        if (!dec || !frame || !pkt)
+            break;
+        if (avcodec_open2(dec, codec, NULL) < 0)
+            break;
+        // av_new_packet adds the input padding the decoder expects
+        if (av_new_packet(pkt, size) < 0)
+            break;
+        memcpy(pkt->data, data, size);
+        if (avcodec_send_packet(dec, pkt) < 0 || avcodec_receive_frame(dec, frame) < 0)
+            break;
+        // stored at the final size, so this is just the color conversion
+        ok = thumb_scale_frame(frame, frame->width > frame->height ? frame->width : frame->height, image);
+    } while (0);
+
+    thumb_packet_put(pkt);
+    thumb_frame_put(frame);
+    avcodec_free_context(&dec);
+    return ok;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+// Pixel layouts of thumbnails, matching Android Bitmap configs
+enum ThumbFormat {
+    THUMB_FORMAT_BGRA = 0,    // ARGB_8888: BGRA bytes
+    THUMB_FORMAT_RGB565 = 1,  // RGB_565: 16 bit little endian, red in the top bits
+    THUMB_FORMAT_GRAY8 = 2,   // ALPHA_8: one byte of luma per pixel
+};
+
+int thumb_format_bpp(ThumbFormat format);
+
+// A scaled thumbnail, tightly packed. Scaling always produces BGRA,
+// thumb_convert_image turns it into one of the compact formats.
+struct ThumbImage {
+    int width = 0;
+    int height = 0;
+    ThumbFormat format = THUMB_FORMAT_BGRA;
+    std::vector<uint8_t> pixels;
+    // time of the frame it was made from, -1 if unknown
+    double pts = -1;
+
+    int stride() const { return width * thumb_format_bpp(format); }
+};
+
+// Convert BGRA rows to format; RGB565 is ordered dithered. dst may be src,
+// converting in place.
+void thumb_convert_rows(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride,
+    int width, int height, ThumbFormat format);
+
+// Convert a BGRA image to format in place, releasing the memory saved
+void thumb_convert_image(ThumbImage *image, ThumbFormat format);
+
+// Output size for a frame so that its longest side is at most dimension
+void thumb_fit_dimension(int src_w, int src_h, int dimension, int *out_w, int *out_h);
+
+// Scale and convert a decoded frame into image
+bool thumb_scale_frame(const AVFrame *frame, int dimension, ThumbImage *image);
+
+// Scale and convert a decoded frame into width x height BGRA pixels at dst
+bool thumb_scale_frame_into(const AVFrame *frame, int width, int height, uint8_t *dst, int dst_stride);
+
+// Center-crop a bgr0 video snapshot (mpv's screenshot-raw) to a square and
+// shrink it by averaging pixel blocks, down to no less than twice dimension.
+// Reads the snapshot once, so the caller can free it right afterwards; the
+// result is still bgr0 and goes through thumb_scale_snapshot.
+bool thumb_reduce_snapshot(const uint8_t *data, int width, int height, int stride,
+    int dimension, ThumbImage *image);
+
+// Scale a reduced snapshot to dimension x dimension BGRA
+bool thumb_scale_snapshot(const ThumbImage &reduced, int dimension, ThumbImage *image);
+
+// JPEG round trip for the disk cache, BGRA only
+bool thumb_encode_jpeg(const ThumbImage &image, std::vector<uint8_t> *out);
+bool thumb_decode_jpeg(const uint8_t *data, size_t size, ThumbImage *image);
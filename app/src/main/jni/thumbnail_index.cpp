@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <unordered_set>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+}
+
+#include "thumbnail_index.h"
+#include "thumbnail_storage.h"
+#include "thumbnail_io.h"
+#include "log.h"
+
+// On-disk layout: header followed by count entries, native byte order
+struct KeyframeIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t file_hash;     // ThumbFileId.hash, covers path, size and mtime
+    int32_t stream_index;
+    int32_t tb_num, tb_den;
+    uint32_t count;
+};
+
+static const char INDEX_MAGIC[4] = { 'M', 'K', 'F', 'I' };
+// 2: attached pictures (cover art) are no longer taken for the video stream
+static const uint32_t INDEX_VERSION = 2;
+
+static std::mutex g_build_mutex;
+static std::condition_variable g_build_cond;
+static std::deque<std::string> g_build_queue;
+// hashes of files that were queued already, successful or not
+static std::unordered_set<uint64_t> g_build_seen;
+static bool g_build_thread_started = false;
+static std::atomic<unsigned> g_index_generation(0);
+
+const KeyframeIndexEntry *KeyframeIndex::find_before(int64_t pts) const {
+    const KeyframeIndexEntry *end = entries + count;
+    const KeyframeIndexEntry *it = std::upper_bound(entries, end, pts,
+        [] (int64_t v, const KeyframeIndexEntry &e) { return v < e.pts; });
+    if (it == entries)
+        return nullptr;
+    return it - 1;
+}
+
+KeyframeIndex::~KeyframeIndex() {
+    if (map)
+        munmap(map, map_size);
+}
+
+static std::string index_path(const ThumbFileId &id) {
+    std::string dir = thumb_cache_subdir("keyframes");
+    if (dir.empty())
+        return dir;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.kfi", (unsigned long long)id.hash);
+    return dir + name;
+}
+
+unsigned thumb_index_generation() {
+    return g_index_generation.load();
+}
+
+std::shared_ptr<KeyframeIndex> thumb_index_load(const char *path, int stream_index, AVRational time_base) {
+    ThumbFileId id;
+    if (!thumb_file_id(path, &id))
+        return nullptr;
+    std::string file = index_path(id);
+    if (file.empty())
+        return nullptr;
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(KeyframeIndexHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<KeyframeIndex> index = std::make_shared<KeyframeIndex>();
+    index->map = map;
+    index->map_size = st.st_size;
+
+    const KeyframeIndexHeader *hdr = static_cast<const KeyframeIndexHeader*>(map);
+    if (memcmp(hdr->magic, INDEX_MAGIC, 4) || hdr->version != INDEX_VERSION ||
+        hdr->file_hash != id.hash || hdr->stream_index != stream_index ||
+        hdr->tb_num != time_base.num || hdr->tb_den != time_base.den || time_base.num <= 0 ||
+        sizeof(*hdr) + (size_t)hdr->count * sizeof(KeyframeIndexEntry) > index->map_size) {
+        ALOGW("Thumbnail | Discarding stale keyframe index %s", file.c_str());
+        unlink(file.c_str());
+        // Let the next thumb_index_request_build scan the file again
+        std::lock_guard<std::mutex> lock(g_build_mutex);
+        g_build_seen.erase(id.hash);
+        return nullptr;
+    }
+
+    index->stream_index = hdr->stream_index;
+    index->time_base = AVRational{hdr->tb_num, hdr->tb_den};
+    index->entries = reinterpret_cast<const KeyframeIndexEntry*>(hdr + 1);
+    index->count = hdr->count;
+    return index;
+}
+
+// Read every packet of the file once and remember where the video keyframes are
+static void build_index(const std::string &path) {
+    ThumbFileId id;
+    if (!thumb_file_id(path.c_str(), &id))
+        return;
+    std::string file = index_path(id);
+    if (file.empty() || access(file.c_str(), F_OK) == 0)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Whole-file scans would swamp the IO stats of thumbnail requests
+    AVIOContext *io = thumb_io_open(path.c_str(), false);
+    AVFormatContext *format_ctx = io ? avformat_alloc_context() : NULL;
+    if (format_ctx) {
+        format_ctx->pb = io;
+        format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else {
+        thumb_io_close(&io);
+    }
+    if (avformat_open_input(&format_ctx, path.c_str(), NULL, NULL) < 0) {
+        ALOGW("Thumbnail | Index: failed to open file");
+        thumb_io_close(&io);
+        return;
+    }
+    format_ctx->max_analyze_duration = 100000;
+    format_ctx->probesize = 500000;
+    if (avformat_find_stream_info(format_ctx, NULL) < 0) {
+        avformat_close_input(&format_ctx);
+        thumb_io_close(&io);
+        return;
+    }
+
+    int stream_idx = -1;
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        AVStream *st = format_ctx->streams[i];
+        // Same choice as the session makes, cover art doesn't count
+        if (stream_idx < 0 && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+                !(st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+            stream_idx = i;
+        else
+            st->discard = AVDISCARD_ALL;
+    }
+    if (stream_idx < 0) {
+        avformat_close_input(&format_ctx);
+        thumb_io_close(&io);
+        return;
+    }
+    AVStream *video_stream = format_ctx->streams[stream_idx];
+
+    std::vector<KeyframeIndexEntry> entries;
+    AVPacket *packet = av_packet_alloc();
+    while (packet && av_read_frame(format_ctx, packet) >= 0) {
+        if (packet->stream_index == stream_idx && (packet->flags & AV_PKT_FLAG_KEY)) {
+            int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (ts != AV_NOPTS_VALUE)
+                entries.push_back(KeyframeIndexEntry{ts, packet->pos});
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+
+    KeyframeIndexHeader hdr;
+    memcpy(hdr.magic, INDEX_MAGIC, 4);
+    hdr.version = INDEX_VERSION;
+    hdr.file_hash = id.hash;
+    hdr.stream_index = stream_idx;
+    hdr.tb_num = video_stream->time_base.num;
+    hdr.tb_den = video_stream->time_base.den;
+    avformat_close_input(&format_ctx);
+    thumb_io_close(&io);
+
+    std::sort(entries.begin(), entries.end(),
+        [] (const KeyframeIndexEntry &a, const KeyframeIndexEntry &b) { return a.pts < b.pts; });
+    entries.erase(std::unique(entries.begin(), entries.end(),
+        [] (const KeyframeIndexEntry &a, const KeyframeIndexEntry &b) { return a.pts == b.pts; }),
+        entries.end());
+    hdr.count = entries.size();
+
+    std::vector<uint8_t> data(sizeof(hdr) + entries.size() * sizeof(KeyframeIndexEntry));
+    memcpy(data.data(), &hdr, sizeof(hdr));
+    if (!entries.empty())
+        memcpy(data.data() + sizeof(hdr), entries.data(), entries.size() * sizeof(KeyframeIndexEntry));
+    if (!thumb_write_file_atomic(file, data.data(), data.size())) {
+        ALOGW("Thumbnail | Index: failed to write %s", file.c_str());
+        return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    ALOGI("Thumbnail | Indexed %u keyframes in %lldms", hdr.count, (long long)elapsed.count());
+}
+
+static void build_thread() {
+    while (1) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(g_build_mutex);
+            g_build_cond.wait(lock, [] { return !g_build_queue.empty(); });
+            path = g_build_queue.front();
+            g_build_queue.pop_front();
+        }
+        build_index(path);
+        // fd:// scans read from a descriptor duplicated for them
+        int fd;
+        if (thumb_io_parse_fd(path.c_str(), &fd))
+            close(fd);
+        g_index_generation++;
+    }
+}
+
+void thumb_index_request_build(const char *path) {
+    ThumbFileId id;
+    if (!thumb_file_id(path, &id) || index_path(id).empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(g_build_mutex);
+    if (!g_build_seen.insert(id.hash).second)
+        return;
+    int fd;
+    if (thumb_io_parse_fd(path, &fd)) {
+        // The caller's descriptor may be gone by the time the scan runs
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0)
+            return;
+        g_build_queue.push_back("fd://" + std::to_string(fd));
+    } else {
+        g_build_queue.push_back(path);
+    }
+    if (!g_build_thread_started) {
+        // One scan at a time, these read the whole file
+        std::thread t(build_thread);
+        pthread_setname_np(t.native_handle(), "thumb_index");
+        t.detach();
+        g_build_thread_started = true;
+    }
+    g_build_cond.notify_one();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+}
+
+struct KeyframeIndexEntry {
+    int64_t pts;   // in stream time base
+    int64_t pos;   // byte offset of the packet, -1 if unknown
+};
+
+// Keyframe positions of one video stream, memory-mapped from the on-disk
+// index built by a background scan of the file.
+struct KeyframeIndex {
+    int stream_index = -1;
+    AVRational time_base = AVRational{0, 1};
+    const KeyframeIndexEntry *entries = nullptr;
+    uint32_t count = 0;
+
+    void *map = nullptr;
+    size_t map_size = 0;
+
+    // Last entry with pts <= the given pts, or null if there is none
+    const KeyframeIndexEntry *find_before(int64_t pts) const;
+
+    ~KeyframeIndex();
+};
+
+// Load the index for path if one was built for the current version of the file
+// and for the given stream. Indexes that don't match are deleted.
+std::shared_ptr<KeyframeIndex> thumb_index_load(const char *path, int stream_index, AVRational time_base);
+
+// Queue a background scan of path (no-op if one is queued or done already)
+void thumb_index_request_build(const char *path);
+
+// Incremented whenever a background scan finishes, so sessions
+// without an index know when it is worth looking again.
+unsigned thumb_index_generation();
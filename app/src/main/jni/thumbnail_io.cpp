@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+extern "C" {
+    #include <libavformat/avio.h>
+    #include <libavutil/mem.h>
+    #include <libavutil/error.h>
+}
+
+#include "thumbnail_io.h"
+#include "thumbnail_stats.h"
+#include "log.h"
+
+// Data per read from the file; seeks within it don't touch the file at all
+static const int IO_BUFFER_SIZE = 512 * 1024;
+// How far ahead of the read position the kernel is asked to read
+static const int64_t READAHEAD_WINDOW = 4 * 1024 * 1024;
+
+struct ThumbIO {
+    int fd;
+    int64_t size;
+    int64_t pos;
+    // end of the region the kernel was last asked to read ahead
+    int64_t advised_end;
+    bool count_stats;
+};
+
+static void advise(ThumbIO *io, int64_t offset) {
+    int64_t len = READAHEAD_WINDOW;
+    if (io->size > 0 && offset + len > io->size)
+        len = io->size - offset;
+    if (len <= 0)
+        return;
+    posix_fadvise(io->fd, offset, len, POSIX_FADV_WILLNEED);
+    io->advised_end = offset + len;
+}
+
+static int io_read(void *opaque, uint8_t *buf, int size) {
+    ThumbIO *io = (ThumbIO*) opaque;
+    // Keep the kernel's reads a window ahead of ours
+    if (io->pos + size > io->advised_end - READAHEAD_WINDOW / 2)
+        advise(io, io->advised_end > io->pos ? io->advised_end : io->pos);
+
+    ssize_t n;
+    do {
+        n = pread(io->fd, buf, size, io->pos);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return AVERROR(errno);
+    if (n == 0)
+        return AVERROR_EOF;
+    io->pos += n;
+    if (io->count_stats)
+        thumb_stats_add(THUMB_COUNT_BYTES_READ, n);
+    return (int) n;
+}
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence) {
+    ThumbIO *io = (ThumbIO*) opaque;
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE)
+        return io->size > 0 ? io->size : AVERROR(ENOSYS);
+
+    int64_t pos;
+    switch (whence) {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = io->pos + offset; break;
+    case SEEK_END:
+        if (io->size <= 0)
+            return AVERROR(ENOSYS);
+        pos = io->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    // A jump away from what was read ahead, start on the new region right away
+    if (pos < io->pos || pos >= io->advised_end)
+        advise(io, pos);
+    if (pos != io->pos && io->count_stats)
+        thumb_stats_add(THUMB_COUNT_IO_SEEKS);
+    io->pos = pos;
+    return pos;
+}
+
+bool thumb_io_parse_fd(const char *path, int *fd) {
+    if (strncmp(path, "fd://", 5))
+        return false;
+    char *end;
+    long n = strtol(path + 5, &end, 10);
+    if (end == path + 5 || *end || n < 0 || n > INT32_MAX)
+        return false;
+    *fd = (int) n;
+    return true;
+}
+
+AVIOContext *thumb_io_open(const char *path, bool count_stats) {
+    int fd, src_fd;
+    if (thumb_io_parse_fd(path, &src_fd)) {
+        fd = fcntl(src_fd, F_DUPFD_CLOEXEC, 0);
+    } else {
+        if (!strncmp(path, "file://", 7))
+            path += 7;
+        else if (strstr(path, "://"))
+            return NULL;
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        // Pipes and the like can't be read at offsets
+        close(fd);
+        return NULL;
+    }
+
+    ThumbIO *io = (ThumbIO*) av_mallocz(sizeof(ThumbIO));
+    uint8_t *buffer = (uint8_t*) av_malloc(IO_BUFFER_SIZE);
+    AVIOContext *pb = io && buffer ?
+        avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, io, io_read, NULL, io_seek) : NULL;
+    if (!pb) {
+        ALOGE("Thumbnail | Failed to allocate IO context");
+        av_free(buffer);
+        av_free(io);
+        close(fd);
+        return NULL;
+    }
+    io->fd = fd;
+    io->size = st.st_size;
+    io->count_stats = count_stats;
+    // Thumbnails jump around the file, readahead is driven by our own hints
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    advise(io, 0);
+    return pb;
+}
+
+int thumb_io_fd(AVIOContext *pb) {
+    return ((ThumbIO*) pb->opaque)->fd;
+}
+
+void thumb_io_close(AVIOContext **pb) {
+    if (!*pb)
+        return;
+    ThumbIO *io = (ThumbIO*) (*pb)->opaque;
+    close(io->fd);
+    av_free(io);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+extern "C" {
+    #include <libavformat/avio.h>
+}
+
+// Input for local files and already open file descriptors (e.g. from a
+// content:// URI, passed as "fd://N"), read with pread through a large buffer.
+// Seeks hint the kernel to start reading the region around the target, and
+// reads keep hinting ahead of themselves. This avoids libavformat's file
+// protocol and its small blocking reads, which hurt on slow SD/USB storage.
+
+// Parse an "fd://N" path
+bool thumb_io_parse_fd(const char *path, int *fd);
+
+// Open path (a local file or fd://N, whose descriptor is duplicated, so the
+// caller may close theirs). Returns null for anything else, such as network
+// URLs, which should go through libavformat's own protocols.
+// Without count_stats its reads and seeks stay out of the thumbnail stats
+// (background scans that would otherwise be charged to requests).
+AVIOContext *thumb_io_open(const char *path, bool count_stats = true);
+
+// The descriptor the context reads from
+int thumb_io_fd(AVIOContext *pb);
+
+// Free the context and close its descriptor, sets *pb to null
+void thumb_io_close(AVIOContext **pb);
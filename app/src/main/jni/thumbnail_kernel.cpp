@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "thumbnail_kernel.h"
+#include "log.h"
+
+// Below this the box filter degrades to point sampling, swscale's bilinear looks better
+static const int MIN_SCALE_FACTOR = 2;
+
+// Source rows summed per output row must fit the 16 bit accumulators
+static const int MAX_ROWS_8BIT = 65535 / 255;
+static const int MAX_ROWS_10BIT = 65535 / 1023;
+
+static void accumulate_u8_scalar(uint16_t *acc, const uint8_t *src, int n) {
+    for (int i = 0; i < n; i++)
+        acc[i] += src[i];
+}
+
+static void accumulate_u16_scalar(uint16_t *acc, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++)
+        acc[i] += src[i];
+}
+
+static void sum_squares_u8_scalar(const uint8_t *src, int n, uint64_t *sum, uint64_t *sum_sq) {
+    uint64_t s = 0, q = 0;
+    for (int i = 0; i < n; i++) {
+        s += src[i];
+        q += src[i] * src[i];
+    }
+    *sum += s;
+    *sum_sq += q;
+}
+
+const ThumbKernelOps thumb_kernel_scalar = {
+    "scalar", accumulate_u8_scalar, accumulate_u16_scalar, sum_squares_u8_scalar,
+};
+
+static const ThumbKernelOps *detect_ops() {
+#if defined(__ARM_NEON)
+    return &thumb_kernel_neon;
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &thumb_kernel_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return &thumb_kernel_sse4;
+    return &thumb_kernel_scalar;
+#else
+    return &thumb_kernel_scalar;
+#endif
+}
+
+static std::atomic<const ThumbKernelOps*> g_ops(nullptr);
+
+static const ThumbKernelOps *ops() {
+    const ThumbKernelOps *o = g_ops.load(std::memory_order_acquire);
+    if (!o) {
+        o = detect_ops();
+        g_ops.store(o, std::memory_order_release);
+        ALOGV("Thumbnail | Using %s scaling kernel", o->name);
+    }
+    return o;
+}
+
+const char *thumb_kernel_name() {
+    return ops()->name;
+}
+
+bool thumb_kernel_select(const char *name) {
+    const ThumbKernelOps *o = nullptr;
+    if (!strcmp(name, "scalar"))
+        o = &thumb_kernel_scalar;
+#if defined(__ARM_NEON)
+    else if (!strcmp(name, "neon"))
+        o = &thumb_kernel_neon;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    else if (!strcmp(name, "sse4") && __builtin_cpu_supports("sse4.1"))
+        o = &thumb_kernel_sse4;
+    else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+        o = &thumb_kernel_avx2;
+#endif
+    if (!o)
+        return false;
+    g_ops.store(o, std::memory_order_release);
+    return true;
+}
+
+bool thumb_kernel_supported(const AVFrame *frame, int width, int height) {
+    int max_rows;
+    switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_NV12:
+        max_rows = MAX_ROWS_8BIT;
+        break;
+    case AV_PIX_FMT_YUV420P10:
+        max_rows = MAX_ROWS_10BIT;
+        break;
+    default:
+        return false;
+    }
+    if (width <= 0 || height <= 0)
+        return false;
+    if (frame->width < width * MIN_SCALE_FACTOR || frame->height < height * MIN_SCALE_FACTOR)
+        return false;
+    return (frame->height + height - 1) / height <= max_rows;
+}
+
+namespace {
+
+// YUV to RGB in 16.16 fixed point
+struct Coeffs {
+    int y_offset;
+    int y_scale;
+    int v_r, u_g, v_g, u_b;
+};
+
+}
+
+static Coeffs make_coeffs(const AVFrame *frame) {
+    double kr = 0.299, kb = 0.114; // BT.601, also what swscale assumes by default
+    if (frame->colorspace == AVCOL_SPC_BT709) {
+        kr = 0.2126;
+        kb = 0.0722;
+    } else if (frame->colorspace == AVCOL_SPC_BT2020_NCL) {
+        kr = 0.2627;
+        kb = 0.0593;
+    }
+    double kg = 1.0 - kr - kb;
+    bool full = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+    double ys = full ? 1.0 : 255.0 / 219.0;
+    double cs = full ? 1.0 : 255.0 / 224.0;
+
+    Coeffs c;
+    c.y_offset = full ? 0 : 16;
+    c.y_scale = (int) lrint(ys * 65536);
+    c.v_r = (int) lrint(cs * 2 * (1 - kr) * 65536);
+    c.u_g = (int) lrint(cs * 2 * (1 - kb) * kb / kg * 65536);
+    c.v_g = (int) lrint(cs * 2 * (1 - kr) * kr / kg * 65536);
+    c.u_b = (int) lrint(cs * 2 * (1 - kb) * 65536);
+    return c;
+}
+
+static inline uint8_t clamp8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+// bounds[i]..bounds[i + 1] is the source range of output element i
+static void make_bounds(int src, int dst, std::vector<int> *bounds) {
+    bounds->resize(dst + 1);
+    for (int i = 0; i <= dst; i++)
+        (*bounds)[i] = (int) ((int64_t) i * src / dst);
+}
+
+static void accumulate_rows(const ThumbKernelOps *o, bool high, uint16_t *acc, int n,
+    const uint8_t *plane, int linesize, int y0, int y1)
+{
+    memset(acc, 0, n * sizeof(uint16_t));
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *row = plane + (ptrdiff_t) y * linesize;
+        if (high)
+            o->accumulate_u16(acc, reinterpret_cast<const uint16_t*>(row), n);
+        else
+            o->accumulate_u8(acc, row, n);
+    }
+}
+
+bool thumb_kernel_scale(const AVFrame *frame, int width, int height, uint8_t *dst, int dst_stride) {
+    if (!thumb_kernel_supported(frame, width, height))
+        return false;
+
+    const ThumbKernelOps *o = ops();
+    const bool nv12 = frame->format == AV_PIX_FMT_NV12;
+    const bool high = frame->format == AV_PIX_FMT_YUV420P10;
+    // averages are brought down to 8 bits with this shift
+    const int shift = high ? 2 : 0;
+    const int src_w = frame->width, src_h = frame->height;
+    const int chroma_w = (src_w + 1) / 2, chroma_h = (src_h + 1) / 2;
+    const Coeffs c = make_coeffs(frame);
+
+    // Reused between calls on the same worker thread
+    static thread_local std::vector<int> xb, yb, cxb, cyb;
+    static thread_local std::vector<uint16_t> acc_y, acc_u, acc_v;
+    make_bounds(src_w, width, &xb);
+    make_bounds(src_h, height, &yb);
+    make_bounds(chroma_w, width, &cxb);
+    make_bounds(chroma_h, height, &cyb);
+    acc_y.resize(src_w);
+    acc_u.resize(nv12 ? chroma_w * 2 : chroma_w);
+    acc_v.resize(chroma_w);
+
+    for (int oy = 0; oy < height; oy++) {
+        const int rows = yb[oy + 1] - yb[oy];
+        const int chroma_rows = cyb[oy + 1] - cyb[oy];
+        accumulate_rows(o, high, acc_y.data(), src_w, frame->data[0], frame->linesize[0],
+            yb[oy], yb[oy + 1]);
+        if (nv12) {
+            accumulate_rows(o, false, acc_u.data(), chroma_w * 2, frame->data[1], frame->linesize[1],
+                cyb[oy], cyb[oy + 1]);
+        } else {
+            accumulate_rows(o, high, acc_u.data(), chroma_w, frame->data[1], frame->linesize[1],
+                cyb[oy], cyb[oy + 1]);
+            accumulate_rows(o, high, acc_v.data(), chroma_w, frame->data[2], frame->linesize[2],
+                cyb[oy], cyb[oy + 1]);
+        }
+
+        uint8_t *out = dst + (ptrdiff_t) oy * dst_stride;
+        for (int ox = 0; ox < width; ox++) {
+            uint32_t sum_y = 0, sum_u = 0, sum_v = 0;
+            for (int x = xb[ox]; x < xb[ox + 1]; x++)
+                sum_y += acc_y[x];
+            if (nv12) {
+                for (int x = cxb[ox]; x < cxb[ox + 1]; x++) {
+                    sum_u += acc_u[2 * x];
+                    sum_v += acc_u[2 * x + 1];
+                }
+            } else {
+                for (int x = cxb[ox]; x < cxb[ox + 1]; x++) {
+                    sum_u += acc_u[x];
+                    sum_v += acc_v[x];
+                }
+            }
+            uint32_t n_y = (uint32_t) rows * (xb[ox + 1] - xb[ox]) << shift;
+            uint32_t n_c = (uint32_t) chroma_rows * (cxb[ox + 1] - cxb[ox]) << shift;
+            int y = (int) ((sum_y + n_y / 2) / n_y);
+            int u = (int) ((sum_u + n_c / 2) / n_c) - 128;
+            int v = (int) ((sum_v + n_c / 2) / n_c) - 128;
+
+            int luma = (y - c.y_offset) * c.y_scale + (1 << 15);
+            out[4 * ox + 0] = clamp8((luma + c.u_b * u) >> 16);
+            out[4 * ox + 1] = clamp8((luma - c.u_g * u - c.v_g * v) >> 16);
+            out[4 * ox + 2] = clamp8((luma + c.v_r * v) >> 16);
+            out[4 * ox + 3] = 0xff;
+        }
+    }
+    return true;
+}
+
+// Rows looked at by thumb_kernel_luma_stats, spread over the frame
+static const int LUMA_SAMPLE_ROWS = 64;
+// Every this many pixels of a sampled row also go into the histogram
+static const int HISTOGRAM_STEP = 4;
+
+bool thumb_kernel_luma_stats(const AVFrame *frame, ThumbLumaStats *stats) {
+    switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_YUV420P10:
+        break;
+    default:
+        return false;
+    }
+    const int w = frame->width, h = frame->height;
+    if (w <= 0 || h <= 0)
+        return false;
+
+    const ThumbKernelOps *o = ops();
+    const bool high = frame->format == AV_PIX_FMT_YUV420P10;
+    const int step = std::max(1, h / LUMA_SAMPLE_ROWS);
+    uint64_t sum = 0, sum_sq = 0, count = 0;
+    uint32_t hist[16] = {}, hist_count = 0;
+
+    static thread_local std::vector<uint8_t> row8;
+    if (high)
+        row8.resize(w);
+
+    for (int y = step / 2; y < h; y += step) {
+        const uint8_t *row = frame->data[0] + (ptrdiff_t) y * frame->linesize[0];
+        if (high) {
+            const uint16_t *src = reinterpret_cast<const uint16_t*>(row);
+            for (int x = 0; x < w; x++)
+                row8[x] = src[x] >> 2;
+            row = row8.data();
+        }
+        o->sum_squares_u8(row, w, &sum, &sum_sq);
+        count += w;
+        for (int x = 0; x < w; x += HISTOGRAM_STEP)
+            hist[row[x] >> 4]++;
+        hist_count += (w + HISTOGRAM_STEP - 1) / HISTOGRAM_STEP;
+    }
+
+    double mean = (double) sum / count;
+    double var = (double) sum_sq / count - mean * mean;
+    stats->mean = mean;
+    stats->stddev = var > 0 ? sqrt(var) : 0;
+    stats->peak = (double) *std::max_element(hist, hist + 16) / hist_count;
+    return true;
+}
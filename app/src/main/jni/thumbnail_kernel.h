@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+// Fused box-filter downscale + YUV to BGRA conversion for the common decoder
+// output formats (yuv420p, yuvj420p, nv12, yuv420p10). Every source pixel is
+// read exactly once and there is no full-size intermediate, which makes it a
+// lot cheaper than swscale when the thumbnail is several times smaller than
+// the frame.
+
+// Row accumulation, the part that touches every source pixel.
+// Implemented once per instruction set and picked at runtime.
+struct ThumbKernelOps {
+    const char *name;
+    // acc[i] += src[i] for i < n
+    void (*accumulate_u8)(uint16_t *acc, const uint8_t *src, int n);
+    void (*accumulate_u16)(uint16_t *acc, const uint16_t *src, int n);
+    // *sum += src[i], *sum_sq += src[i]^2 for i < n
+    void (*sum_squares_u8)(const uint8_t *src, int n, uint64_t *sum, uint64_t *sum_sq);
+};
+
+extern const ThumbKernelOps thumb_kernel_scalar;
+#if defined(__ARM_NEON)
+extern const ThumbKernelOps thumb_kernel_neon;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+extern const ThumbKernelOps thumb_kernel_sse4;
+extern const ThumbKernelOps thumb_kernel_avx2;
+#endif
+
+// Whether thumb_kernel_scale handles this frame format and scale factor
+bool thumb_kernel_supported(const AVFrame *frame, int width, int height);
+
+// Scale frame into width x height BGRA pixels at dst, false if unsupported
+bool thumb_kernel_scale(const AVFrame *frame, int width, int height, uint8_t *dst, int dst_stride);
+
+// Brightness distribution of a frame, from a sample of its luma rows.
+// Levels are 8 bit regardless of the frame's depth.
+struct ThumbLumaStats {
+    double mean;
+    double stddev;
+    // share of samples in the fullest of 16 brightness bins, 1 for a flat image
+    double peak;
+};
+
+// False if the frame's format isn't one thumb_kernel_scale handles
+bool thumb_kernel_luma_stats(const AVFrame *frame, ThumbLumaStats *stats);
+
+// Implementation in use ("scalar", "neon", "sse4" or "avx2")
+const char *thumb_kernel_name();
+
+// Force an implementation by name, e.g. for benchmarks. False if it isn't
+// available on this CPU.
+bool thumb_kernel_select(const char *name);
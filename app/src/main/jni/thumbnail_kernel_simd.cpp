@@ -0,0 +1,167 @@
+#include <stdint.h>
+
+#include "thumbnail_kernel.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+static void accumulate_u8_neon(uint16_t *acc, const uint8_t *src, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(s)));
+        vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(s)));
+    }
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+static void accumulate_u16_neon(uint16_t *acc, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        vst1q_u16(acc + i, vaddq_u16(vld1q_u16(acc + i), vld1q_u16(src + i)));
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+static void sum_squares_u8_neon(const uint8_t *src, int n, uint64_t *sum, uint64_t *sum_sq) {
+    // 32 bit lanes hold up to 16k iterations of 4 * 255^2, far more than a row
+    uint32x4_t s = vdupq_n_u32(0), q = vdupq_n_u32(0);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        s = vpadalq_u16(s, vpaddlq_u8(v));
+        q = vpadalq_u16(q, vmull_u8(vget_low_u8(v), vget_low_u8(v)));
+        q = vpadalq_u16(q, vmull_u8(vget_high_u8(v), vget_high_u8(v)));
+    }
+    uint64_t ts = vgetq_lane_u64(vpaddlq_u32(s), 0) + vgetq_lane_u64(vpaddlq_u32(s), 1);
+    uint64_t tq = vgetq_lane_u64(vpaddlq_u32(q), 0) + vgetq_lane_u64(vpaddlq_u32(q), 1);
+    for (; i < n; i++) {
+        ts += src[i];
+        tq += src[i] * src[i];
+    }
+    *sum += ts;
+    *sum_sq += tq;
+}
+
+const ThumbKernelOps thumb_kernel_neon = {
+    "neon", accumulate_u8_neon, accumulate_u16_neon, sum_squares_u8_neon,
+};
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse4.1")))
+static void accumulate_u8_sse4(uint16_t *acc, const uint8_t *src, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_cvtepu8_epi16(s)));
+        _mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1),
+            _mm_cvtepu8_epi16(_mm_srli_si128(s, 8))));
+    }
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+__attribute__((target("sse4.1")))
+static void accumulate_u16_sse4(uint16_t *acc, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), s));
+    }
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+__attribute__((target("avx2")))
+static void accumulate_u8_avx2(uint16_t *acc, const uint8_t *src, int n) {
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+        __m256i *a = reinterpret_cast<__m256i*>(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), _mm256_cvtepu8_epi16(s0)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi16(_mm256_loadu_si256(a + 1), _mm256_cvtepu8_epi16(s1)));
+    }
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+__attribute__((target("avx2")))
+static void accumulate_u16_avx2(uint16_t *acc, const uint16_t *src, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i *a = reinterpret_cast<__m256i*>(acc + i);
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), s));
+    }
+    for (; i < n; i++)
+        acc[i] += src[i];
+}
+
+__attribute__((target("sse4.1")))
+static void sum_squares_u8_sse4(const uint8_t *src, int n, uint64_t *sum, uint64_t *sum_sq) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s = zero, q = zero;
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_cvtepu8_epi16(v), hi = _mm_unpackhi_epi8(v, zero);
+        s = _mm_add_epi64(s, _mm_sad_epu8(v, zero));
+        q = _mm_add_epi32(q, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+    uint64_t sl[2];
+    uint32_t ql[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sl), s);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ql), q);
+    uint64_t ts = sl[0] + sl[1];
+    uint64_t tq = (uint64_t) ql[0] + ql[1] + ql[2] + ql[3];
+    for (; i < n; i++) {
+        ts += src[i];
+        tq += src[i] * src[i];
+    }
+    *sum += ts;
+    *sum_sq += tq;
+}
+
+__attribute__((target("avx2")))
+static void sum_squares_u8_avx2(const uint8_t *src, int n, uint64_t *sum, uint64_t *sum_sq) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s = zero, q = zero;
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        s = _mm256_add_epi64(s, _mm256_sad_epu8(v, zero));
+        q = _mm256_add_epi32(q, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+    }
+    uint64_t sl[4];
+    uint32_t ql[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sl), s);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ql), q);
+    uint64_t ts = sl[0] + sl[1] + sl[2] + sl[3];
+    uint64_t tq = 0;
+    for (int k = 0; k < 8; k++)
+        tq += ql[k];
+    for (; i < n; i++) {
+        ts += src[i];
+        tq += src[i] * src[i];
+    }
+    *sum += ts;
+    *sum_sq += tq;
+}
+
+const ThumbKernelOps thumb_kernel_sse4 = {
+    "sse4", accumulate_u8_sse4, accumulate_u16_sse4, sum_squares_u8_sse4,
+};
+
+const ThumbKernelOps thumb_kernel_avx2 = {
+    "avx2", accumulate_u8_avx2, accumulate_u16_avx2, sum_squares_u8_avx2,
+};
+#endif
@@ -0,0 +1,98 @@
+#include <mutex>
+#include <list>
+#include <utility>
+#include <unordered_map>
+
+#include "thumbnail_memcache.h"
+#include "log.h"
+
+static const int64_t DEFAULT_LIMIT = 32 * 1024 * 1024;
+
+struct MemEntry {
+    uint64_t key;
+    std::shared_ptr<const ThumbImage> image;
+};
+
+static std::mutex g_mem_mutex;
+static std::list<MemEntry> g_mem_lru;  // most recently used first
+static std::unordered_map<uint64_t, std::list<MemEntry>::iterator> g_mem_map;
+static int64_t g_mem_bytes = 0;
+static int64_t g_mem_limit = DEFAULT_LIMIT;
+static int64_t g_mem_hits = 0;
+static int64_t g_mem_misses = 0;
+
+static int64_t entry_size(const ThumbImage &image) {
+    return (int64_t)image.pixels.size();
+}
+
+static void evict_to_locked(int64_t target) {
+    while (g_mem_bytes > target && !g_mem_lru.empty()) {
+        const MemEntry &e = g_mem_lru.back();
+        g_mem_bytes -= entry_size(*e.image);
+        g_mem_map.erase(e.key);
+        g_mem_lru.pop_back();
+    }
+}
+
+std::shared_ptr<const ThumbImage> thumb_mem_cache_get(uint64_t key) {
+    std::lock_guard<std::mutex> lock(g_mem_mutex);
+    auto it = g_mem_map.find(key);
+    if (it == g_mem_map.end()) {
+        g_mem_misses++;
+        return nullptr;
+    }
+    g_mem_hits++;
+    g_mem_lru.splice(g_mem_lru.begin(), g_mem_lru, it->second);
+    return it->second->image;
+}
+
+void thumb_mem_cache_put(uint64_t key, std::shared_ptr<const ThumbImage> image) {
+    if (!image)
+        return;
+    int64_t size = entry_size(*image);
+
+    std::lock_guard<std::mutex> lock(g_mem_mutex);
+    if (size > g_mem_limit)
+        return;
+
+    auto it = g_mem_map.find(key);
+    if (it != g_mem_map.end()) {
+        g_mem_bytes -= entry_size(*it->second->image);
+        g_mem_lru.erase(it->second);
+        g_mem_map.erase(it);
+    }
+    g_mem_lru.push_front(MemEntry{key, std::move(image)});
+    g_mem_map[key] = g_mem_lru.begin();
+    g_mem_bytes += size;
+    evict_to_locked(g_mem_limit);
+}
+
+void thumb_mem_cache_set_limit(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(g_mem_mutex);
+    g_mem_limit = bytes < 0 ? 0 : bytes;
+    evict_to_locked(g_mem_limit);
+}
+
+void thumb_mem_cache_trim(int keep_percent) {
+    if (keep_percent < 0)
+        keep_percent = 0;
+    if (keep_percent >= 100)
+        return;
+
+    std::lock_guard<std::mutex> lock(g_mem_mutex);
+    int64_t before = g_mem_bytes;
+    evict_to_locked(g_mem_bytes * keep_percent / 100);
+    ALOGV("Thumbnail | Memory cache trimmed from %lld to %lld bytes",
+        (long long)before, (long long)g_mem_bytes);
+}
+
+ThumbMemCacheStats thumb_mem_cache_stats() {
+    std::lock_guard<std::mutex> lock(g_mem_mutex);
+    ThumbMemCacheStats stats;
+    stats.hits = g_mem_hits;
+    stats.misses = g_mem_misses;
+    stats.entries = (int64_t)g_mem_lru.size();
+    stats.bytes = g_mem_bytes;
+    stats.limit = g_mem_limit;
+    return stats;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+
+#include "thumbnail_image.h"
+
+// In-memory LRU of scaled thumbnails, bounded by the total size of their pixels.
+// Keys are thumb_key() hashes.
+
+std::shared_ptr<const ThumbImage> thumb_mem_cache_get(uint64_t key);
+void thumb_mem_cache_put(uint64_t key, std::shared_ptr<const ThumbImage> image);
+
+void thumb_mem_cache_set_limit(int64_t bytes);
+
+// Shrink to keep_percent of the current size, 0 empties the cache
+void thumb_mem_cache_trim(int keep_percent);
+
+struct ThumbMemCacheStats {
+    int64_t hits;
+    int64_t misses;
+    int64_t entries;
+    int64_t bytes;
+    int64_t limit;
+};
+
+ThumbMemCacheStats thumb_mem_cache_stats();
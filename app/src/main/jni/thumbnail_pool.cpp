@@ -0,0 +1,139 @@
+#include <mutex>
+#include <list>
+#include <vector>
+#include <utility>
+
+#include "thumbnail_pool.h"
+#include "log.h"
+
+// Idle objects kept around; enough for every worker plus some source geometries
+static const size_t MAX_IDLE_SCALERS = 16;
+static const size_t MAX_IDLE_FRAMES = 16;
+static const size_t MAX_IDLE_PACKETS = 16;
+
+static std::mutex g_pool_mutex;
+// Most recently returned first
+static std::list<std::pair<ThumbScaler::Key, SwsContext*>> g_idle_scalers;
+static std::vector<AVFrame*> g_idle_frames;
+static std::vector<AVPacket*> g_idle_packets;
+static int64_t g_scaler_hits = 0;
+static int64_t g_scaler_misses = 0;
+
+bool ThumbScaler::Key::operator==(const Key &o) const {
+    return src_w == o.src_w && src_h == o.src_h && src_fmt == o.src_fmt &&
+        dst_w == o.dst_w && dst_h == o.dst_h && dst_fmt == o.dst_fmt && flags == o.flags;
+}
+
+ThumbScaler::ThumbScaler(int src_w, int src_h, AVPixelFormat src_fmt,
+    int dst_w, int dst_h, AVPixelFormat dst_fmt, int flags)
+    : key{src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt, flags}, ctx(nullptr)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        for (auto it = g_idle_scalers.begin(); it != g_idle_scalers.end(); ++it) {
+            if (it->first == key) {
+                ctx = it->second;
+                g_idle_scalers.erase(it);
+                g_scaler_hits++;
+                return;
+            }
+        }
+        g_scaler_misses++;
+    }
+    ctx = sws_getContext(src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt, flags, NULL, NULL, NULL);
+    if (!ctx)
+        ALOGE("Thumbnail | Failed to create scaler");
+}
+
+ThumbScaler::~ThumbScaler() {
+    if (!ctx)
+        return;
+    SwsContext *evicted = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        g_idle_scalers.emplace_front(key, ctx);
+        if (g_idle_scalers.size() > MAX_IDLE_SCALERS) {
+            evicted = g_idle_scalers.back().second;
+            g_idle_scalers.pop_back();
+        }
+    }
+    sws_freeContext(evicted);
+}
+
+ThumbPoolStats thumb_pool_stats() {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    ThumbPoolStats stats;
+    stats.scaler_hits = g_scaler_hits;
+    stats.scaler_misses = g_scaler_misses;
+    return stats;
+}
+
+AVFrame *thumb_frame_get() {
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        if (!g_idle_frames.empty()) {
+            AVFrame *frame = g_idle_frames.back();
+            g_idle_frames.pop_back();
+            return frame;
+        }
+    }
+    return av_frame_alloc();
+}
+
+void thumb_frame_put(AVFrame *frame) {
+    if (!frame)
+        return;
+    av_frame_unref(frame);
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        if (g_idle_frames.size() < MAX_IDLE_FRAMES) {
+            g_idle_frames.push_back(frame);
+            return;
+        }
+    }
+    av_frame_free(&frame);
+}
+
+AVPacket *thumb_packet_get() {
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        if (!g_idle_packets.empty()) {
+            AVPacket *packet = g_idle_packets.back();
+            g_idle_packets.pop_back();
+            return packet;
+        }
+    }
+    return av_packet_alloc();
+}
+
+void thumb_packet_put(AVPacket *packet) {
+    if (!packet)
+        return;
+    av_packet_unref(packet);
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        if (g_idle_packets.size() < MAX_IDLE_PACKETS) {
+            g_idle_packets.push_back(packet);
+            return;
+        }
+    }
+    av_packet_free(&packet);
+}
+
+void thumb_pool_clear() {
+    std::list<std::pair<ThumbScaler::Key, SwsContext*>> scalers;
+    std::vector<AVFrame*> frames;
+    std::vector<AVPacket*> packets;
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        scalers.swap(g_idle_scalers);
+        frames.swap(g_idle_frames);
+        packets.swap(g_idle_packets);
+    }
+    for (auto &s : scalers)
+        sws_freeContext(s.second);
+    for (AVFrame *f : frames)
+        av_frame_free(&f);
+    for (AVPacket *p : packets)
+        av_packet_free(&p);
+}
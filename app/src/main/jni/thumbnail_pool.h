@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/frame.h>
+    #include <libswscale/swscale.h>
+}
+
+// Reusable FFmpeg objects for the thumbnail path, so steady-state thumbnail
+// generation doesn't allocate outside the decoder.
+
+// A pooled SwsContext for one conversion (source geometry/format to destination
+// geometry/format/algorithm). Contexts go back to the pool on destruction and
+// are handed out again for the same conversion.
+class ThumbScaler {
+public:
+    ThumbScaler(int src_w, int src_h, AVPixelFormat src_fmt,
+        int dst_w, int dst_h, AVPixelFormat dst_fmt, int flags);
+    ~ThumbScaler();
+    ThumbScaler(const ThumbScaler&) = delete;
+    ThumbScaler& operator=(const ThumbScaler&) = delete;
+
+    SwsContext *get() const { return ctx; }
+    explicit operator bool() const { return ctx != nullptr; }
+
+    struct Key {
+        int src_w, src_h, src_fmt;
+        int dst_w, dst_h, dst_fmt;
+        int flags;
+        bool operator==(const Key &o) const;
+    };
+
+private:
+    Key key;
+    SwsContext *ctx;
+};
+
+struct ThumbPoolStats {
+    int64_t scaler_hits;
+    int64_t scaler_misses;
+};
+
+ThumbPoolStats thumb_pool_stats();
+
+// Frames are returned unreferenced, packets empty
+AVFrame *thumb_frame_get();
+void thumb_frame_put(AVFrame *frame);
+AVPacket *thumb_packet_get();
+void thumb_packet_put(AVPacket *packet);
+
+// Free all idle scalers, frames and packets
+void thumb_pool_clear();
@@ -0,0 +1,48 @@
+#include <mutex>
+#include <unordered_map>
+
+#include "thumbnail_request.h"
+#include "thumbnail_session.h"
+
+static std::unordered_map<int64_t, std::shared_ptr<ThumbRequest>> g_requests;
+static std::mutex g_requests_mutex;
+static int64_t g_next_id = 1;
+
+bool ThumbRequest::expired() const {
+    if (cancelled.load(std::memory_order_relaxed))
+        return true;
+    return deadline != std::chrono::steady_clock::time_point() &&
+        std::chrono::steady_clock::now() >= deadline;
+}
+
+int64_t thumb_request_create(int64_t timeout_ms) {
+    std::shared_ptr<ThumbRequest> r = std::make_shared<ThumbRequest>();
+    if (timeout_ms > 0)
+        r->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::lock_guard<std::mutex> lock(g_requests_mutex);
+    int64_t id = g_next_id++;
+    g_requests[id] = r;
+    return id;
+}
+
+std::shared_ptr<ThumbRequest> thumb_request_get(int64_t id) {
+    if (!id)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(g_requests_mutex);
+    auto it = g_requests.find(id);
+    return it != g_requests.end() ? it->second : nullptr;
+}
+
+void thumb_request_cancel(int64_t id) {
+    std::shared_ptr<ThumbRequest> r = thumb_request_get(id);
+    if (!r)
+        return;
+    r->cancelled = true;
+    // Let it stop waiting for a worker
+    thumb_session_wake_waiters();
+}
+
+void thumb_request_release(int64_t id) {
+    std::lock_guard<std::mutex> lock(g_requests_mutex);
+    g_requests.erase(id);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Cancellation token of a thumbnail request. Checked while waiting for a
+// worker, inside libavformat's IO (interrupt_callback) and between packets in
+// the decode loop, so abandoned requests stop within a packet or so.
+struct ThumbRequest {
+    std::atomic<bool> cancelled{false};
+    // zero if the request has no deadline
+    std::chrono::steady_clock::time_point deadline;
+
+    // Cancelled, or past the deadline
+    bool expired() const;
+};
+
+// Create a request, with a deadline timeout_ms from now if > 0. Returns its id.
+int64_t thumb_request_create(int64_t timeout_ms);
+
+// Look up a request by id, null for 0 or unknown ids
+std::shared_ptr<ThumbRequest> thumb_request_get(int64_t id);
+
+// Cancel a request, in-flight work for it gives up as soon as it notices
+void thumb_request_cancel(int64_t id);
+
+// Forget a request once the caller is done with it
+void thumb_request_release(int64_t id);
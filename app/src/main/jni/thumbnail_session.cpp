@@ -0,0 +1,887 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <mutex>
+#include <list>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <math.h>
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+#include "thumbnail_session.h"
+#include "thumbnail_pool.h"
+#include "thumbnail_storage.h"
+#include "thumbnail_io.h"
+#include "thumbnail_kernel.h"
+#include "thumbnail_cover.h"
+#include "thumbnail_stats.h"
+#include "log.h"
+
+// Sessions are evicted when unused for this long or when there are too many
+static const auto SESSION_IDLE_TIMEOUT = std::chrono::seconds(30);
+static const size_t MIN_SESSIONS = 4;
+static size_t g_max_sessions = MIN_SESSIONS;
+// Decoder threads per session, so that parallel workers don't oversubscribe the CPU.
+// Read by open_session without g_sessions_mutex.
+static std::atomic<int> g_decoder_threads(0);
+
+// Parallel decode limit, see ThumbWorkerSlot
+static const int MAX_DEFAULT_WORKERS = 4;
+static int default_workers();
+static std::mutex g_workers_mutex;
+static std::condition_variable g_workers_cond;
+static int g_workers = default_workers();
+static int g_workers_busy = 0;
+
+// Most recently used first
+static std::list<std::shared_ptr<ThumbSession>> g_sessions;
+static std::mutex g_sessions_mutex;
+
+// Codec cache for faster initialization
+struct CodecCacheEntry {
+    AVCodecID codec_id;
+    const AVCodec *codec;
+    std::chrono::steady_clock::time_point last_used;
+};
+
+static std::unordered_map<AVCodecID, CodecCacheEntry> g_codec_cache;
+static std::mutex g_codec_cache_mutex;
+
+// Hardware device context cache (expensive to create)
+static AVBufferRef *g_hw_device_ctx = nullptr;
+static std::mutex g_hw_ctx_mutex;
+static bool g_hw_ctx_initialized = false;
+static bool g_hw_ctx_available = false;
+
+// Get codec from cache or find it
+static const AVCodec* get_cached_codec(AVCodecID codec_id) {
+    std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
+
+    auto it = g_codec_cache.find(codec_id);
+    if (it != g_codec_cache.end()) {
+        it->second.last_used = std::chrono::steady_clock::now();
+        ALOGV("Thumbnail | Codec found in cache: %s", avcodec_get_name(codec_id));
+        return it->second.codec;
+    }
+
+    // Not in cache, find it
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    if (codec) {
+        g_codec_cache[codec_id] = {codec_id, codec, std::chrono::steady_clock::now()};
+        ALOGV("Thumbnail | Codec added to cache: %s", codec->name);
+    }
+
+    return codec;
+}
+
+// Initialize hardware device context once and reuse it
+static bool init_hw_device_context() {
+    std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
+
+    if (g_hw_ctx_initialized) {
+        return g_hw_ctx_available;
+    }
+
+    g_hw_ctx_initialized = true;
+
+    enum AVHWDeviceType hw_type = av_hwdevice_find_type_by_name("mediacodec");
+    if (hw_type == AV_HWDEVICE_TYPE_NONE) {
+        ALOGD("Thumbnail | MediaCodec not found, HW accel unavailable");
+        g_hw_ctx_available = false;
+        return false;
+    }
+
+    if (av_hwdevice_ctx_create(&g_hw_device_ctx, hw_type, NULL, NULL, 0) < 0) {
+        ALOGD("Thumbnail | Failed to create HW device context");
+        g_hw_ctx_available = false;
+        return false;
+    }
+
+    ALOGI("Thumbnail | Hardware device context initialized successfully");
+    g_hw_ctx_available = true;
+    return true;
+}
+
+void thumb_codec_cache_clear() {
+    std::lock_guard<std::mutex> lock(g_codec_cache_mutex);
+    g_codec_cache.clear();
+}
+
+void thumb_hw_context_release() {
+    std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
+    if (g_hw_device_ctx) {
+        av_buffer_unref(&g_hw_device_ctx);
+        g_hw_device_ctx = nullptr;
+    }
+    g_hw_ctx_initialized = false;
+    g_hw_ctx_available = false;
+}
+
+ThumbSession::~ThumbSession() {
+    if (codec_ctx)
+        avcodec_free_context(&codec_ctx);
+    if (cover_ctx)
+        avcodec_free_context(&cover_ctx);
+    if (format_ctx)
+        avformat_close_input(&format_ctx);
+    thumb_io_close(&io);
+}
+
+// Whether the container's own index is too sparse for fast seeking,
+// e.g. MPEG-TS or MKV written without cues
+static bool native_index_sparse(AVFormatContext *format_ctx, AVStream *st) {
+    int entries = avformat_index_get_entries_count(st);
+    if (entries <= 0)
+        return true;
+    if (format_ctx->duration <= 0)
+        return false;
+    double seconds = format_ctx->duration / (double)AV_TIME_BASE;
+    return entries < seconds / 10.0;
+}
+
+// Pick up the keyframe index once the background scan has produced it
+static void refresh_kf_index(ThumbSession *s) {
+    if (!s->wants_kf_index || s->kf_index)
+        return;
+    unsigned generation = thumb_index_generation();
+    if (s->kf_index_checked && generation == s->kf_index_generation)
+        return;
+    s->kf_index_checked = true;
+    s->kf_index_generation = generation;
+    std::shared_ptr<KeyframeIndex> index = thumb_index_load(s->path.c_str(), s->video_stream_idx,
+        s->video_stream->time_base);
+    if (index && index->count > 0) {
+        ALOGV("Thumbnail | Using keyframe index with %u entries", index->count);
+        s->kf_index = index;
+    }
+}
+
+// Decoder shortcuts per seek mode. They can be changed between packets.
+static void set_decode_mode(ThumbSession *s, ThumbSeekMode mode) {
+    AVCodecContext *codec_ctx = s->codec_ctx;
+
+    // For keyframe-only reads the demuxer skips everything else, where it
+    // supports that (mp4 doesn't even read the data), and decode drops
+    // whatever still gets through before it reaches the decoder.
+    s->keyframes_only = mode == THUMB_SEEK_KEYFRAME;
+    s->video_stream->discard = s->keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+
+    switch (mode) {
+    case THUMB_SEEK_KEYFRAME:
+        codec_ctx->skip_frame = AVDISCARD_NONKEY;
+        break;
+    case THUMB_SEEK_EXACT:
+        // Frames in between are references for the target, decode them properly
+        codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+        codec_ctx->skip_idct = AVDISCARD_DEFAULT;
+        codec_ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+        return;
+    default:
+        codec_ctx->skip_frame = AVDISCARD_NONREF;
+        break;
+    }
+    codec_ctx->skip_idct = AVDISCARD_BIDIR;
+    codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+}
+
+// MPEG-TS/PS packet offsets are valid resync points, so the index can jump straight
+// there. Elsewhere (e.g. MKV, where packets sit inside clusters) seek to the
+// keyframe's timestamp and let the demuxer find it.
+static bool prefers_byte_seek(const AVInputFormat *fmt) {
+    return (fmt->flags & AVFMT_TS_DISCONT) && !(fmt->flags & AVFMT_NO_BYTE_SEEK);
+}
+
+// Descriptor numbers get reused, so fd:// sessions are told apart by the file behind them
+static std::string session_key(const char *path) {
+    int fd;
+    ThumbFileId id;
+    if (!thumb_io_parse_fd(path, &fd) || !thumb_file_id(path, &id))
+        return path;
+    char key[32];
+    snprintf(key, sizeof(key), "fd:%016llx", (unsigned long long) id.hash);
+    return key;
+}
+
+// Lets libavformat abandon blocking IO (e.g. a stalled network source)
+static int interrupt_callback(void *opaque) {
+    ThumbSession *s = (ThumbSession*) opaque;
+    return s->request && s->request->expired();
+}
+
+static std::shared_ptr<ThumbSession> open_session(const char *path, const std::string &key, bool use_hw_dec,
+    const std::shared_ptr<ThumbRequest> &request)
+{
+    auto open_start = std::chrono::steady_clock::now();
+    std::shared_ptr<ThumbSession> s = std::make_shared<ThumbSession>();
+    s->path = path;
+    s->key = key;
+    s->use_hw_dec = use_hw_dec;
+    s->request = request;
+
+    s->format_ctx = avformat_alloc_context();
+    if (!s->format_ctx) {
+        ALOGE("Thumbnail | Failed to allocate format context");
+        return nullptr;
+    }
+    s->format_ctx->interrupt_callback.callback = interrupt_callback;
+    s->format_ctx->interrupt_callback.opaque = s.get();
+
+    // Local files and descriptors are read through our own IO
+    int fd;
+    bool is_fd = thumb_io_parse_fd(path, &fd);
+    s->io = thumb_io_open(path);
+    if (s->io) {
+        s->format_ctx->pb = s->io;
+        s->format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+        if (is_fd)
+            s->path = "fd://" + std::to_string(thumb_io_fd(s->io));
+    } else if (is_fd) {
+        ALOGE("Thumbnail | Invalid file descriptor");
+        return nullptr;
+    }
+
+    // Open video file
+    if (avformat_open_input(&s->format_ctx, path, NULL, NULL) < 0) {
+        ALOGE("Thumbnail | Failed to open file");
+        return nullptr;
+    }
+
+    // Cover art comes with the header. Files that have nothing else to show
+    // (music) need neither probing nor a video decoder.
+    s->cover_stream_idx = thumb_cover_stream(s->format_ctx);
+    if (s->cover_stream_idx >= 0 && !(s->format_ctx->ctx_flags & AVFMTCTX_NOHEADER) &&
+        !thumb_has_video(s->format_ctx)) {
+        for (unsigned int i = 0; i < s->format_ctx->nb_streams; i++)
+            s->format_ctx->streams[i]->discard = AVDISCARD_ALL;
+        s->cover_only = true;
+        thumb_stats_record(THUMB_STAGE_OPEN, thumb_stats_since(open_start));
+        return s;
+    }
+    int64_t open_us = thumb_stats_since(open_start);
+
+    // Find stream information (ultra-fast minimal analysis)
+    s->format_ctx->max_analyze_duration = 100000;
+    s->format_ctx->probesize = 500000;
+    s->format_ctx->fps_probe_size = 1;
+    s->format_ctx->max_ts_probe = 1;
+
+    {
+        ThumbStageTimer timer(THUMB_STAGE_PROBE);
+        if (avformat_find_stream_info(s->format_ctx, NULL) < 0) {
+            ALOGE("Thumbnail | Failed to find stream info");
+            return nullptr;
+        }
+    }
+    auto codec_start = std::chrono::steady_clock::now();
+
+    // Find video stream
+    AVCodecParameters *codec_params = NULL;
+
+    for (unsigned int i = 0; i < s->format_ctx->nb_streams; i++) {
+        AVStream *st = s->format_ctx->streams[i];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && !(st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            s->video_stream_idx = i;
+            codec_params = s->format_ctx->streams[i]->codecpar;
+            break;
+        }
+    }
+
+    if (s->video_stream_idx == -1) {
+        if (s->cover_stream_idx >= 0) {
+            // Only found out about the lack of video now, the cover art still works
+            for (unsigned int i = 0; i < s->format_ctx->nb_streams; i++)
+                s->format_ctx->streams[i]->discard = AVDISCARD_ALL;
+            s->cover_only = true;
+            thumb_stats_record(THUMB_STAGE_OPEN, open_us);
+            return s;
+        }
+        ALOGE("Thumbnail | No video stream found");
+        return nullptr;
+    }
+
+    s->video_stream = s->format_ctx->streams[s->video_stream_idx];
+
+    // Nothing but the video stream is ever decoded, let the demuxer skip the rest
+    for (unsigned int i = 0; i < s->format_ctx->nb_streams; i++) {
+        if ((int) i != s->video_stream_idx)
+            s->format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    // Initialize codec
+    const AVCodec *codec = get_cached_codec(codec_params->codec_id);
+    if (!codec) {
+        ALOGE("Thumbnail | Codec not found");
+        return nullptr;
+    }
+
+    s->codec_ctx = avcodec_alloc_context3(codec);
+    if (!s->codec_ctx) {
+        ALOGE("Thumbnail | Failed to allocate codec context");
+        return nullptr;
+    }
+
+    AVCodecContext *codec_ctx = s->codec_ctx;
+    if (avcodec_parameters_to_context(codec_ctx, codec_params) < 0) {
+        ALOGE("Thumbnail | Failed to copy codec params");
+        return nullptr;
+    }
+
+    // Optimized for speed
+    codec_ctx->thread_count = g_decoder_threads.load();
+    codec_ctx->thread_type = FF_THREAD_SLICE;
+    codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    set_decode_mode(s.get(), THUMB_SEEK_FAST);
+    codec_ctx->export_side_data = 0;
+    codec_ctx->err_recognition = 0;
+    codec_ctx->workaround_bugs = 0;
+    codec_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+
+    // Enable hardware decoding if requested
+    if (use_hw_dec && init_hw_device_context()) {
+        std::lock_guard<std::mutex> lock(g_hw_ctx_mutex);
+        if (g_hw_device_ctx) {
+            codec_ctx->hw_device_ctx = av_buffer_ref(g_hw_device_ctx);
+        }
+    }
+
+    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+        ALOGE("Thumbnail | Failed to open codec");
+        return nullptr;
+    }
+    thumb_stats_record(THUMB_STAGE_OPEN, open_us + thumb_stats_since(codec_start));
+
+    // Containers with sparse or missing seek indexes get one built in the background
+    if (native_index_sparse(s->format_ctx, s->video_stream)) {
+        s->wants_kf_index = true;
+        refresh_kf_index(s.get());
+        if (!s->kf_index)
+            thumb_index_request_build(s->path.c_str());
+    }
+
+    return s;
+}
+
+// Drop sessions that are idle for too long or exceed the session limit.
+// Sessions currently in use stay alive through their shared_ptr until released.
+static void evict_sessions_locked() {
+    auto now = std::chrono::steady_clock::now();
+    size_t unpinned = 0;
+    for (auto it = g_sessions.begin(); it != g_sessions.end();) {
+        ThumbSession *s = it->get();
+        if (s->pinned && !s->broken) {
+            ++it;
+            continue;
+        }
+        if (s->broken || now - s->last_used > SESSION_IDLE_TIMEOUT || unpinned >= g_max_sessions) {
+            ALOGV("Thumbnail | Closing session: %s", s->path.c_str());
+            it = g_sessions.erase(it);
+            continue;
+        }
+        unpinned++;
+        ++it;
+    }
+}
+
+std::shared_ptr<ThumbSession> thumb_session_acquire(const char *path, bool use_hw_dec,
+    const std::shared_ptr<ThumbRequest> &request)
+{
+    std::string key = session_key(path);
+    {
+        std::lock_guard<std::mutex> lock(g_sessions_mutex);
+        evict_sessions_locked();
+        for (auto it = g_sessions.begin(); it != g_sessions.end(); ++it) {
+            if ((*it)->key != key || (*it)->use_hw_dec != use_hw_dec)
+                continue;
+            // Another worker is decoding from this one
+            if (!(*it)->lock.try_lock())
+                continue;
+            std::shared_ptr<ThumbSession> s = *it;
+            s->last_used = std::chrono::steady_clock::now();
+            s->request = request;
+            g_sessions.splice(g_sessions.begin(), g_sessions, it);
+            return s;
+        }
+    }
+
+    // Opening is slow, don't block other lookups meanwhile
+    std::shared_ptr<ThumbSession> s = open_session(path, key, use_hw_dec, request);
+    if (!s)
+        return nullptr;
+    s->lock.lock();
+    s->last_used = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    g_sessions.push_front(s);
+    evict_sessions_locked();
+    return s;
+}
+
+bool thumb_session_open(const char *path, bool use_hw_dec) {
+    std::shared_ptr<ThumbSession> s = thumb_session_acquire(path, use_hw_dec);
+    if (!s)
+        return false;
+    std::lock_guard<std::mutex> session_lock(s->lock, std::adopt_lock);
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    s->pinned++;
+    return true;
+}
+
+static int default_workers() {
+    int cores = (int) std::thread::hardware_concurrency();
+    return std::min(std::max(cores / 2, 1), MAX_DEFAULT_WORKERS);
+}
+
+void thumb_session_set_workers(int workers) {
+    if (workers <= 0)
+        workers = default_workers();
+    int cores = (int) std::thread::hardware_concurrency();
+    {
+        std::lock_guard<std::mutex> lock(g_workers_mutex);
+        g_workers = workers;
+    }
+    g_workers_cond.notify_all();
+
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    g_max_sessions = std::max(MIN_SESSIONS, (size_t) workers);
+    g_decoder_threads = (workers > 1 && cores > 0) ? std::max(1, cores / workers) : 0;
+    evict_sessions_locked();
+}
+
+int thumb_session_workers() {
+    std::lock_guard<std::mutex> lock(g_workers_mutex);
+    return g_workers;
+}
+
+// Deadlines aren't signalled, waiters look at the clock this often
+static const auto WORKER_WAIT_POLL = std::chrono::milliseconds(50);
+
+ThumbWorkerSlot::ThumbWorkerSlot(const ThumbRequest *request) {
+    std::unique_lock<std::mutex> lock(g_workers_mutex);
+    while (g_workers_busy >= g_workers) {
+        if (request && request->expired())
+            return;
+        if (request)
+            g_workers_cond.wait_for(lock, WORKER_WAIT_POLL);
+        else
+            g_workers_cond.wait(lock);
+    }
+    g_workers_busy++;
+    m_acquired = true;
+}
+
+ThumbWorkerSlot::~ThumbWorkerSlot() {
+    if (!m_acquired)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(g_workers_mutex);
+        g_workers_busy--;
+    }
+    g_workers_cond.notify_one();
+}
+
+void thumb_session_wake_waiters() {
+    std::lock_guard<std::mutex> lock(g_workers_mutex);
+    g_workers_cond.notify_all();
+}
+
+void thumb_session_close(const char *path) {
+    std::string key = session_key(path);
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    auto pinned = std::find_if(g_sessions.begin(), g_sessions.end(),
+        [&key] (const std::shared_ptr<ThumbSession> &s) { return s->key == key && s->pinned > 0; });
+    if (pinned == g_sessions.end() || --(*pinned)->pinned > 0)
+        return;
+    // Last handle closed, the file's sessions go right away
+    for (auto it = g_sessions.begin(); it != g_sessions.end();) {
+        if ((*it)->key == key && !(*it)->pinned)
+            it = g_sessions.erase(it);
+        else
+            ++it;
+    }
+}
+
+void thumb_session_clear(bool include_pinned) {
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    for (auto it = g_sessions.begin(); it != g_sessions.end();) {
+        if (include_pinned || !(*it)->pinned)
+            it = g_sessions.erase(it);
+        else
+            ++it;
+    }
+}
+
+static int64_t seconds_to_stream_ts(AVStream *st, double seconds) {
+    return av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AVRational{1, AV_TIME_BASE}, st->time_base);
+}
+
+static double frame_seconds(AVStream *st, const AVFrame *frame) {
+    if (frame->pts != AV_NOPTS_VALUE)
+        return frame->pts * av_q2d(st->time_base);
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        return frame->best_effort_timestamp * av_q2d(st->time_base);
+    return 0.0;
+}
+
+// Jump to the indexed keyframe at or before position
+static bool seek_with_index(ThumbSession *s, double position) {
+    const KeyframeIndexEntry *e = s->kf_index->find_before(seconds_to_stream_ts(s->video_stream, position));
+    if (!e)
+        return false;
+    int ret;
+    if (e->pos >= 0 && prefers_byte_seek(s->format_ctx->iformat))
+        ret = av_seek_frame(s->format_ctx, s->video_stream_idx, e->pos, AVSEEK_FLAG_BYTE);
+    else
+        ret = av_seek_frame(s->format_ctx, s->video_stream_idx, e->pts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0)
+        return false;
+    avcodec_flush_buffers(s->codec_ctx);
+    return true;
+}
+
+void thumb_session_seek(ThumbSession *s, double position, int seek_flags) {
+    ThumbStageTimer timer(THUMB_STAGE_SEEK);
+    refresh_kf_index(s);
+
+    if (s->kf_index && position > 1.0 && seek_with_index(s, position)) {
+        s->needs_rewind = true;
+        return;
+    }
+
+    // Seek to position (skip if near start of a freshly opened file)
+    if (position > 1.0 && position < INT64_MAX / AV_TIME_BASE) {
+        if (av_seek_frame(s->format_ctx, s->video_stream_idx,
+                          seconds_to_stream_ts(s->video_stream, position), seek_flags) < 0) {
+            ALOGW("Thumbnail | Seek failed, using first frame");
+        }
+        avcodec_flush_buffers(s->codec_ctx);
+    } else if (s->needs_rewind) {
+        AVStream *st = s->video_stream;
+        int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+        if (av_seek_frame(s->format_ctx, s->video_stream_idx, start, AVSEEK_FLAG_BACKWARD) < 0) {
+            ALOGW("Thumbnail | Rewind failed");
+        }
+        avcodec_flush_buffers(s->codec_ctx);
+    }
+    s->needs_rewind = true;
+}
+
+bool thumb_session_decode(ThumbSession *s, double target, double tolerance,
+    AVFrame *frame, double *frame_time, int max_frames, bool accept_last)
+{
+    ThumbStageTimer timer(THUMB_STAGE_DECODE);
+    AVPacket *packet = thumb_packet_get();
+    AVFrame *last = accept_last ? thumb_frame_get() : NULL;
+    if (!packet || (accept_last && !last)) {
+        ALOGE("Thumbnail | Failed to allocate packet");
+        thumb_packet_put(packet);
+        thumb_frame_put(last);
+        return false;
+    }
+
+    bool frame_found = false;
+    bool draining = false;
+    bool cancelled = false;
+    int frames_decoded = 0;
+    int packets_read = 0;
+    double last_time = 0.0;
+
+    // Frames left in the decoder from a previous call come first,
+    // this is what lets batch requests decode forward without seeking.
+    while (frames_decoded < max_frames) {
+        int ret = avcodec_receive_frame(s->codec_ctx, frame);
+        if (ret >= 0) {
+            frames_decoded++;
+            double t = frame_seconds(s->video_stream, frame);
+            // Accept first frame within tolerance of the target
+            if (t >= target - tolerance) {
+                *frame_time = t;
+                frame_found = true;
+                break;
+            }
+            if (last) {
+                av_frame_unref(last);
+                av_frame_move_ref(last, frame);
+                last_time = t;
+            } else {
+                av_frame_unref(frame);
+            }
+            continue;
+        }
+        if (ret != AVERROR(EAGAIN) || draining)
+            break;
+        if (s->request && s->request->expired()) {
+            cancelled = true;
+            break;
+        }
+
+        // Decoder wants more input
+        ret = av_read_frame(s->format_ctx, packet);
+        if (ret == AVERROR_EXIT) {
+            // Interrupted in the middle of IO, the demuxer's state is anyone's guess
+            s->broken = true;
+            cancelled = true;
+            break;
+        }
+        if (ret < 0) {
+            // End of file, flush out whatever the decoder still holds
+            avcodec_send_packet(s->codec_ctx, NULL);
+            draining = true;
+            continue;
+        }
+        packets_read++;
+        if (packet->stream_index == s->video_stream_idx &&
+            (!s->keyframes_only || (packet->flags & AV_PKT_FLAG_KEY)))
+            avcodec_send_packet(s->codec_ctx, packet);
+        av_packet_unref(packet);
+    }
+
+    thumb_packet_put(packet);
+    if (!frame_found && !cancelled && last && last->buf[0]) {
+        // Ran out of budget (or file), the closest frame before the target will do
+        av_frame_move_ref(frame, last);
+        *frame_time = last_time;
+        frame_found = true;
+    }
+    thumb_frame_put(last);
+    if (draining) {
+        // Decoder can't take new packets until flushed
+        s->broken = !frame_found;
+    }
+    thumb_stats_add(THUMB_COUNT_FRAMES, frames_decoded);
+    thumb_stats_add(THUMB_COUNT_PACKETS, packets_read);
+    ALOGV("Thumbnail | Decoded %d frames from %d packets%s", frames_decoded, packets_read,
+        cancelled ? ", cancelled" : "");
+    return frame_found;
+}
+
+double thumb_session_keyframe_before(ThumbSession *s, double position) {
+    AVStream *st = s->video_stream;
+    if (!st)
+        return -1;
+    if (s->kf_index) {
+        const KeyframeIndexEntry *e = s->kf_index->find_before(seconds_to_stream_ts(st, position));
+        return e ? e->pts * av_q2d(st->time_base) : -1;
+    }
+    if (avformat_index_get_entries_count(st) <= 0)
+        return -1;
+    int64_t ts = seconds_to_stream_ts(st, position);
+    int idx = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+    if (idx < 0)
+        return -1;
+    const AVIndexEntry *e = avformat_index_get_entry(st, idx);
+    if (!e)
+        return -1;
+    return e->timestamp * av_q2d(st->time_base);
+}
+
+double thumb_session_keyframe_after(ThumbSession *s, double position) {
+    AVStream *st = s->video_stream;
+    if (!st)
+        return -1;
+    int64_t ts = seconds_to_stream_ts(st, position);
+    if (s->kf_index) {
+        const KeyframeIndex *idx = s->kf_index.get();
+        const KeyframeIndexEntry *e = idx->find_before(ts);
+        if (!e)
+            e = idx->count > 0 ? idx->entries : nullptr;
+        else if (e->pts < ts)
+            e = e + 1 < idx->entries + idx->count ? e + 1 : nullptr;
+        return e ? e->pts * av_q2d(st->time_base) : -1;
+    }
+    if (avformat_index_get_entries_count(st) <= 0)
+        return -1;
+    int i = av_index_search_timestamp(st, ts, 0);
+    if (i < 0)
+        return -1;
+    const AVIndexEntry *e = avformat_index_get_entry(st, i);
+    if (!e)
+        return -1;
+    return e->timestamp * av_q2d(st->time_base);
+}
+
+double thumb_session_duration(ThumbSession *s) {
+    if (s->format_ctx->duration > 0)
+        return s->format_ctx->duration / (double) AV_TIME_BASE;
+    AVStream *st = s->video_stream;
+    if (st && st->duration > 0)
+        return st->duration * av_q2d(st->time_base);
+    return 0;
+}
+
+// FAST: accept the first frame within this many seconds of the target
+static const double FAST_MATCH_TOLERANCE = 5.0;
+// EXACT: frames decoded from the keyframe before giving up on reaching the target
+static const int EXACT_MAX_FRAMES = 600;
+
+bool thumb_session_grab(ThumbSession *s, double position, ThumbSeekMode mode,
+    AVFrame *frame, double *frame_time)
+{
+    // cover art only, nothing to seek in
+    if (s->cover_only)
+        return false;
+
+    bool found;
+    switch (mode) {
+    case THUMB_SEEK_KEYFRAME:
+        set_decode_mode(s, mode);
+        thumb_session_seek(s, position, AVSEEK_FLAG_BACKWARD);
+        // Only keyframes come out of the decoder, the first one is it
+        found = thumb_session_decode(s, position, INFINITY, frame, frame_time, 1);
+        break;
+    case THUMB_SEEK_EXACT: {
+        set_decode_mode(s, mode);
+        thumb_session_seek(s, position, AVSEEK_FLAG_BACKWARD);
+        // Anything within half a frame of the target is the target
+        AVRational fps = av_guess_frame_rate(s->format_ctx, s->video_stream, NULL);
+        double tolerance = fps.num > 0 && fps.den > 0 ? 0.5 / av_q2d(fps) : 0.02;
+        found = thumb_session_decode(s, position, tolerance, frame, frame_time, EXACT_MAX_FRAMES, true);
+        break;
+    }
+    default:
+        thumb_session_seek(s, position, AVSEEK_FLAG_ANY);
+        found = thumb_session_decode(s, position, FAST_MATCH_TOLERANCE, frame, frame_time);
+        break;
+    }
+    set_decode_mode(s, THUMB_SEEK_FAST);
+    return found;
+}
+
+// Batch targets are decoded up to, so they can afford to be precise
+static const double BATCH_MATCH_TOLERANCE = 0.5;
+// Without an index, decode forward instead of seeking if the next target is this close
+static const double BATCH_FORWARD_WINDOW = 2.0;
+// Frames decoded past the estimate before settling for the last one, for
+// frame rate guesses that are off and reordered B-frames
+static const int BATCH_SLACK_FRAMES = 16;
+
+// Roughly how many frames there are from one time to another
+static int frames_between(ThumbSession *s, double from, double to) {
+    AVRational fps = av_guess_frame_rate(s->format_ctx, s->video_stream, NULL);
+    double rate = fps.num > 0 && fps.den > 0 ? av_q2d(fps) : 30.0;
+    return (int) ceil((to - from) * rate);
+}
+
+bool thumb_session_grab_next(ThumbSession *s, double position, double last_time,
+    AVFrame *frame, double *frame_time, bool *seeked)
+{
+    *seeked = false;
+    if (s->cover_only)
+        return false;
+
+    // Keep decoding if the target is in the GOP we're already in,
+    // otherwise start over at the keyframe before it
+    double keyframe = thumb_session_keyframe_before(s, position);
+    bool forward = false;
+    if (last_time >= 0 && position > last_time) {
+        if (keyframe >= 0)
+            forward = keyframe <= last_time;
+        else
+            forward = position - last_time <= BATCH_FORWARD_WINDOW;
+    }
+
+    // Only decode up to the target if that fits the budget, long GOPs
+    // settle for a frame close to the target instead
+    double from = forward ? last_time : keyframe;
+    int frames = from >= 0 ? frames_between(s, from, position) : -1;
+    bool found = false;
+    if (frames >= 0 && frames <= EXACT_MAX_FRAMES) {
+        if (!forward) {
+            thumb_session_seek(s, position, AVSEEK_FLAG_BACKWARD);
+            *seeked = true;
+        }
+        found = thumb_session_decode(s, position, BATCH_MATCH_TOLERANCE, frame, frame_time,
+            frames + BATCH_SLACK_FRAMES, true);
+    }
+    if (!found && !(s->request && s->request->expired())) {
+        found = thumb_session_grab(s, position, THUMB_SEEK_FAST, frame, frame_time);
+        *seeked = true;
+    }
+    return found;
+}
+
+// Representative frames: a frame counts as blank below this luma deviation...
+static const double BLANK_MAX_STDDEV = 12.0;
+// ...or when this share of it sits in a single brightness bin
+static const double BLANK_MIN_PEAK = 0.85;
+// Keyframes tried after a blank frame, each one twice as far as the one before
+static const int REPRESENTATIVE_MAX_TRIES = 6;
+static const double REPRESENTATIVE_FIRST_STEP = 2.0;
+
+static bool frame_is_blank(const AVFrame *frame) {
+    ThumbLumaStats stats;
+    // Formats we can't look at are taken as they are
+    if (!thumb_kernel_luma_stats(frame, &stats))
+        return false;
+    return stats.stddev < BLANK_MAX_STDDEV || stats.peak > BLANK_MIN_PEAK;
+}
+
+bool thumb_session_grab_representative(ThumbSession *s, double position, ThumbSeekMode mode,
+    AVFrame *frame, double *frame_time)
+{
+    if (!thumb_session_grab(s, position, mode, frame, frame_time))
+        return false;
+    if (!frame_is_blank(frame))
+        return true;
+
+    AVFrame *candidate = thumb_frame_get();
+    if (!candidate)
+        return true;
+
+    double duration = thumb_session_duration(s);
+    double t = *frame_time, step = REPRESENTATIVE_FIRST_STEP;
+    int tries = 0;
+    set_decode_mode(s, THUMB_SEEK_KEYFRAME);
+    for (; tries < REPRESENTATIVE_MAX_TRIES; tries++, step *= 2) {
+        double target = t + step;
+        if (duration > 0 && target >= duration)
+            break;
+        // Land on the first keyframe past target: the indexed one if known,
+        // otherwise a forward seek does the same
+        double keyframe = thumb_session_keyframe_after(s, target);
+        if (keyframe >= 0)
+            thumb_session_seek(s, keyframe, AVSEEK_FLAG_BACKWARD);
+        else
+            thumb_session_seek(s, target, 0);
+
+        double candidate_time;
+        if (!thumb_session_decode(s, target, INFINITY, candidate, &candidate_time, 1))
+            break;
+        if (candidate_time <= t) {
+            // No keyframes past the last one
+            av_frame_unref(candidate);
+            break;
+        }
+        t = candidate_time;
+        if (!frame_is_blank(candidate)) {
+            av_frame_unref(frame);
+            av_frame_move_ref(frame, candidate);
+            *frame_time = t;
+            break;
+        }
+        av_frame_unref(candidate);
+    }
+    set_decode_mode(s, THUMB_SEEK_FAST);
+    thumb_frame_put(candidate);
+    ALOGV("Thumbnail | Representative frame at %.3fs after %d tries", *frame_time, tries);
+    return true;
+}
+
+bool thumb_session_grab_cover(ThumbSession *s, int dimension, AVFrame *frame) {
+    if (s->cover_stream_idx < 0)
+        return false;
+    ThumbStageTimer timer(THUMB_STAGE_DECODE);
+    if (!thumb_cover_decode(s->format_ctx->streams[s->cover_stream_idx], dimension, &s->cover_ctx, frame))
+        return false;
+    thumb_stats_add(THUMB_COUNT_FRAMES);
+    return true;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <atomic>
+
+#include "thumbnail_index.h"
+#include "thumbnail_request.h"
+
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+}
+
+// An opened demuxer + decoder pair for a single file.
+// Sessions are kept around between thumbnail requests so that scrubbing
+// the same file only has to seek, flush and decode.
+struct ThumbSession {
+    // what was opened; for fd:// inputs this names the session's own descriptor
+    std::string path;
+    // what requests are matched against: the path, or the file's identity for fd:// inputs
+    std::string key;
+    bool use_hw_dec = false;
+
+    AVFormatContext *format_ctx = nullptr;
+    // our own input for local files, null if libavformat does the IO
+    AVIOContext *io = nullptr;
+    AVCodecContext *codec_ctx = nullptr;
+    AVStream *video_stream = nullptr;
+    int video_stream_idx = -1;
+
+    // stream with embedded cover art, -1 if none
+    int cover_stream_idx = -1;
+    // nothing but cover art (e.g. music): no video decoder, video_stream is null
+    bool cover_only = false;
+    AVCodecContext *cover_ctx = nullptr;
+
+    // keyframe index from a background scan, for files the container doesn't index well
+    std::shared_ptr<KeyframeIndex> kf_index;
+    bool wants_kf_index = false;
+    bool kf_index_checked = false;
+    unsigned kf_index_generation = 0;
+
+    // demuxer has been read from since the last seek (or since opening)
+    bool needs_rewind = false;
+    // only keyframe packets are passed to the decoder (THUMB_SEEK_KEYFRAME)
+    bool keyframes_only = false;
+    // open handles from openThumbnailSession, exempt from eviction while there are any
+    int pinned = 0;
+    // decoder state is unknown, drop the session instead of reusing it
+    std::atomic<bool> broken{false};
+
+    std::chrono::steady_clock::time_point last_used;
+
+    // request currently being served, null if none; interrupts IO and decoding once expired
+    std::shared_ptr<ThumbRequest> request;
+
+    // held by whoever is currently decoding from this session
+    std::mutex lock;
+
+    ~ThumbSession();
+};
+
+// Get an idle cached session for path or open a new one. Returns null on failure.
+// path may also be fd://N for an open file descriptor, which the session duplicates.
+// The session is returned with its lock held, so no other worker can use it
+// until the caller unlocks it. Opening and everything done with the session
+// until the next acquire gives up once request expires.
+std::shared_ptr<ThumbSession> thumb_session_acquire(const char *path, bool use_hw_dec,
+    const std::shared_ptr<ThumbRequest> &request = nullptr);
+
+// Pin / unpin a session so it survives idle eviction. Pins are counted, the
+// session stays pinned until every open has been matched by a close.
+bool thumb_session_open(const char *path, bool use_hw_dec);
+void thumb_session_close(const char *path);
+
+// Limit how many decodes run in parallel (0 picks a default for this device).
+// Also sizes the session cache and per-decoder threading to match.
+void thumb_session_set_workers(int workers);
+int thumb_session_workers();
+
+// Held for the duration of a decode, waits while all workers are busy.
+// Stops waiting without a slot if request expires meanwhile.
+class ThumbWorkerSlot {
+public:
+    explicit ThumbWorkerSlot(const ThumbRequest *request = nullptr);
+    ~ThumbWorkerSlot();
+    ThumbWorkerSlot(const ThumbWorkerSlot&) = delete;
+    ThumbWorkerSlot& operator=(const ThumbWorkerSlot&) = delete;
+
+    bool acquired() const { return m_acquired; }
+
+private:
+    bool m_acquired = false;
+};
+
+// Make waiting ThumbWorkerSlots check their requests again
+void thumb_session_wake_waiters();
+
+// Drop cached sessions. Pinned sessions are only dropped if include_pinned is set.
+void thumb_session_clear(bool include_pinned);
+
+// Seek so that decoding continues at (or, for AVSEEK_FLAG_BACKWARD, before) position.
+// Positions near the start rewind to the first frame instead.
+void thumb_session_seek(ThumbSession *s, double position, int seek_flags);
+
+// Decode forward until a frame at or after target - tolerance is found,
+// giving up after max_frames or when the session's request expires. With accept_last the last frame decoded is
+// returned instead of failing if no frame gets close enough.
+// On success the frame is left in frame and its time in *frame_time.
+bool thumb_session_decode(ThumbSession *s, double target, double tolerance,
+    AVFrame *frame, double *frame_time, int max_frames = 100, bool accept_last = false);
+
+// How closely a thumbnail has to match the requested position
+enum ThumbSeekMode {
+    THUMB_SEEK_FAST = 0,        // any frame within a few seconds of the target
+    THUMB_SEEK_KEYFRAME = 1,    // keyframe at or before the target, nothing else read or decoded
+    THUMB_SEEK_EXACT = 2,       // decode from the previous keyframe up to the target
+};
+
+// Seek to position and decode a frame for it according to mode
+bool thumb_session_grab(ThumbSession *s, double position, ThumbSeekMode mode,
+    AVFrame *frame, double *frame_time);
+
+// Next target of a batch (targets in ascending order): decode forward from
+// where the decoder is (last_time, the previous frame returned, -1 if unknown)
+// when that is cheaper than a seek, otherwise from the keyframe before the
+// target. Falls back to a FAST grab if the target is too far from either.
+// *seeked tells whether it had to seek.
+bool thumb_session_grab_next(ThumbSession *s, double position, double last_time,
+    AVFrame *frame, double *frame_time, bool *seeked);
+
+// Like thumb_session_grab, but if the frame is blank (black, a fade, a flat
+// colour or a small logo on black) move on through the following keyframes,
+// within a budget, until one has some content. Falls back to the first frame.
+bool thumb_session_grab_representative(ThumbSession *s, double position, ThumbSeekMode mode,
+    AVFrame *frame, double *frame_time);
+
+// Decode the session's cover art, see thumb_cover_decode
+bool thumb_session_grab_cover(ThumbSession *s, int dimension, AVFrame *frame);
+
+// Time of the indexed keyframe at or before position, or -1 if unknown
+double thumb_session_keyframe_before(ThumbSession *s, double position);
+// Time of the indexed keyframe at or after position, or -1 if unknown
+double thumb_session_keyframe_after(ThumbSession *s, double position);
+
+// Length of the file in seconds, 0 if unknown
+double thumb_session_duration(ThumbSession *s);
+
+// Shared codec lookup and hwdevice context, used when opening sessions
+void thumb_codec_cache_clear();
+void thumb_hw_context_release();
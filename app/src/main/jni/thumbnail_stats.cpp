@@ -0,0 +1,109 @@
+#include <string.h>
+#include <atomic>
+
+#include "thumbnail_stats.h"
+#include "log.h"
+
+struct StageHistogram {
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> total_us;
+    std::atomic<int64_t> max_us;
+    std::atomic<int64_t> buckets[THUMB_STATS_BUCKETS];
+};
+
+static StageHistogram g_stages[THUMB_STAGE_COUNT];
+static std::atomic<int64_t> g_counters[THUMB_COUNTER_COUNT];
+
+// Sums for the request the current thread is working on
+struct RequestMetrics {
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    int64_t stage_us[THUMB_STAGE_COUNT];
+    int64_t counters[THUMB_COUNTER_COUNT];
+};
+
+static thread_local RequestMetrics t_request;
+
+static int bucket_for(int64_t us) {
+    int64_t ms = us / 1000;
+    int bucket = 0;
+    while (ms > 0 && bucket < THUMB_STATS_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void thumb_stats_record(ThumbStage stage, int64_t us) {
+    StageHistogram &h = g_stages[stage];
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.total_us.fetch_add(us, std::memory_order_relaxed);
+    h.buckets[bucket_for(us)].fetch_add(1, std::memory_order_relaxed);
+    int64_t max = h.max_us.load(std::memory_order_relaxed);
+    while (us > max && !h.max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+
+    if (t_request.active)
+        t_request.stage_us[stage] += us;
+}
+
+void thumb_stats_add(ThumbCounter counter, int64_t n) {
+    g_counters[counter].fetch_add(n, std::memory_order_relaxed);
+    if (t_request.active)
+        t_request.counters[counter] += n;
+}
+
+void thumb_stats_begin() {
+    memset(&t_request.stage_us, 0, sizeof(t_request.stage_us));
+    memset(&t_request.counters, 0, sizeof(t_request.counters));
+    t_request.start = std::chrono::steady_clock::now();
+    t_request.active = true;
+    thumb_stats_add(THUMB_COUNT_REQUESTS);
+}
+
+void thumb_stats_end(const char *what, bool ok) {
+    if (!t_request.active)
+        return;
+    if (!ok)
+        thumb_stats_add(THUMB_COUNT_FAILURES);
+    thumb_stats_record(THUMB_STAGE_TOTAL, thumb_stats_since(t_request.start));
+    t_request.active = false;
+
+    const int64_t *us = t_request.stage_us;
+    const int64_t *n = t_request.counters;
+    ALOGV("Thumbnail | %s%s: open %.1f probe %.1f seek %.1f decode %.1f scale %.1f bitmap %.1f "
+        "total %.1fms, %lld frames, %lld packets, %lld KiB read, %lld seeks, %lld cache hits",
+        what, ok ? "" : " (failed)",
+        us[THUMB_STAGE_OPEN] / 1000.0, us[THUMB_STAGE_PROBE] / 1000.0,
+        us[THUMB_STAGE_SEEK] / 1000.0, us[THUMB_STAGE_DECODE] / 1000.0,
+        us[THUMB_STAGE_SCALE] / 1000.0, us[THUMB_STAGE_BITMAP] / 1000.0,
+        us[THUMB_STAGE_TOTAL] / 1000.0,
+        (long long) n[THUMB_COUNT_FRAMES], (long long) n[THUMB_COUNT_PACKETS],
+        (long long) (n[THUMB_COUNT_BYTES_READ] / 1024), (long long) n[THUMB_COUNT_IO_SEEKS],
+        (long long) n[THUMB_COUNT_CACHE_HITS]);
+}
+
+void thumb_stats_get(ThumbStageStats stages[THUMB_STAGE_COUNT], int64_t counters[THUMB_COUNTER_COUNT]) {
+    for (int i = 0; i < THUMB_STAGE_COUNT; i++) {
+        const StageHistogram &h = g_stages[i];
+        stages[i].count = h.count.load(std::memory_order_relaxed);
+        stages[i].total_us = h.total_us.load(std::memory_order_relaxed);
+        stages[i].max_us = h.max_us.load(std::memory_order_relaxed);
+        for (int b = 0; b < THUMB_STATS_BUCKETS; b++)
+            stages[i].buckets[b] = h.buckets[b].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < THUMB_COUNTER_COUNT; i++)
+        counters[i] = g_counters[i].load(std::memory_order_relaxed);
+}
+
+void thumb_stats_reset() {
+    for (int i = 0; i < THUMB_STAGE_COUNT; i++) {
+        StageHistogram &h = g_stages[i];
+        h.count = 0;
+        h.total_us = 0;
+        h.max_us = 0;
+        for (int b = 0; b < THUMB_STATS_BUCKETS; b++)
+            h.buckets[b] = 0;
+    }
+    for (int i = 0; i < THUMB_COUNTER_COUNT; i++)
+        g_counters[i] = 0;
+}
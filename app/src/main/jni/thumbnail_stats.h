@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+// Where the time of a thumbnail request goes. Every stage feeds a histogram
+// shared by all workers, and the stages of the request a thread is working
+// on are summed up for a single log line at its end.
+
+enum ThumbStage {
+    THUMB_STAGE_OPEN,     // opening the input and decoder, without probing
+    THUMB_STAGE_PROBE,    // avformat_find_stream_info
+    THUMB_STAGE_SEEK,
+    THUMB_STAGE_DECODE,   // reading packets and decoding up to the target
+    THUMB_STAGE_SCALE,
+    THUMB_STAGE_BITMAP,   // creating or filling the Java Bitmap
+    THUMB_STAGE_TOTAL,    // whole request, cached or not
+    THUMB_STAGE_COUNT
+};
+
+enum ThumbCounter {
+    THUMB_COUNT_REQUESTS,
+    THUMB_COUNT_CACHE_HITS,
+    THUMB_COUNT_FAILURES,
+    THUMB_COUNT_FRAMES,       // frames out of the decoder
+    THUMB_COUNT_PACKETS,      // packets out of the demuxer
+    THUMB_COUNT_BYTES_READ,   // through thumb_io, i.e. local files and fd:// only
+    THUMB_COUNT_IO_SEEKS,     // thumb_io seeks that moved the read position
+    THUMB_COUNTER_COUNT
+};
+
+// Buckets are powers of two in milliseconds: < 1ms, < 2ms, < 4ms, ... and
+// everything from 16s up in the last one
+static const int THUMB_STATS_BUCKETS = 16;
+
+struct ThumbStageStats {
+    int64_t count;
+    int64_t total_us;
+    int64_t max_us;
+    int64_t buckets[THUMB_STATS_BUCKETS];
+};
+
+void thumb_stats_record(ThumbStage stage, int64_t us);
+void thumb_stats_add(ThumbCounter counter, int64_t n = 1);
+
+inline int64_t thumb_stats_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Times the enclosing scope as stage
+class ThumbStageTimer {
+public:
+    explicit ThumbStageTimer(ThumbStage stage)
+        : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+    ~ThumbStageTimer() { thumb_stats_record(m_stage, thumb_stats_since(m_start)); }
+    ThumbStageTimer(const ThumbStageTimer&) = delete;
+    ThumbStageTimer& operator=(const ThumbStageTimer&) = delete;
+
+private:
+    ThumbStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Start and finish the per-request sums of the calling thread. Finishing
+// records THUMB_STAGE_TOTAL and logs the breakdown, tagged with what.
+void thumb_stats_begin();
+void thumb_stats_end(const char *what, bool ok);
+
+// thumb_stats_begin/end for the enclosing scope, failed unless ok gets set
+class ThumbStatsScope {
+public:
+    explicit ThumbStatsScope(const char *what) : m_what(what) { thumb_stats_begin(); }
+    ~ThumbStatsScope() { thumb_stats_end(m_what, ok); }
+    ThumbStatsScope(const ThumbStatsScope&) = delete;
+    ThumbStatsScope& operator=(const ThumbStatsScope&) = delete;
+
+    bool ok = false;
+
+private:
+    const char *m_what;
+};
+
+void thumb_stats_get(ThumbStageStats stages[THUMB_STAGE_COUNT], int64_t counters[THUMB_COUNTER_COUNT]);
+void thumb_stats_reset();
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <mutex>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "thumbnail_storage.h"
+#include "thumbnail_io.h"
+#include "log.h"
+
+static std::string g_cache_dir;
+static std::mutex g_cache_dir_mutex;
+
+uint64_t thumb_hash(const void *data, size_t len, uint64_t seed) {
+    // FNV-1a, plenty for cache file names
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool thumb_file_id(const char *path, ThumbFileId *id) {
+    int fd;
+    bool is_fd = thumb_io_parse_fd(path, &fd);
+    if (!strncmp(path, "file://", 7))
+        path += 7;
+    struct stat st;
+    if ((is_fd ? fstat(fd, &st) : stat(path, &st)) < 0 || !S_ISREG(st.st_mode))
+        return false;
+    id->size = st.st_size;
+    id->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    // The number of a descriptor says nothing about the file, its inode does
+    uint64_t h;
+    if (is_fd) {
+        uint64_t inode[2] = { (uint64_t) st.st_dev, (uint64_t) st.st_ino };
+        h = thumb_hash(inode, sizeof(inode));
+    } else {
+        h = thumb_hash(path, strlen(path));
+    }
+    h = thumb_hash(&id->size, sizeof(id->size), h);
+    h = thumb_hash(&id->mtime_ns, sizeof(id->mtime_ns), h);
+    id->hash = h;
+    return true;
+}
+
+ThumbKey thumb_key(const char *path, double position, int dimension, int variant, bool exact) {
+    ThumbKey key;
+    ThumbFileId id;
+    if (thumb_file_id(path, &id)) {
+        key.hash = id.hash;
+        key.persistent = true;
+    } else {
+        key.hash = thumb_hash(path, strlen(path));
+    }
+    // Thumbnails within the same second share an entry, exact ones are kept to the millisecond
+    int64_t bucket = exact ? (int64_t) llround(position * 1000) : (int64_t)(position + 0.5);
+    key.hash = thumb_hash(&bucket, sizeof(bucket), key.hash);
+    key.hash = thumb_hash(&dimension, sizeof(dimension), key.hash);
+    if (variant)
+        key.hash = thumb_hash(&variant, sizeof(variant), key.hash);
+    return key;
+}
+
+void thumb_set_cache_dir(const char *dir) {
+    std::lock_guard<std::mutex> lock(g_cache_dir_mutex);
+    g_cache_dir = dir ? dir : "";
+    if (!g_cache_dir.empty() && mkdir(g_cache_dir.c_str(), 0700) < 0 && errno != EEXIST) {
+        ALOGE("Thumbnail | Failed to create cache dir %s", g_cache_dir.c_str());
+        g_cache_dir.clear();
+    }
+}
+
+std::string thumb_cache_subdir(const char *name) {
+    std::lock_guard<std::mutex> lock(g_cache_dir_mutex);
+    if (g_cache_dir.empty())
+        return std::string();
+    std::string dir = g_cache_dir + "/" + name;
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+        return std::string();
+    return dir;
+}
+
+bool thumb_write_file_atomic(const std::string &path, const void *data, size_t len) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, p + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    if (done != len || rename(tmp.c_str(), path.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
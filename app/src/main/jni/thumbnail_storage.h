@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Identity of a local file as used by the on-disk thumbnail caches.
+// Changing the file (size or mtime) changes the hash.
+struct ThumbFileId {
+    int64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+};
+
+// Works for local paths and fd://N, fails for anything else (e.g. network URLs)
+bool thumb_file_id(const char *path, ThumbFileId *id);
+
+uint64_t thumb_hash(const void *data, size_t len, uint64_t seed = 0xcbf29ce484222325ULL);
+
+// Cache key of a thumbnail. Keys of local files also cover the file's size and
+// mtime and stay valid across restarts (persistent), others only hash the path.
+struct ThumbKey {
+    uint64_t hash = 0;
+    bool persistent = false;
+};
+
+// variant distinguishes thumbnails of the same position made differently (e.g. seek mode).
+// Positions within the same second share a key, unless exact is set.
+ThumbKey thumb_key(const char *path, double position, int dimension, int variant = 0, bool exact = false);
+
+// Root directory for persistent thumbnail data, set from FastThumbnails.initialize
+void thumb_set_cache_dir(const char *dir);
+
+// Path of a subdirectory of the cache dir (created on demand), empty if there's no cache dir
+std::string thumb_cache_subdir(const char *name);
+
+// Write a whole file through a temporary so readers never see it half-written
+bool thumb_write_file_atomic(const std::string &path, const void *data, size_t len);
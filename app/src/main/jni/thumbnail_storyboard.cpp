@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <string>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "thumbnail_storyboard.h"
+#include "thumbnail_session.h"
+#include "thumbnail_storage.h"
+#include "thumbnail_image.h"
+#include "thumbnail_pool.h"
+#include "log.h"
+
+static const char STORYBOARD_MAGIC[4] = { 'M', 'S', 'B', 'I' };
+// 2: tile_dimension in the header
+static const uint32_t STORYBOARD_VERSION = 2;
+static const char *INDEX_NAME = "/storyboard.idx";
+
+// Longer files get a proportionally larger interval rather than more tiles
+static const uint32_t MAX_ENTRIES = 20000;
+
+static std::string sheet_path(const std::string &dir, uint32_t sheet) {
+    char name[32];
+    snprintf(name, sizeof(name), "/sheet-%04u.jpg", sheet);
+    return dir + name;
+}
+
+static uint64_t source_hash(const char *path) {
+    ThumbFileId id;
+    if (thumb_file_id(path, &id))
+        return id.hash;
+    return thumb_hash(path, strlen(path));
+}
+
+static std::string default_dir(uint64_t file_hash, const StoryboardParams &p) {
+    if (thumb_cache_subdir("storyboards").empty())
+        return std::string();
+    uint64_t h = thumb_hash(&p.interval, sizeof(p.interval), file_hash);
+    h = thumb_hash(&p.tile_dimension, sizeof(p.tile_dimension), h);
+    h = thumb_hash(&p.columns, sizeof(p.columns), h);
+    h = thumb_hash(&p.rows, sizeof(p.rows), h);
+    char name[48];
+    snprintf(name, sizeof(name), "storyboards/%016llx", (unsigned long long) h);
+    return thumb_cache_subdir(name);
+}
+
+// Whether dir already holds a complete storyboard for this file and parameters
+static bool is_current(const std::string &index, uint64_t file_hash, const StoryboardParams &p) {
+    int fd = open(index.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    StoryboardHeader hdr;
+    bool ok = read(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr);
+    close(fd);
+    return ok && !memcmp(hdr.magic, STORYBOARD_MAGIC, sizeof(hdr.magic)) &&
+        hdr.version == STORYBOARD_VERSION && hdr.file_hash == file_hash &&
+        (hdr.interval == p.interval || (hdr.count == MAX_ENTRIES && hdr.interval > p.interval)) &&
+        hdr.columns == (uint32_t) p.columns &&
+        hdr.rows == (uint32_t) p.rows &&
+        hdr.tile_dimension == (uint32_t) p.tile_dimension;
+}
+
+// Keyframe closest to position if the file's index knows, otherwise position itself
+static double nearest_keyframe(ThumbSession *s, double position) {
+    double before = thumb_session_keyframe_before(s, position);
+    double after = thumb_session_keyframe_after(s, position);
+    if (before < 0)
+        return after < 0 ? position : after;
+    if (after < 0)
+        return before;
+    return position - before <= after - position ? before : after;
+}
+
+static bool write_sheet(const std::string &dir, uint32_t sheet, const ThumbImage &image) {
+    std::vector<uint8_t> jpeg;
+    if (!thumb_encode_jpeg(image, &jpeg))
+        return false;
+    return thumb_write_file_atomic(sheet_path(dir, sheet), jpeg.data(), jpeg.size());
+}
+
+std::string thumb_storyboard_build(const char *path, const char *out_dir, const StoryboardParams &params,
+    const std::shared_ptr<ThumbRequest> &request)
+{
+    if (params.interval <= 0 || params.tile_dimension <= 0 || params.columns <= 0 || params.rows <= 0) {
+        ALOGE("Thumbnail | Storyboard: invalid parameters");
+        return std::string();
+    }
+
+    uint64_t file_hash = source_hash(path);
+    std::string dir = out_dir && *out_dir ? std::string(out_dir) : default_dir(file_hash, params);
+    if (dir.empty() || (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)) {
+        ALOGE("Thumbnail | Storyboard: no output directory");
+        return std::string();
+    }
+    std::string index = dir + INDEX_NAME;
+    if (is_current(index, file_hash, params))
+        return index;
+
+    ThumbWorkerSlot slot(request.get());
+    if (!slot.acquired())
+        return std::string();
+    std::shared_ptr<ThumbSession> session = thumb_session_acquire(path, params.use_hw_dec, request);
+    if (!session)
+        return std::string();
+    std::lock_guard<std::mutex> session_lock(session->lock, std::adopt_lock);
+    ThumbSession *s = session.get();
+    if (s->cover_only) {
+        ALOGE("Thumbnail | Storyboard: no video, only cover art");
+        return std::string();
+    }
+
+    double duration = thumb_session_duration(s);
+    if (duration <= 0) {
+        ALOGE("Thumbnail | Storyboard: unknown duration");
+        return std::string();
+    }
+    double interval = params.interval;
+    uint32_t count = (uint32_t) ceil(duration / interval);
+    if (count > MAX_ENTRIES) {
+        count = MAX_ENTRIES;
+        interval = duration / count;
+    }
+    if (count == 0)
+        count = 1;
+
+    const uint32_t per_sheet = params.columns * params.rows;
+    StoryboardHeader hdr;
+    memcpy(hdr.magic, STORYBOARD_MAGIC, sizeof(hdr.magic));
+    hdr.version = STORYBOARD_VERSION;
+    hdr.file_hash = file_hash;
+    hdr.interval = interval;
+    hdr.columns = params.columns;
+    hdr.rows = params.rows;
+    hdr.sheet_count = (count + per_sheet - 1) / per_sheet;
+    hdr.count = count;
+    hdr.tile_width = hdr.tile_height = 0;
+    hdr.tile_dimension = params.tile_dimension;
+    hdr.reserved = 0;
+
+    std::vector<StoryboardEntry> entries(count);
+    ThumbImage sheet, tile;
+    AVFrame *frame = thumb_frame_get();
+    if (!frame)
+        return std::string();
+
+    double last_target = -1, last_pts = -1;
+    bool have_tile = false, ok = true;
+    int decoded = 0;
+
+    for (uint32_t i = 0; i < count && ok; i++) {
+        if (request && request->expired()) {
+            // Sheets written so far are left for the next attempt to overwrite
+            ALOGI("Thumbnail | Storyboard: cancelled at %u/%u", i, count);
+            thumb_frame_put(frame);
+            return std::string();
+        }
+        double target = nearest_keyframe(s, i * interval);
+
+        // Intervals shorter than the GOP share a keyframe, decode it once
+        if (!have_tile || target != last_target) {
+            double frame_time;
+            if (thumb_session_grab(s, target, THUMB_SEEK_KEYFRAME, frame, &frame_time)) {
+                if (!have_tile) {
+                    // The first frame fixes the tile size for the whole storyboard
+                    int w, h;
+                    thumb_fit_dimension(frame->width, frame->height, params.tile_dimension, &w, &h);
+                    tile.width = w;
+                    tile.height = h;
+                    tile.pixels.resize((size_t) w * h * 4);
+                    hdr.tile_width = w;
+                    hdr.tile_height = h;
+                    sheet.width = w * params.columns;
+                    sheet.height = h * params.rows;
+                }
+                if (frame_time != last_pts || !have_tile) {
+                    ok = thumb_scale_frame_into(frame, tile.width, tile.height,
+                        tile.pixels.data(), tile.stride());
+                    decoded++;
+                }
+                last_pts = frame_time;
+                have_tile = ok;
+                av_frame_unref(frame);
+            } else if (!have_tile) {
+                ALOGE("Thumbnail | Storyboard: failed to decode first frame");
+                ok = false;
+                break;
+            }
+            // On a failed grab the slot keeps showing the previous tile
+            last_target = target;
+        }
+
+        uint32_t sheet_no = i / per_sheet, cell = i % per_sheet;
+        if (cell == 0) {
+            // Fresh sheet, unused cells stay black
+            sheet.pixels.assign((size_t) sheet.width * sheet.height * 4, 0);
+            for (size_t p = 3; p < sheet.pixels.size(); p += 4)
+                sheet.pixels[p] = 0xff;
+        }
+        int x = (cell % params.columns) * tile.width;
+        int y = (cell / params.columns) * tile.height;
+        for (int row = 0; row < tile.height; row++) {
+            memcpy(sheet.pixels.data() + (size_t) (y + row) * sheet.stride() + x * 4,
+                tile.pixels.data() + (size_t) row * tile.stride(), tile.stride());
+        }
+        entries[i].pts = last_pts;
+        entries[i].sheet = sheet_no;
+        entries[i].x = x;
+        entries[i].y = y;
+
+        if (cell == per_sheet - 1 || i == count - 1)
+            ok = write_sheet(dir, sheet_no, sheet);
+    }
+    thumb_frame_put(frame);
+
+    if (!ok) {
+        session->broken = true;
+        ALOGE("Thumbnail | Storyboard: failed");
+        return std::string();
+    }
+
+    // The index goes last, its presence marks the storyboard as complete
+    std::vector<uint8_t> data(sizeof(hdr) + entries.size() * sizeof(StoryboardEntry));
+    memcpy(data.data(), &hdr, sizeof(hdr));
+    memcpy(data.data() + sizeof(hdr), entries.data(), entries.size() * sizeof(StoryboardEntry));
+    if (!thumb_write_file_atomic(index, data.data(), data.size()))
+        return std::string();
+
+    ALOGI("Thumbnail | Storyboard: %u tiles from %d frames in %u sheets", count, decoded, hdr.sheet_count);
+    return index;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+
+#include "thumbnail_request.h"
+
+// Trickplay storyboards: the keyframe nearest to every interval of the file,
+// tiled into fixed grid JPEG sprite sheets, plus a binary index mapping times
+// to tiles. Built once with a keyframe seek per interval, after which scrubbing
+// previews are a lookup into the sheets instead of a decode.
+//
+// Directory layout:
+//   storyboard.idx      StoryboardHeader, then StoryboardEntry[count] in time order
+//   sheet-0000.jpg ...  columns x rows tiles each, row-major
+// The index holds the structs below as they are in memory, in native byte order;
+// it is a cache on the device that made it, not an exchange format.
+
+struct StoryboardParams {
+    double interval = 10.0;     // seconds between tiles
+    int tile_dimension = 160;   // longest side of a tile
+    int columns = 10;
+    int rows = 10;
+    bool use_hw_dec = true;
+};
+
+struct StoryboardHeader {
+    char magic[4];          // "MSBI"
+    uint32_t version;
+    uint64_t file_hash;     // ThumbFileId hash of the source
+    double interval;        // entry i is for time i * interval
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t sheet_count;
+    uint32_t count;
+    uint32_t tile_dimension;    // as requested, tiles of small sources come out smaller
+    uint32_t reserved;
+};
+
+struct StoryboardEntry {
+    double pts;             // time of the frame shown, in seconds
+    uint32_t sheet;
+    uint16_t x;             // top left corner of the tile in the sheet
+    uint16_t y;
+};
+
+// Build the storyboard for path into dir (a per-file directory under the
+// cache dir if dir is null). An existing storyboard for the same version of
+// the file and the same parameters is reused. Returns the index path, or an
+// empty string on failure or once request (if any) expires.
+std::string thumb_storyboard_build(const char *path, const char *dir, const StoryboardParams &params,
+    const std::shared_ptr<ThumbRequest> &request = nullptr);